@@ -0,0 +1,712 @@
+// clock_gettime
+#define _POSIX_C_SOURCE 199309L
+
+#include "lwjson.h"
+#include "lwjsonCorpus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LWJSON_BENCH_CYCLES     1
+#endif
+
+// Max path elements of a lookup, terminator included
+#define LWJSON_BENCH_PATH_MAX       (8)
+
+// Entries written by each generation benchmark
+#define LWJSON_BENCH_ENTRIES        (64)
+
+// Values of each bulk array entry
+#define LWJSON_BENCH_BULK_VALUES    (16)
+
+// Generation buffer, large enough for every generation benchmark
+#define LWJSON_BENCH_OUTPUT_LEN     (16 * 1024)
+
+// Int slots of the template benchmarks
+#define LWJSON_BENCH_TEMPLATE_SAMPLES   (16)
+
+// Default min measuring time per benchmark
+#define LWJSON_BENCH_MIN_MS         (100)
+
+// Generator under test
+typedef enum {
+    LWJSON_BENCH_NONE = 0,
+    LWJSON_BENCH_STRING_TO_OBJECT,
+    LWJSON_BENCH_STRING_TO_ARRAY,
+    LWJSON_BENCH_INT_TO_OBJECT,
+    LWJSON_BENCH_INT_TO_ARRAY,
+    LWJSON_BENCH_DOUBLE_TO_OBJECT,
+    LWJSON_BENCH_DOUBLE_TO_ARRAY,
+    LWJSON_BENCH_FLOAT_TO_OBJECT,
+    LWJSON_BENCH_FLOAT_TO_ARRAY,
+    LWJSON_BENCH_FIXED_DOUBLE_TO_OBJECT,
+    LWJSON_BENCH_FIXED_DOUBLE_TO_ARRAY,
+    LWJSON_BENCH_BOOLEAN_TO_OBJECT,
+    LWJSON_BENCH_BOOLEAN_TO_ARRAY,
+    LWJSON_BENCH_OBJECT_TO_OBJECT,
+    LWJSON_BENCH_OBJECT_TO_ARRAY,
+    LWJSON_BENCH_ARRAY_TO_OBJECT,
+    LWJSON_BENCH_ARRAY_TO_ARRAY,
+    LWJSON_BENCH_NULL_TO_OBJECT,
+    LWJSON_BENCH_NULL_TO_ARRAY,
+    LWJSON_BENCH_APPEND_OBJECT,
+    LWJSON_BENCH_STRING_TO_OBJECT_KEY,
+    LWJSON_BENCH_INT_TO_OBJECT_KEY,
+    LWJSON_BENCH_DOUBLE_TO_OBJECT_KEY,
+    LWJSON_BENCH_FLOAT_TO_OBJECT_KEY,
+    LWJSON_BENCH_FIXED_DOUBLE_TO_OBJECT_KEY,
+    LWJSON_BENCH_BOOLEAN_TO_OBJECT_KEY,
+    LWJSON_BENCH_OBJECT_TO_OBJECT_KEY,
+    LWJSON_BENCH_ARRAY_TO_OBJECT_KEY,
+    LWJSON_BENCH_NULL_TO_OBJECT_KEY,
+    LWJSON_BENCH_INT_ARRAY,
+    LWJSON_BENCH_DOUBLE_ARRAY,
+    LWJSON_BENCH_BOOLEAN_ARRAY,
+    LWJSON_BENCH_STRING_ARRAY,
+    LWJSON_BENCH_INT_SLOT_TO_OBJECT,
+    LWJSON_BENCH_INT_SLOT_TO_ARRAY,
+    LWJSON_BENCH_DOUBLE_SLOT_TO_OBJECT,
+    LWJSON_BENCH_DOUBLE_SLOT_TO_ARRAY,
+    LWJSON_BENCH_FIXED_DOUBLE_SLOT_TO_OBJECT,
+    LWJSON_BENCH_FIXED_DOUBLE_SLOT_TO_ARRAY,
+    LWJSON_BENCH_STRING_SLOT_TO_OBJECT,
+    LWJSON_BENCH_STRING_SLOT_TO_ARRAY,
+    LWJSON_BENCH_BOOLEAN_SLOT_TO_OBJECT,
+    LWJSON_BENCH_BOOLEAN_SLOT_TO_ARRAY
+} LwJsonBenchAdd;
+
+typedef struct LwJsonBench LwJsonBench;
+
+// Runs one operation. Returns a negative errno on failure and sets the processed bytes
+typedef int (*LwJsonBenchRun)(const LwJsonBench *bench, uint32_t *bytes);
+
+struct LwJsonBench {
+    const char *name;
+    const char *variant;
+    LwJsonCorpusId corpus;
+    LwJsonBenchRun run;
+    const char *path[LWJSON_BENCH_PATH_MAX];
+    LwJsonBenchAdd add;
+};
+
+// Telemetry template, built once for the fill and compact benchmarks
+typedef struct {
+    char string[LWJSON_BENCH_OUTPUT_LEN];
+    LwJsonMsg msg;
+    LwJsonSlot slots[LWJSON_BENCH_TEMPLATE_SAMPLES + 6];
+    LwJsonTemplate tpl;
+    int device;
+    int seq;
+    int temp;
+    int ratio;
+    int online;
+    int samples;
+} LwJsonBenchTemplate;
+
+typedef struct {
+    uint64_t iterations;
+    uint64_t ns;
+    uint64_t cycles;
+    uint32_t bytes;
+} LwJsonBenchResult;
+
+static int BenchGetObject(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchGetArray(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchGetArrayLen(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchGetIntArray(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchGetStringArray(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchGetString(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchGetInt(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchGetBool(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchGetIntLines(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchAdd(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchAddEntry(LwJsonMsg *msg, LwJsonTemplate *tpl, LwJsonBenchAdd add, uint32_t i);
+static bool BenchAddToArray(LwJsonBenchAdd add);
+static int BenchTemplateFill(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchTemplateCompact(const LwJsonBench *bench, uint32_t *bytes);
+static int BenchTemplateBuild(void);
+static int BenchMeasure(const LwJsonBench *bench, uint64_t minNs, LwJsonBenchResult *result);
+static void BenchPrint(const LwJsonBench *bench, const LwJsonBenchResult *result, bool json, bool first);
+static uint64_t BenchNowNs(void);
+static uint64_t BenchCycles(void);
+
+static LwJsonCorpus corpus[LWJSON_CORPUS_COUNT];
+static LwJsonBenchTemplate benchTemplate;
+
+// Keeps lookups and generation from being optimized away
+static volatile int benchSink;
+
+static const LwJsonBench benches[] = {
+    // Lookups by field position
+    {"lwJsonGetInt", "pos=first", LWJSON_CORPUS_WIDE, BenchGetInt, {"f000"}},
+    {"lwJsonGetInt", "pos=middle", LWJSON_CORPUS_WIDE, BenchGetInt, {"f128"}},
+    {"lwJsonGetInt", "pos=last", LWJSON_CORPUS_WIDE, BenchGetInt, {"f255"}},
+    {"lwJsonGetInt", "pos=missing", LWJSON_CORPUS_WIDE, BenchGetInt, {"f999"}},
+    // Lookups by path depth
+    {"lwJsonGetInt", "depth=1", LWJSON_CORPUS_DEEP, BenchGetInt, {"value"}},
+    {"lwJsonGetInt", "depth=2", LWJSON_CORPUS_DEEP, BenchGetInt, {"next", "value"}},
+    {"lwJsonGetInt", "depth=3", LWJSON_CORPUS_DEEP, BenchGetInt, {"next", "next", "value"}},
+    {"lwJsonGetInt", "depth=4", LWJSON_CORPUS_DEEP, BenchGetInt, {"next", "next", "next", "value"}},
+    {"lwJsonGetInt", "depth=5", LWJSON_CORPUS_DEEP, BenchGetInt, {"next", "next", "next", "next", "value"}},
+    {"lwJsonGetInt", "depth=6", LWJSON_CORPUS_DEEP, BenchGetInt, {"next", "next", "next", "next", "next", "value"}},
+    {"lwJsonGetInt", "depth=7", LWJSON_CORPUS_DEEP, BenchGetInt, {"next", "next", "next", "next", "next", "next", "value"}},
+    {"lwJsonGetObject", "depth=1", LWJSON_CORPUS_DEEP, BenchGetObject, {"next"}},
+    {"lwJsonGetObject", "depth=6", LWJSON_CORPUS_DEEP, BenchGetObject, {"next", "next", "next", "next", "next", "next"}},
+    {"lwJsonGetBool", "depth=1", LWJSON_CORPUS_DEEP, BenchGetBool, {"enabled"}},
+    {"lwJsonGetBool", "depth=7", LWJSON_CORPUS_DEEP, BenchGetBool, {"next", "next", "next", "next", "next", "next", "enabled"}},
+    // Lookups by corpus
+    {"lwJsonGetInt", "telemetry", LWJSON_CORPUS_TELEMETRY, BenchGetInt, {"humidity"}},
+    {"lwJsonGetString", "telemetry", LWJSON_CORPUS_TELEMETRY, BenchGetString, {"fw"}},
+    {"lwJsonGetBool", "telemetry", LWJSON_CORPUS_TELEMETRY, BenchGetBool, {"online"}},
+    {"lwJsonGetObject", "telemetry", LWJSON_CORPUS_TELEMETRY, BenchGetObject, {"location"}},
+    {"lwJsonGetArray", "numeric", LWJSON_CORPUS_NUMERIC, BenchGetArray, {"samples"}},
+    {"lwJsonGetArrayLen", "numeric", LWJSON_CORPUS_NUMERIC, BenchGetArrayLen, {"samples"}},
+    {"lwJsonGetIntArray", "numeric", LWJSON_CORPUS_NUMERIC, BenchGetIntArray, {"samples"}},
+    {"lwJsonGetArrayLen", "log", LWJSON_CORPUS_LOG, BenchGetArrayLen, {"entries"}},
+    {"lwJsonGetStringArray", "log", LWJSON_CORPUS_LOG, BenchGetStringArray, {"entries"}},
+    {"lwJsonGetString", "log", LWJSON_CORPUS_LOG, BenchGetString, {"last"}},
+    {"lwJsonGetInt", "ndjson", LWJSON_CORPUS_NDJSON, BenchGetIntLines, {"seq"}},
+    // Generation, LWJSON_BENCH_ENTRIES entries per operation
+    {"lwJsonAddStringToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_STRING_TO_OBJECT},
+    {"lwJsonAddStringToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_STRING_TO_ARRAY},
+    {"lwJsonAddIntToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_INT_TO_OBJECT},
+    {"lwJsonAddIntToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_INT_TO_ARRAY},
+    {"lwJsonAddDoubleToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_DOUBLE_TO_OBJECT},
+    {"lwJsonAddDoubleToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_DOUBLE_TO_ARRAY},
+    {"lwJsonAddFloatToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_FLOAT_TO_OBJECT},
+    {"lwJsonAddFloatToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_FLOAT_TO_ARRAY},
+    {"lwJsonAddFixedDoubleToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_FIXED_DOUBLE_TO_OBJECT},
+    {"lwJsonAddFixedDoubleToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_FIXED_DOUBLE_TO_ARRAY},
+    {"lwJsonAddBooleanToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_BOOLEAN_TO_OBJECT},
+    {"lwJsonAddBooleanToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_BOOLEAN_TO_ARRAY},
+    {"lwJsonAddObjectToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_OBJECT_TO_OBJECT},
+    {"lwJsonAddObjectToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_OBJECT_TO_ARRAY},
+    {"lwJsonAddArrayToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_ARRAY_TO_OBJECT},
+    {"lwJsonAddArrayToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_ARRAY_TO_ARRAY},
+    {"lwJsonAddNullToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_NULL_TO_OBJECT},
+    {"lwJsonAddNullToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_NULL_TO_ARRAY},
+    {"lwJsonAppendObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_APPEND_OBJECT},
+    {"lwJsonAddStringToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_STRING_TO_OBJECT_KEY},
+    {"lwJsonAddIntToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_INT_TO_OBJECT_KEY},
+    {"lwJsonAddDoubleToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_DOUBLE_TO_OBJECT_KEY},
+    {"lwJsonAddFloatToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_FLOAT_TO_OBJECT_KEY},
+    {"lwJsonAddFixedDoubleToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_FIXED_DOUBLE_TO_OBJECT_KEY},
+    {"lwJsonAddBooleanToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_BOOLEAN_TO_OBJECT_KEY},
+    {"lwJsonAddObjectToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_OBJECT_TO_OBJECT_KEY},
+    {"lwJsonAddArrayToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_ARRAY_TO_OBJECT_KEY},
+    {"lwJsonAddNullToObjectKey", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_NULL_TO_OBJECT_KEY},
+    {"lwJsonAddIntArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_INT_ARRAY},
+    {"lwJsonAddDoubleArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_DOUBLE_ARRAY},
+    {"lwJsonAddBooleanArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_BOOLEAN_ARRAY},
+    {"lwJsonAddStringArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_STRING_ARRAY},
+    // Template slots, then patching and compacting a built template
+    {"lwJsonAddIntSlotToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_INT_SLOT_TO_OBJECT},
+    {"lwJsonAddIntSlotToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_INT_SLOT_TO_ARRAY},
+    {"lwJsonAddDoubleSlotToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_DOUBLE_SLOT_TO_OBJECT},
+    {"lwJsonAddDoubleSlotToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_DOUBLE_SLOT_TO_ARRAY},
+    {"lwJsonAddFixedDoubleSlotToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_FIXED_DOUBLE_SLOT_TO_OBJECT},
+    {"lwJsonAddFixedDoubleSlotToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_FIXED_DOUBLE_SLOT_TO_ARRAY},
+    {"lwJsonAddStringSlotToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_STRING_SLOT_TO_OBJECT},
+    {"lwJsonAddStringSlotToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_STRING_SLOT_TO_ARRAY},
+    {"lwJsonAddBooleanSlotToObject", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_BOOLEAN_SLOT_TO_OBJECT},
+    {"lwJsonAddBooleanSlotToArray", "", LWJSON_CORPUS_COUNT, BenchAdd, {NULL}, LWJSON_BENCH_BOOLEAN_SLOT_TO_ARRAY},
+    {"lwJsonTemplateSet", "fill", LWJSON_CORPUS_COUNT, BenchTemplateFill, {NULL}},
+    {"lwJsonTemplateCompact", "", LWJSON_CORPUS_COUNT, BenchTemplateCompact, {NULL}}
+};
+
+
+int main(int argc, char **argv) {
+    const char *filter = NULL;
+    uint64_t minNs = LWJSON_BENCH_MIN_MS * 1000000ULL;
+    LwJsonBenchResult result;
+    bool json = false;
+    bool first = true;
+    int status = 0;
+    uint32_t i;
+    int argi;
+
+    for (argi = 1; argi < argc; argi++) {
+        if (strcmp(argv[argi], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[argi], "--csv") == 0) {
+            json = false;
+        } else if (strcmp(argv[argi], "--min-ms") == 0 && argi + 1 < argc) {
+            argi++;
+            minNs = strtoull(argv[argi], NULL, 10) * 1000000ULL;
+        } else if (argv[argi][0] != '-') {
+            filter = argv[argi];
+        } else {
+            fprintf(stderr, "usage: %s [--csv | --json] [--min-ms ms] [name filter]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (lwJsonCorpusBuild(corpus) != 0) {
+        fprintf(stderr, "corpus build failed\n");
+        return 1;
+    }
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("benchmark,variant,corpus,bytes,iterations,ns_per_op,bytes_per_s,cycles_per_byte\n");
+    }
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (filter != NULL && strstr(benches[i].name, filter) == NULL) {
+            continue;
+        }
+        if (BenchMeasure(&benches[i], minNs, &result) != 0) {
+            fprintf(stderr, "%s %s failed\n", benches[i].name, benches[i].variant);
+            status = 1;
+            continue;
+        }
+        BenchPrint(&benches[i], &result, json, first);
+        first = false;
+    }
+
+    if (json) {
+        printf("\n]\n");
+    }
+
+    lwJsonCorpusFree(corpus);
+
+    return status;
+}
+
+
+static int BenchGetObject(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    LwJsonMsg object;
+    int result;
+
+    result = lwJsonGetObject((const char **)bench->path, msg, &object);
+    benchSink = (int)object.len;
+    (*bytes) = msg->len;
+
+    return result;
+}
+
+static int BenchGetArray(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    LwJsonMsg array;
+    int result;
+
+    result = lwJsonGetArray((const char **)bench->path, msg, &array);
+    benchSink = (int)array.len;
+    (*bytes) = msg->len;
+
+    return result;
+}
+
+static int BenchGetArrayLen(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    int result;
+
+    result = lwJsonGetArrayLen((const char **)bench->path, msg);
+    benchSink = result;
+    (*bytes) = msg->len;
+
+    return result;
+}
+
+static int BenchGetIntArray(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    static int values[LWJSON_CORPUS_NUMBERS];
+    int result;
+
+    result = lwJsonGetIntArray((const char **)bench->path, msg, values, LWJSON_CORPUS_NUMBERS);
+    benchSink = values[0];
+    (*bytes) = msg->len;
+
+    return result;
+}
+
+static int BenchGetStringArray(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    static char *strings[LWJSON_CORPUS_LOG_ENTRIES];
+    static unsigned int lens[LWJSON_CORPUS_LOG_ENTRIES];
+    int result;
+
+    result = lwJsonGetStringArray((const char **)bench->path, msg, strings, lens, LWJSON_CORPUS_LOG_ENTRIES);
+    benchSink = (int)lens[0];
+    (*bytes) = msg->len;
+
+    return result;
+}
+
+static int BenchGetString(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    char value[256];
+    int result;
+
+    result = lwJsonGetString((const char **)bench->path, msg, value, sizeof(value) - 1);
+    benchSink = value[0];
+    (*bytes) = msg->len;
+
+    return result;
+}
+
+static int BenchGetInt(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    int value = 0;
+    int result;
+
+    result = lwJsonGetInt((const char **)bench->path, msg, &value);
+    benchSink = value;
+    (*bytes) = msg->len;
+
+    // Lookups of missing members are measured too
+    if (result == -ENOENT || result == -EPERM) {
+        if (strcmp(bench->variant, "pos=missing") == 0) {
+            return 0;
+        }
+    }
+
+    return result;
+}
+
+static int BenchGetBool(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    bool value = false;
+    int result;
+
+    result = lwJsonGetBool((const char **)bench->path, msg, &value);
+    benchSink = value;
+    (*bytes) = msg->len;
+
+    return result;
+}
+
+static int BenchGetIntLines(const LwJsonBench *bench, uint32_t *bytes) {
+    const LwJsonMsg *msg = &corpus[bench->corpus].msg;
+    LwJsonMsg line;
+    const char *end;
+    uint32_t offset = 0;
+    int value = 0;
+    int result;
+
+    // One lookup per line
+    memset(&line, 0, sizeof(line));
+    while (offset < msg->len) {
+        end = memchr(&msg->string[offset], '\n', msg->len - offset);
+        line.string = &msg->string[offset];
+        line.len = (end != NULL) ? (uint32_t)(end - line.string) : msg->len - offset;
+        result = lwJsonGetInt((const char **)bench->path, &line, &value);
+        if (result != 0) {
+            return result;
+        }
+        benchSink = value;
+        offset += line.len + 1;
+    }
+    (*bytes) = msg->len;
+
+    return 0;
+}
+
+static int BenchAdd(const LwJsonBench *bench, uint32_t *bytes) {
+    static char output[LWJSON_BENCH_OUTPUT_LEN];
+    static LwJsonSlot slots[LWJSON_BENCH_ENTRIES];
+    LwJsonTemplate tpl;
+    LwJsonMsg msg;
+    uint32_t i;
+    int result;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.string = output;
+    msg.len = sizeof(output);
+    lwJsonWriteStart(&msg);
+    lwJsonTemplateStart(&tpl, &msg, slots, LWJSON_BENCH_ENTRIES);
+    if (BenchAddToArray(bench->add)) {
+        lwJsonStartArray(&msg);
+    } else {
+        lwJsonStartObject(&msg);
+    }
+    for (i = 0; i < LWJSON_BENCH_ENTRIES; i++) {
+        BenchAddEntry(&msg, &tpl, bench->add, i);
+    }
+
+    // Errors are sticky, WriteEnd reports the first one
+    result = lwJsonWriteEnd(&msg);
+    benchSink = output[1];
+    (*bytes) = (uint32_t)strlen(output);
+
+    return result;
+}
+
+static int BenchAddEntry(LwJsonMsg *msg, LwJsonTemplate *tpl, LwJsonBenchAdd add, uint32_t i) {
+    static const LwJsonKey key = LWJSON_KEY("value");
+    static const int64_t ints[LWJSON_BENCH_BULK_VALUES] = {0, -1, 12, -123, 1234, -12345, 123456, -1234567, 12345678, -123456789, 1234567890, 7, 42, 65535, -32768, 100};
+    static const double doubles[LWJSON_BENCH_BULK_VALUES] = {0.0, -1.5, 12.25, -123.125, 1234.5, 3.14159, 2.71828, 1e-3, 1e6, -0.0625, 100.75, 0.1, 0.2, 0.3, 21.5, -40.0};
+    static const bool booleans[LWJSON_BENCH_BULK_VALUES] = {true, false, true, true, false, false, true, false, true, false, true, true, false, true, false, true};
+    static const char *const strings[LWJSON_BENCH_BULK_VALUES] = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta", "iota", "kappa", "lambda", "mu", "nu", "xi", "omicron", "pi"};
+    static const char string[] = "2024-05-01T12:00:00.000Z INFO worker-3 GET /api/v1/items/42 200 12ms";
+    double value = (double)i * 1.25 + 0.5;
+
+    switch (add) {
+    case LWJSON_BENCH_STRING_TO_OBJECT:
+        return lwJsonAddStringToObject(msg, "value", string);
+    case LWJSON_BENCH_STRING_TO_ARRAY:
+        return lwJsonAddStringToArray(msg, string);
+    case LWJSON_BENCH_INT_TO_OBJECT:
+        return lwJsonAddIntToObject(msg, "value", ints[i % LWJSON_BENCH_BULK_VALUES]);
+    case LWJSON_BENCH_INT_TO_ARRAY:
+        return lwJsonAddIntToArray(msg, ints[i % LWJSON_BENCH_BULK_VALUES]);
+    case LWJSON_BENCH_DOUBLE_TO_OBJECT:
+        return lwJsonAddDoubleToObject(msg, "value", value);
+    case LWJSON_BENCH_DOUBLE_TO_ARRAY:
+        return lwJsonAddDoubleToArray(msg, value);
+    case LWJSON_BENCH_FLOAT_TO_OBJECT:
+        return lwJsonAddFloatToObject(msg, "value", (float)value);
+    case LWJSON_BENCH_FLOAT_TO_ARRAY:
+        return lwJsonAddFloatToArray(msg, (float)value);
+    case LWJSON_BENCH_FIXED_DOUBLE_TO_OBJECT:
+        return lwJsonAddFixedDoubleToObject(msg, "value", value, 2);
+    case LWJSON_BENCH_FIXED_DOUBLE_TO_ARRAY:
+        return lwJsonAddFixedDoubleToArray(msg, value, 2);
+    case LWJSON_BENCH_BOOLEAN_TO_OBJECT:
+        return lwJsonAddBooleanToObject(msg, "value", booleans[i % LWJSON_BENCH_BULK_VALUES]);
+    case LWJSON_BENCH_BOOLEAN_TO_ARRAY:
+        return lwJsonAddBooleanToArray(msg, booleans[i % LWJSON_BENCH_BULK_VALUES]);
+    case LWJSON_BENCH_OBJECT_TO_OBJECT:
+        lwJsonAddObjectToObject(msg, "value");
+        return lwJsonCloseObject(msg);
+    case LWJSON_BENCH_OBJECT_TO_ARRAY:
+        lwJsonAddObjectToArray(msg);
+        return lwJsonCloseObject(msg);
+    case LWJSON_BENCH_ARRAY_TO_OBJECT:
+        lwJsonAddArrayToObject(msg, "value");
+        return lwJsonCloseArray(msg);
+    case LWJSON_BENCH_ARRAY_TO_ARRAY:
+        lwJsonAddArrayToArray(msg);
+        return lwJsonCloseArray(msg);
+    case LWJSON_BENCH_NULL_TO_OBJECT:
+        return lwJsonAddNullToObject(msg, "value");
+    case LWJSON_BENCH_NULL_TO_ARRAY:
+        return lwJsonAddNullToArray(msg);
+    case LWJSON_BENCH_APPEND_OBJECT:
+        return lwJsonAppendObject(msg, "value", "{\"lat\":40,\"lon\":-3}");
+    case LWJSON_BENCH_STRING_TO_OBJECT_KEY:
+        return lwJsonAddStringToObjectKey(msg, &key, string);
+    case LWJSON_BENCH_INT_TO_OBJECT_KEY:
+        return lwJsonAddIntToObjectKey(msg, &key, ints[i % LWJSON_BENCH_BULK_VALUES]);
+    case LWJSON_BENCH_DOUBLE_TO_OBJECT_KEY:
+        return lwJsonAddDoubleToObjectKey(msg, &key, value);
+    case LWJSON_BENCH_FLOAT_TO_OBJECT_KEY:
+        return lwJsonAddFloatToObjectKey(msg, &key, (float)value);
+    case LWJSON_BENCH_FIXED_DOUBLE_TO_OBJECT_KEY:
+        return lwJsonAddFixedDoubleToObjectKey(msg, &key, value, 2);
+    case LWJSON_BENCH_BOOLEAN_TO_OBJECT_KEY:
+        return lwJsonAddBooleanToObjectKey(msg, &key, booleans[i % LWJSON_BENCH_BULK_VALUES]);
+    case LWJSON_BENCH_OBJECT_TO_OBJECT_KEY:
+        lwJsonAddObjectToObjectKey(msg, &key);
+        return lwJsonCloseObject(msg);
+    case LWJSON_BENCH_ARRAY_TO_OBJECT_KEY:
+        lwJsonAddArrayToObjectKey(msg, &key);
+        return lwJsonCloseArray(msg);
+    case LWJSON_BENCH_NULL_TO_OBJECT_KEY:
+        return lwJsonAddNullToObjectKey(msg, &key);
+    case LWJSON_BENCH_INT_ARRAY:
+        return lwJsonAddIntArray(msg, "values", ints, LWJSON_BENCH_BULK_VALUES);
+    case LWJSON_BENCH_DOUBLE_ARRAY:
+        return lwJsonAddDoubleArray(msg, "values", doubles, LWJSON_BENCH_BULK_VALUES);
+    case LWJSON_BENCH_BOOLEAN_ARRAY:
+        return lwJsonAddBooleanArray(msg, "values", booleans, LWJSON_BENCH_BULK_VALUES);
+    case LWJSON_BENCH_STRING_ARRAY:
+        return lwJsonAddStringArray(msg, "values", strings, LWJSON_BENCH_BULK_VALUES);
+    case LWJSON_BENCH_INT_SLOT_TO_OBJECT:
+        return lwJsonAddIntSlotToObject(tpl, "value", 11);
+    case LWJSON_BENCH_INT_SLOT_TO_ARRAY:
+        return lwJsonAddIntSlotToArray(tpl, 11);
+    case LWJSON_BENCH_DOUBLE_SLOT_TO_OBJECT:
+        return lwJsonAddDoubleSlotToObject(tpl, "value", 24);
+    case LWJSON_BENCH_DOUBLE_SLOT_TO_ARRAY:
+        return lwJsonAddDoubleSlotToArray(tpl, 24);
+    case LWJSON_BENCH_FIXED_DOUBLE_SLOT_TO_OBJECT:
+        return lwJsonAddFixedDoubleSlotToObject(tpl, "value", 10, 2);
+    case LWJSON_BENCH_FIXED_DOUBLE_SLOT_TO_ARRAY:
+        return lwJsonAddFixedDoubleSlotToArray(tpl, 10, 2);
+    case LWJSON_BENCH_STRING_SLOT_TO_OBJECT:
+        return lwJsonAddStringSlotToObject(tpl, "value", 16);
+    case LWJSON_BENCH_STRING_SLOT_TO_ARRAY:
+        return lwJsonAddStringSlotToArray(tpl, 16);
+    case LWJSON_BENCH_BOOLEAN_SLOT_TO_OBJECT:
+        return lwJsonAddBooleanSlotToObject(tpl, "value");
+    case LWJSON_BENCH_BOOLEAN_SLOT_TO_ARRAY:
+        return lwJsonAddBooleanSlotToArray(tpl);
+    default:
+        return -EINVAL;
+    }
+}
+
+static bool BenchAddToArray(LwJsonBenchAdd add) {
+
+    switch (add) {
+    case LWJSON_BENCH_STRING_TO_ARRAY:
+    case LWJSON_BENCH_INT_TO_ARRAY:
+    case LWJSON_BENCH_DOUBLE_TO_ARRAY:
+    case LWJSON_BENCH_FLOAT_TO_ARRAY:
+    case LWJSON_BENCH_FIXED_DOUBLE_TO_ARRAY:
+    case LWJSON_BENCH_BOOLEAN_TO_ARRAY:
+    case LWJSON_BENCH_OBJECT_TO_ARRAY:
+    case LWJSON_BENCH_ARRAY_TO_ARRAY:
+    case LWJSON_BENCH_NULL_TO_ARRAY:
+    case LWJSON_BENCH_INT_SLOT_TO_ARRAY:
+    case LWJSON_BENCH_DOUBLE_SLOT_TO_ARRAY:
+    case LWJSON_BENCH_FIXED_DOUBLE_SLOT_TO_ARRAY:
+    case LWJSON_BENCH_STRING_SLOT_TO_ARRAY:
+    case LWJSON_BENCH_BOOLEAN_SLOT_TO_ARRAY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int BenchTemplateFill(const LwJsonBench *bench, uint32_t *bytes) {
+    static uint32_t seq;
+    LwJsonBenchTemplate *t = &benchTemplate;
+    uint32_t i;
+
+    (void)bench;
+    if (t->msg.string == NULL && BenchTemplateBuild() != 0) {
+        return -ENOMEM;
+    }
+
+    // One telemetry message. Errors would only come from values wider than their slots
+    seq++;
+    lwJsonTemplateSetString(&t->tpl, t->device, "sensor-0042");
+    lwJsonTemplateSetInt(&t->tpl, t->seq, seq);
+    lwJsonTemplateSetDouble(&t->tpl, t->temp, 21.5 + (double)(seq % 16) * 0.125);
+    lwJsonTemplateSetDouble(&t->tpl, t->ratio, 1.0 / (double)(seq % 7 + 1));
+    lwJsonTemplateSetBoolean(&t->tpl, t->online, (seq % 5) != 0);
+    for (i = 0; i < LWJSON_BENCH_TEMPLATE_SAMPLES; i++) {
+        lwJsonTemplateSetInt(&t->tpl, t->samples + i, (int64_t)((seq + i) * 7919U % 100000U));
+    }
+    benchSink = t->string[1];
+    (*bytes) = t->msg._offset;
+
+    return 0;
+}
+
+static int BenchTemplateCompact(const LwJsonBench *bench, uint32_t *bytes) {
+    static char output[LWJSON_BENCH_OUTPUT_LEN];
+    LwJsonMsg msg;
+    int result;
+
+    if (benchTemplate.msg.string == NULL) {
+        result = BenchTemplateFill(bench, bytes);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.string = output;
+    msg.len = sizeof(output) - 1;
+    result = lwJsonTemplateCompact(&benchTemplate.tpl, &msg);
+    benchSink = output[1];
+    (*bytes) = msg.len;
+
+    return result;
+}
+
+static int BenchTemplateBuild(void) {
+    LwJsonBenchTemplate *t = &benchTemplate;
+    uint32_t i;
+
+    t->msg.string = t->string;
+    t->msg.len = sizeof(t->string) - 1;
+    lwJsonWriteStart(&t->msg);
+    lwJsonTemplateStart(&t->tpl, &t->msg, t->slots, sizeof(t->slots) / sizeof(t->slots[0]));
+    lwJsonStartObject(&t->msg);
+    t->device = lwJsonAddStringSlotToObject(&t->tpl, "device", 16);
+    t->seq = lwJsonAddIntSlotToObject(&t->tpl, "seq", 10);
+    t->temp = lwJsonAddFixedDoubleSlotToObject(&t->tpl, "temp", 7, 2);
+    t->ratio = lwJsonAddDoubleSlotToObject(&t->tpl, "ratio", 24);
+    t->online = lwJsonAddBooleanSlotToObject(&t->tpl, "online");
+    lwJsonAddStringToObject(&t->msg, "fw", "1.4.2");
+    lwJsonAddArrayToObject(&t->msg, "samples");
+    t->samples = lwJsonAddIntSlotToArray(&t->tpl, 6);
+    for (i = 1; i < LWJSON_BENCH_TEMPLATE_SAMPLES; i++) {
+        lwJsonAddIntSlotToArray(&t->tpl, 6);
+    }
+    lwJsonCloseArray(&t->msg);
+    lwJsonCloseObject(&t->msg);
+
+    return lwJsonWriteEnd(&t->msg);
+}
+
+static int BenchMeasure(const LwJsonBench *bench, uint64_t minNs, LwJsonBenchResult *result) {
+    uint64_t iterations = 1;
+    uint64_t startNs;
+    uint64_t startCycles;
+    uint64_t n;
+    uint32_t bytes = 0;
+
+    // Warm up, and check that the operation succeeds before timing it
+    if (bench->run(bench, &bytes) < 0) {
+        return -EPERM;
+    }
+
+    // Double the iterations until the run lasts long enough
+    while (true) {
+        startNs = BenchNowNs();
+        startCycles = BenchCycles();
+        for (n = 0; n < iterations; n++) {
+            bench->run(bench, &bytes);
+        }
+        result->cycles = BenchCycles() - startCycles;
+        result->ns = BenchNowNs() - startNs;
+        if (result->ns >= minNs || iterations >= (1ULL << 40)) {
+            break;
+        }
+        iterations *= 2;
+    }
+    result->iterations = iterations;
+    result->bytes = bytes;
+
+    return 0;
+}
+
+static void BenchPrint(const LwJsonBench *bench, const LwJsonBenchResult *result, bool json, bool first) {
+    const char *corpusName = (bench->corpus < LWJSON_CORPUS_COUNT) ? corpus[bench->corpus].name : "generated";
+    double nsPerOp = (double)result->ns / (double)result->iterations;
+    double bytesPerS = (result->ns > 0) ? (double)result->bytes * (double)result->iterations * 1e9 / (double)result->ns : 0.0;
+    double cyclesPerByte = 0.0;
+    char cycles[32] = "";
+
+    // Reference cycles of the timestamp counter. Left empty where there is none
+    if (result->cycles > 0 && result->bytes > 0) {
+        cyclesPerByte = (double)result->cycles / ((double)result->bytes * (double)result->iterations);
+        snprintf(cycles, sizeof(cycles), "%.3f", cyclesPerByte);
+    }
+
+    if (json) {
+        printf("%s  {\"benchmark\":\"%s\",\"variant\":\"%s\",\"corpus\":\"%s\",\"bytes\":%lu,\"iterations\":%llu,\"ns_per_op\":%.1f,\"bytes_per_s\":%.0f,\"cycles_per_byte\":%s}",
+               first ? "" : ",\n", bench->name, bench->variant, corpusName, (unsigned long)result->bytes, (unsigned long long)result->iterations,
+               nsPerOp, bytesPerS, (cycles[0] != 0) ? cycles : "null");
+    } else {
+        printf("%s,%s,%s,%lu,%llu,%.1f,%.0f,%s\n", bench->name, bench->variant, corpusName, (unsigned long)result->bytes,
+               (unsigned long long)result->iterations, nsPerOp, bytesPerS, cycles);
+    }
+}
+
+static uint64_t BenchNowNs(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t BenchCycles(void) {
+#ifdef LWJSON_BENCH_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
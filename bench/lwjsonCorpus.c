@@ -0,0 +1,169 @@
+#include "lwjsonCorpus.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// Growable text buffer
+typedef struct {
+    char *string;
+    uint32_t len;
+    uint32_t max;
+    int error;
+} LwJsonCorpusText;
+
+static void CorpusAppend(LwJsonCorpusText *text, const char *format, ...);
+static int CorpusFinish(LwJsonCorpusText *text, LwJsonCorpus *corpus, const char *name);
+static void CorpusTelemetry(LwJsonCorpusText *text, uint32_t seq);
+static void CorpusDeepLevel(LwJsonCorpusText *text, uint32_t level);
+
+
+int lwJsonCorpusBuild(LwJsonCorpus *corpus) {
+    LwJsonCorpusText text;
+    uint32_t i;
+    int result;
+
+    if (corpus == NULL) {
+        return -EINVAL;
+    }
+    memset(corpus, 0, LWJSON_CORPUS_COUNT * sizeof(LwJsonCorpus));
+    memset(&text, 0, sizeof(text));
+    CorpusTelemetry(&text, 1234);
+    result = CorpusFinish(&text, &corpus[LWJSON_CORPUS_TELEMETRY], "telemetry");
+
+    if (result == 0) {
+        CorpusDeepLevel(&text, 0);
+        result = CorpusFinish(&text, &corpus[LWJSON_CORPUS_DEEP], "deep");
+    }
+
+    if (result == 0) {
+        CorpusAppend(&text, "{");
+        for (i = 0; i < LWJSON_CORPUS_WIDE_MEMBERS; i++) {
+            CorpusAppend(&text, "%s\"f%03u\":%u", (i > 0) ? "," : "", (unsigned)i, (unsigned)i);
+        }
+        CorpusAppend(&text, "}");
+        result = CorpusFinish(&text, &corpus[LWJSON_CORPUS_WIDE], "wide");
+    }
+
+    if (result == 0) {
+        CorpusAppend(&text, "{\"count\":%u,\"samples\":[", (unsigned)LWJSON_CORPUS_NUMBERS);
+        for (i = 0; i < LWJSON_CORPUS_NUMBERS; i++) {
+            // Mix of widths. lwJsonGetIntArray takes no signs
+            CorpusAppend(&text, "%s%lu", (i > 0) ? "," : "", (unsigned long)((i * 7919UL) % 100000));
+        }
+        CorpusAppend(&text, "]}");
+        result = CorpusFinish(&text, &corpus[LWJSON_CORPUS_NUMERIC], "numeric");
+    }
+
+    if (result == 0) {
+        CorpusAppend(&text, "{\"service\":\"gateway\",\"entries\":[");
+        for (i = 0; i < LWJSON_CORPUS_LOG_ENTRIES; i++) {
+            CorpusAppend(&text, "%s\"2024-05-01T12:%02u:%02u.000Z INFO worker-%u GET /api/v1/items/%u 200 %ums user=client-%04u agent=lwjson-bench\"",
+                         (i > 0) ? "," : "", (unsigned)(i / 60) % 60, (unsigned)i % 60, (unsigned)i % 8, (unsigned)i * 13, (unsigned)i % 97, (unsigned)i);
+        }
+        CorpusAppend(&text, "],\"last\":\"2024-05-01T12:59:59.000Z WARN worker-0 GET /api/v1/health 503 250ms user=monitor agent=probe\"}");
+        result = CorpusFinish(&text, &corpus[LWJSON_CORPUS_LOG], "log");
+    }
+
+    if (result == 0) {
+        for (i = 0; i < LWJSON_CORPUS_NDJSON_LINES; i++) {
+            CorpusTelemetry(&text, i);
+            CorpusAppend(&text, "\n");
+        }
+        result = CorpusFinish(&text, &corpus[LWJSON_CORPUS_NDJSON], "ndjson");
+    }
+
+    if (result != 0) {
+        lwJsonCorpusFree(corpus);
+    }
+
+    return result;
+}
+
+void lwJsonCorpusFree(LwJsonCorpus *corpus) {
+    uint32_t i;
+
+    if (corpus == NULL) {
+        return;
+    }
+
+    for (i = 0; i < LWJSON_CORPUS_COUNT; i++) {
+        free(corpus[i].msg.string);
+        corpus[i].msg.string = NULL;
+        corpus[i].msg.len = 0;
+    }
+}
+
+
+static void CorpusAppend(LwJsonCorpusText *text, const char *format, ...) {
+    va_list args;
+    uint32_t max;
+    char *string;
+    int len;
+
+    if (text->error != 0) {
+        return;
+    }
+
+    va_start(args, format);
+    len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (len < 0) {
+        text->error = -EINVAL;
+        return;
+    }
+
+    // Grow by doubling, keeping room for the terminator
+    if (text->len + (uint32_t)len + 1 > text->max) {
+        max = (text->max > 0) ? text->max : 256;
+        while (text->len + (uint32_t)len + 1 > max) {
+            max *= 2;
+        }
+        string = realloc(text->string, max);
+        if (string == NULL) {
+            text->error = -ENOMEM;
+            return;
+        }
+        text->string = string;
+        text->max = max;
+    }
+
+    va_start(args, format);
+    vsnprintf(&text->string[text->len], text->max - text->len, format, args);
+    va_end(args);
+    text->len += (uint32_t)len;
+}
+
+static int CorpusFinish(LwJsonCorpusText *text, LwJsonCorpus *corpus, const char *name) {
+    int result = text->error;
+
+    if (result == 0) {
+        corpus->name = name;
+        corpus->msg.string = text->string;
+        corpus->msg.len = text->len;
+    } else {
+        free(text->string);
+    }
+    memset(text, 0, sizeof(LwJsonCorpusText));
+
+    return result;
+}
+
+static void CorpusTelemetry(LwJsonCorpusText *text, uint32_t seq) {
+
+    CorpusAppend(text, "{\"device\":\"sensor-%04u\",\"seq\":%u,\"ts\":%u,\"temp\":%d,\"humidity\":%u,\"online\":%s,\"fw\":\"1.4.2\",\"location\":{\"lat\":40,\"lon\":-3}}",
+                 (unsigned)seq % 100, (unsigned)seq, 1700000000U + (unsigned)seq, (int)(seq % 40) - 10, (unsigned)(seq * 7) % 100, (seq % 5 != 0) ? "true" : "false");
+}
+
+static void CorpusDeepLevel(LwJsonCorpusText *text, uint32_t level) {
+
+    // Siblings come before the value and the next level, so lookups scan them
+    CorpusAppend(text, "{\"name\":\"level %u\",\"tags\":[\"alpha\",\"beta\",\"gamma\"],\"limits\":{\"min\":0,\"max\":100},\"enabled\":true,\"value\":%u",
+                 (unsigned)level, (unsigned)level);
+    if (level + 1 < LWJSON_CORPUS_DEEP_LEVELS) {
+        CorpusAppend(text, ",\"next\":");
+        CorpusDeepLevel(text, level + 1);
+    }
+    CorpusAppend(text, "}");
+}
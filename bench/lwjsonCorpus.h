@@ -0,0 +1,49 @@
+#ifndef LWJSON_CORPUS_H
+#define LWJSON_CORPUS_H
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+#include "lwjson.h"
+
+// Members of the wide object
+#define LWJSON_CORPUS_WIDE_MEMBERS      (256)
+
+// Levels of the deep config, one per lookup depth benchmark. Needs LWJSON_DEPTH_MAX >= 8
+#define LWJSON_CORPUS_DEEP_LEVELS       (7)
+
+// Items of the numeric array
+#define LWJSON_CORPUS_NUMBERS           (1024)
+
+// Entries of the string-heavy log
+#define LWJSON_CORPUS_LOG_ENTRIES       (128)
+
+// Lines of the NDJSON stream
+#define LWJSON_CORPUS_NDJSON_LINES      (256)
+
+typedef enum {
+    LWJSON_CORPUS_TELEMETRY = 0,    // Small flat object, as sent by a sensor
+    LWJSON_CORPUS_DEEP,             // Nested config, one level per path element
+    LWJSON_CORPUS_WIDE,             // Flat object with many members
+    LWJSON_CORPUS_NUMERIC,          // Large integer array
+    LWJSON_CORPUS_LOG,              // Array of long strings
+    LWJSON_CORPUS_NDJSON,           // Telemetry objects, one per line
+    LWJSON_CORPUS_COUNT
+} LwJsonCorpusId;
+
+typedef struct {
+    const char *name;
+    LwJsonMsg msg;
+} LwJsonCorpus;
+
+// Builds every corpus. Returns 0 or a negative errno
+int lwJsonCorpusBuild(LwJsonCorpus *corpus);
+void lwJsonCorpusFree(LwJsonCorpus *corpus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,19 +5,165 @@
 extern "C"{
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "lwjson_types.h"
 #include "lwjson_config.h"
 
 // Generation
+// Max length of a formatted double, including terminator
+#define LWJSON_DOUBLE_STRING_LEN    (32)
+
+// Pre-encoded member name: quoted and escaped name followed by ':'
+typedef struct {
+    const char *token;
+    uint32_t len;
+} LwJsonKey;
+
+// Key from a string literal that needs no escaping, e.g. LwJsonKey key = LWJSON_KEY("temp");
+#define LWJSON_KEY(name)    { "\"" name "\":", sizeof("\"" name "\":") - 1 }
+
+// Handling of invalid UTF-8 in generated strings
+typedef enum {
+    LWJSON_UTF8_REJECT = 0,     // Fail with -EINVAL
+    LWJSON_UTF8_REPLACE,        // Replace invalid bytes with U+FFFD
+    LWJSON_UTF8_TRUSTED         // Input is known to be valid, skip validation
+} LwJsonUtf8Policy;
+
+// Output encoding
+typedef enum {
+    LWJSON_FORMAT_JSON = 0,
+    LWJSON_FORMAT_CBOR          // RFC 8949, containers of indefinite length
+} LwJsonFormat;
+
+// Subtrees selected by lwJsonProject paths
+typedef enum {
+    LWJSON_PROJECT_KEEP = 0,    // Output only the selected subtrees and their parents. Parents with nothing selected are left out
+    LWJSON_PROJECT_DROP         // Output everything but the selected subtrees
+} LwJsonProjectMode;
+
+// Drains len bytes of generated output. Returns 0 or a negative errno
+typedef int (*LwJsonFlushCallback)(void *context, const char *data, uint32_t len);
+
+// Resizes a buffer from oldLen to newLen bytes keeping its contents, like realloc. Returns NULL on failure
+// The first allocation of a writer started without buffer gets ptr NULL and oldLen 0
+typedef void *(*LwJsonReallocCallback)(void *context, void *ptr, uint32_t oldLen, uint32_t newLen);
+
+// Segmented input and output. LwJsonSegment has the same layout as struct iovec
+typedef struct {
+    const char *string;
+    size_t len;
+} LwJsonSegment;
+
+// Segmented output, ready for writev. Referenced strings must stay valid until the output is sent
+typedef struct {
+    LwJsonSegment *segments;
+    uint32_t count;
+    uint32_t max;
+} LwJsonSegmentList;
+
 typedef struct {
     char *string;
     uint32_t len;
     uint32_t _offset;
     int _lastError;
+    LwJsonUtf8Policy _utf8Policy;
+    LwJsonFlushCallback _flush;
+    void *_flushContext;
+    uint32_t _stack;
+    uint8_t _depth;
+    bool _first;
+    LwJsonReallocCallback _realloc;
+    void *_reallocContext;
+    LwJsonSegmentList *_segmentList;
+    uint32_t _segmentStart;
+    uint32_t _refMinLen;
+    bool _measure;
+    LwJsonFormat _format;
 } LwJsonMsg;
 
+// Writer state saved by lwJsonWriteMark
+typedef struct {
+    uint32_t _offset;
+    uint32_t _stack;
+    uint8_t _depth;
+    bool _first;
+    uint32_t _segmentCount;
+    uint32_t _segmentStart;
+} LwJsonWriteMark;
+
+// Value slot of a template. Fixed width text at offset, padded with whitespace
+typedef struct {
+    uint32_t offset;
+    uint32_t width;
+    uint8_t type;
+    uint8_t decimals;
+} LwJsonSlot;
+
+typedef struct {
+    LwJsonMsg *msg;
+    LwJsonSlot *slots;
+    uint32_t slotCount;
+    uint32_t slotMax;
+} LwJsonTemplate;
+
+// Slot decimals for doubles in shortest form
+#define LWJSON_SLOT_SHORTEST    (0xFF)
+
+// Writes one or more array elements into msg. Returns 0 or a negative errno
+typedef int (*LwJsonElementCallback)(LwJsonMsg *msg, void *context);
+
+// Array split across messages of at most maxLen bytes, each one {prefix,"name":[...],suffix}
+typedef struct {
+    LwJsonMsg *msg;
+    const char *prefix;
+    const char *name;
+    const char *suffix;
+    LwJsonFlushCallback sink;
+    void *context;
+    uint32_t maxLen;
+    uint32_t count;
+} LwJsonSplitter;
+
+typedef struct {
+    const LwJsonSegment *segments;
+    uint32_t count;
+} LwJsonSegmentedMsg;
+
+// Ring buffer input. Frame of len bytes starting at head, wrapping at capacity
+typedef struct {
+    const char *base;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t len;
+} LwJsonRing;
+
+#if LWJSON_STATS
+// Hot-path counters of the calling thread
+typedef struct {
+    uint32_t bytesScanned;          // Bytes visited by lookups
+    uint32_t stateTransitions;      // Lookup state handler dispatches
+    uint32_t stackPushes;           // Containers entered by lookups
+    uint32_t rescans;               // Lookups restarted at the end of a partially matched container
+    uint32_t stringsCopied;         // Strings copied out by lookups or escaped into output
+    uint32_t bytesWritten;          // Output bytes completed or flushed by writers
+    uint32_t enomemRetries;         // Writes that ran out of room and flushed or grew the buffer
+} LwJsonStats;
+
+typedef enum {
+    LWJSON_TRACE_FIND_START = 0,    // arg: path depth
+    LWJSON_TRACE_FIND_PUSH,         // arg: offset of the container
+    LWJSON_TRACE_FIND_RESCAN,       // arg: offset of the container end
+    LWJSON_TRACE_FIND_END,          // arg: bytes scanned
+    LWJSON_TRACE_WRITE_FLUSH,       // arg: bytes flushed
+    LWJSON_TRACE_WRITE_GROW         // arg: new buffer len
+} LwJsonTraceEvent;
+
+// Called from the hot path, keep it short
+typedef void (*LwJsonTraceCallback)(void *context, LwJsonTraceEvent event, uint32_t arg);
+#endif
+
 
 // Parsing
 int lwJsonGetObject(const char **path, const LwJsonMsg *msg, LwJsonMsg *object);
@@ -28,10 +174,37 @@ int lwJsonGetStringArray(const char **path, const LwJsonMsg *msg, char **pArray,
 int lwJsonGetString(const char **path, const LwJsonMsg *msg, char *value, unsigned int valueLen);
 int lwJsonGetInt(const char **path, const LwJsonMsg *msg, int *value);
 int lwJsonGetBool(const char **path, const LwJsonMsg *msg, bool *value);
+int lwJsonSegGetObject(const char **path, const LwJsonSegmentedMsg *msg, LwJsonMsg *object, char *buffer, uint32_t bufferLen);
+int lwJsonSegGetArray(const char **path, const LwJsonSegmentedMsg *msg, LwJsonMsg *array, char *buffer, uint32_t bufferLen);
+int lwJsonSegGetString(const char **path, const LwJsonSegmentedMsg *msg, char *value, uint32_t valueLen);
+int lwJsonSegGetInt(const char **path, const LwJsonSegmentedMsg *msg, int *value);
+int lwJsonSegGetBool(const char **path, const LwJsonSegmentedMsg *msg, bool *value);
+int lwJsonRingGetObject(const char **path, const LwJsonRing *ring, LwJsonMsg *object, char *buffer, uint32_t bufferLen);
+int lwJsonRingGetArray(const char **path, const LwJsonRing *ring, LwJsonMsg *array, char *buffer, uint32_t bufferLen);
+int lwJsonRingGetString(const char **path, const LwJsonRing *ring, char *value, uint32_t valueLen);
+int lwJsonRingGetInt(const char **path, const LwJsonRing *ring, int *value);
+int lwJsonRingGetBool(const char **path, const LwJsonRing *ring, bool *value);
+
+// CBOR input. lwJsonGet* use these when msg starts with a CBOR array, map or tag
+int lwJsonCborGetObject(const char **path, const LwJsonMsg *msg, LwJsonMsg *object);
+int lwJsonCborGetArray(const char **path, const LwJsonMsg *msg, LwJsonMsg *array);
+int lwJsonCborGetArrayLen(const char **path, const LwJsonMsg *msg);
+int lwJsonCborGetIntArray(const char **path, const LwJsonMsg *msg, int *array, uint32_t arrayLen);
+int lwJsonCborGetStringArray(const char **path, const LwJsonMsg *msg, char **pArray, uint32_t *pLen, uint32_t arrayLen);
+int lwJsonCborGetString(const char **path, const LwJsonMsg *msg, char *value, uint32_t valueLen);
+int lwJsonCborGetInt(const char **path, const LwJsonMsg *msg, int *value);
+int lwJsonCborGetBool(const char **path, const LwJsonMsg *msg, bool *value);
 
 
 int lwJsonWriteStart(LwJsonMsg *msg);
 int lwJsonWriteEnd(LwJsonMsg *msg);
+int lwJsonWriteSetUtf8Policy(LwJsonMsg *msg, LwJsonUtf8Policy policy);
+int lwJsonWriteSetFormat(LwJsonMsg *msg, LwJsonFormat format);
+int lwJsonWriteSetFlush(LwJsonMsg *msg, LwJsonFlushCallback flush, void *context);
+int lwJsonWriteSetAllocator(LwJsonMsg *msg, LwJsonReallocCallback allocator, void *context);
+int lwJsonWriteSetSegments(LwJsonMsg *msg, LwJsonSegmentList *list, uint32_t refMinLen);
+int lwJsonWriteMark(const LwJsonMsg *msg, LwJsonWriteMark *mark);
+int lwJsonWriteRollback(LwJsonMsg *msg, const LwJsonWriteMark *mark);
 void LwJsonWriteApplyOffset(LwJsonMsg *msg, uint32_t offset);
 int lwJsonStartObject(LwJsonMsg *msg);
 int lwJsonStartArray(LwJsonMsg *msg);
@@ -41,6 +214,13 @@ int lwJsonAddStringToObject(LwJsonMsg *msg, const char *name, const char *string
 int lwJsonAddStringToArray(LwJsonMsg *msg, const char *string);
 int lwJsonAddIntToObject(LwJsonMsg *msg, const char *name, int64_t value);
 int lwJsonAddIntToArray(LwJsonMsg *msg, int64_t value);
+int lwJsonAddDoubleToObject(LwJsonMsg *msg, const char *name, double value);
+int lwJsonAddDoubleToArray(LwJsonMsg *msg, double value);
+// Digits that round trip as float, shortest for nearly all values. 0.1f is written as 0.1
+int lwJsonAddFloatToObject(LwJsonMsg *msg, const char *name, float value);
+int lwJsonAddFloatToArray(LwJsonMsg *msg, float value);
+int lwJsonAddFixedDoubleToObject(LwJsonMsg *msg, const char *name, double value, uint32_t decimals);
+int lwJsonAddFixedDoubleToArray(LwJsonMsg *msg, double value, uint32_t decimals);
 int lwJsonAddBooleanToObject(LwJsonMsg *msg, const char *name, bool boolean);
 int lwJsonAddBooleanToArray(LwJsonMsg *msg, bool boolean);
 int lwJsonAddObjectToObject(LwJsonMsg *msg, const char *name);
@@ -51,6 +231,85 @@ int lwJsonAddNullToObject(LwJsonMsg *msg, const char *name);
 int lwJsonAddNullToArray(LwJsonMsg *msg);
 int lwJsonAppendObject(LwJsonMsg *msg, const char *name, const char *objString);
 
+// Pre-encoded keys
+int lwJsonKeyInit(LwJsonKey *key, const char *name, char *buffer, uint32_t bufferLen);
+int lwJsonAddStringToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, const char *string);
+int lwJsonAddIntToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, int64_t value);
+int lwJsonAddDoubleToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, double value);
+int lwJsonAddFloatToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, float value);
+int lwJsonAddFixedDoubleToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, double value, uint32_t decimals);
+int lwJsonAddBooleanToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, bool boolean);
+int lwJsonAddObjectToObjectKey(LwJsonMsg *msg, const LwJsonKey *key);
+int lwJsonAddArrayToObjectKey(LwJsonMsg *msg, const LwJsonKey *key);
+int lwJsonAddNullToObjectKey(LwJsonMsg *msg, const LwJsonKey *key);
+
+// Bulk arrays. With name NULL the array is added to the current array
+int lwJsonAddIntArray(LwJsonMsg *msg, const char *name, const int64_t *values, uint32_t count);
+int lwJsonAddDoubleArray(LwJsonMsg *msg, const char *name, const double *values, uint32_t count);
+int lwJsonAddBooleanArray(LwJsonMsg *msg, const char *name, const bool *values, uint32_t count);
+int lwJsonAddStringArray(LwJsonMsg *msg, const char *name, const char *const *values, uint32_t count);
+
+// Measure mode. The same calls as a real write only compute the exact output length
+int lwJsonMeasureStart(LwJsonMsg *msg);
+int lwJsonMeasureEnd(LwJsonMsg *msg, uint32_t *len);
+
+// Chunked arrays. Each chunk can be written by a different thread, then stitched in order
+int lwJsonChunkStart(LwJsonMsg *msg);
+int lwJsonChunkEnd(LwJsonMsg *msg);
+int lwJsonStitchChunks(LwJsonMsg *msg, const LwJsonMsg *chunks, uint32_t count);
+
+// Templates. Slot functions return the slot index
+int lwJsonTemplateStart(LwJsonTemplate *tpl, LwJsonMsg *msg, LwJsonSlot *slots, uint32_t slotMax);
+int lwJsonAddIntSlotToObject(LwJsonTemplate *tpl, const char *name, uint32_t width);
+int lwJsonAddIntSlotToArray(LwJsonTemplate *tpl, uint32_t width);
+int lwJsonAddDoubleSlotToObject(LwJsonTemplate *tpl, const char *name, uint32_t width);
+int lwJsonAddDoubleSlotToArray(LwJsonTemplate *tpl, uint32_t width);
+int lwJsonAddFixedDoubleSlotToObject(LwJsonTemplate *tpl, const char *name, uint32_t width, uint32_t decimals);
+int lwJsonAddFixedDoubleSlotToArray(LwJsonTemplate *tpl, uint32_t width, uint32_t decimals);
+int lwJsonAddStringSlotToObject(LwJsonTemplate *tpl, const char *name, uint32_t width);
+int lwJsonAddStringSlotToArray(LwJsonTemplate *tpl, uint32_t width);
+int lwJsonAddBooleanSlotToObject(LwJsonTemplate *tpl, const char *name);
+int lwJsonAddBooleanSlotToArray(LwJsonTemplate *tpl);
+int lwJsonTemplateSetInt(LwJsonTemplate *tpl, uint32_t slot, int64_t value);
+int lwJsonTemplateSetDouble(LwJsonTemplate *tpl, uint32_t slot, double value);
+int lwJsonTemplateSetString(LwJsonTemplate *tpl, uint32_t slot, const char *string);
+int lwJsonTemplateSetBoolean(LwJsonTemplate *tpl, uint32_t slot, bool boolean);
+int lwJsonTemplateSetNull(LwJsonTemplate *tpl, uint32_t slot);
+int lwJsonTemplateCompact(const LwJsonTemplate *tpl, LwJsonMsg *dst);
+
+// Split arrays. prefix and suffix are object members as JSON text, or NULL
+int lwJsonSplitStart(LwJsonSplitter *split, LwJsonMsg *msg, const char *prefix, const char *name, const char *suffix, LwJsonFlushCallback sink, void *context);
+int lwJsonSplitAdd(LwJsonSplitter *split, LwJsonElementCallback element, void *context);
+int lwJsonSplitEnd(LwJsonSplitter *split);
+
+// Transformation
+// In place. On error msg->len is unchanged and the contents of the buffer are undefined
+int lwJsonMinify(LwJsonMsg *msg);
+int lwJsonMinifyTo(const LwJsonMsg *src, LwJsonMsg *dst);
+// paths are NULL terminated like lwJsonGet paths, "*" matches any name or item. dst may be src
+int lwJsonProject(const LwJsonMsg *src, const char **const *paths, uint32_t pathCount, LwJsonProjectMode mode, LwJsonMsg *dst);
+// Masks selected strings and numbers in place. Returns the number of redacted values
+int lwJsonRedact(LwJsonMsg *msg, const char **const *paths, uint32_t pathCount, char mask);
+
+// Structural index
+int lwJsonIndexBuild(const LwJsonMsg *msg, void *index, uint32_t indexLen);
+int lwJsonIndexCheck(const void *index, uint32_t indexLen, const LwJsonMsg *msg, bool checkDocument);
+// Getters take no indexLen and trust the entry count of the header. An index that was stored
+// or mapped (untrusted) needs a successful lwJsonIndexCheck on the same mapping first
+int lwJsonIndexGetObject(const void *index, const char **path, const LwJsonMsg *msg, LwJsonMsg *object);
+int lwJsonIndexGetArray(const void *index, const char **path, const LwJsonMsg *msg, LwJsonMsg *array);
+int lwJsonIndexGetArrayLen(const void *index, const char **path, const LwJsonMsg *msg);
+int lwJsonIndexGetString(const void *index, const char **path, const LwJsonMsg *msg, char *value, unsigned int valueLen);
+int lwJsonIndexGetInt(const void *index, const char **path, const LwJsonMsg *msg, int *value);
+int lwJsonIndexGetBool(const void *index, const char **path, const LwJsonMsg *msg, bool *value);
+
+#if LWJSON_STATS
+// Instrumentation. Counters and trace hook are per thread
+void lwJsonStatsGet(LwJsonStats *stats);
+void lwJsonStatsReset(void);
+void lwJsonSetTrace(LwJsonTraceCallback trace, void *context);
+#endif
+
 
 #ifdef __cplusplus
 }
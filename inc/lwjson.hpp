@@ -0,0 +1,331 @@
+#ifndef LWJSON_HPP
+#define LWJSON_HPP
+
+// C++17 serializer on top of the generation API. Describe a struct once:
+//
+//     struct Point { int x; int y; char label[8]; };
+//     LWJSON_FIELDS(Point, x, y, label)
+//
+// and write it with lwjson::serialize(point, buffer, len). Member keys are
+// pre-quoted at compile time and types are dispatched at compile time.
+// lwjson::maxSize<Point>() is a constexpr bound on the output size and
+// lwjson::measure(point) the exact size of a given value.
+// Unsigned 64-bit values above INT64_MAX fail with -ERANGE.
+
+#include "lwjson.h"
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace lwjson {
+
+namespace detail {
+
+template <typename T>
+inline constexpr bool dependentFalse = false;
+
+// Member pointer and its key as "\"name\":". N counts the name terminator
+template <typename Class, typename Member, std::size_t N>
+struct Field {
+    using MemberType = Member;
+
+    std::array<char, N + 2> token;
+    Member Class::*member;
+
+    LwJsonKey key() const {
+        return LwJsonKey{token.data(), static_cast<uint32_t>(token.size())};
+    }
+};
+
+template <typename Class, typename Member, std::size_t N>
+constexpr Field<Class, Member, N> makeField(const char (&name)[N], Member Class::*member) {
+    Field<Class, Member, N> field{{}, member};
+
+    field.token[0] = '"';
+    for (std::size_t i = 0; (i + 1) < N; i++) {
+        field.token[i + 1] = name[i];
+    }
+    field.token[N] = '"';
+    field.token[N + 1] = ':';
+
+    return field;
+}
+
+template <typename T, typename = void>
+struct HasFields : std::false_type {};
+
+template <typename T>
+struct HasFields<T, std::void_t<decltype(lwJsonFields(static_cast<const T*>(nullptr)))>> : std::true_type {};
+
+template <typename T>
+struct IsString : std::false_type {};
+
+template <> struct IsString<const char*> : std::true_type {};
+template <> struct IsString<char*> : std::true_type {};
+template <> struct IsString<std::string> : std::true_type {};
+template <std::size_t N> struct IsString<char[N]> : std::true_type {};
+
+template <typename T>
+struct IsArray : std::false_type {};
+
+template <typename T, std::size_t N> struct IsArray<T[N]> : std::bool_constant<!std::is_same_v<T, char>> {
+    using Element = T;
+    static constexpr std::size_t size = N;
+};
+template <typename T, std::size_t N> struct IsArray<std::array<T, N>> : std::true_type {
+    using Element = T;
+    static constexpr std::size_t size = N;
+};
+
+// Written as int64_t, larger unsigned values don't fit
+template <typename T>
+constexpr bool intInRange(const T &value) {
+    if constexpr (std::is_unsigned_v<T> && sizeof(T) >= sizeof(int64_t)) {
+        return value <= static_cast<T>(std::numeric_limits<int64_t>::max());
+    } else {
+        return true;
+    }
+}
+
+inline const char *cString(const char *value) {
+    return value;
+}
+
+inline const char *cString(const std::string &value) {
+    return value.c_str();
+}
+
+template <typename T>
+inline constexpr auto fieldsOf = lwJsonFields(static_cast<const T*>(nullptr));
+
+} // namespace detail
+
+template <typename T>
+int writeElement(LwJsonMsg *msg, const T &value);
+
+template <typename T>
+int writeMember(LwJsonMsg *msg, const LwJsonKey *key, const T &value);
+
+// Members of value, inside an already open object
+template <typename T>
+int writeFields(LwJsonMsg *msg, const T &value) {
+    return std::apply([msg, &value](const auto &...field) {
+        int result = 0;
+        LwJsonKey key;
+
+        // Stop at the first error
+        ((result == 0 ? (key = field.key(), result = writeMember(msg, &key, value.*(field.member))) : result), ...);
+        return result;
+    }, detail::fieldsOf<T>);
+}
+
+template <typename T>
+int writeMember(LwJsonMsg *msg, const LwJsonKey *key, const T &value) {
+    int result;
+
+    if constexpr (std::is_same_v<T, bool>) {
+        return lwJsonAddBooleanToObjectKey(msg, key, value);
+    } else if constexpr (std::is_integral_v<T>) {
+        if (!detail::intInRange(value)) {
+            return -ERANGE;
+        }
+        return lwJsonAddIntToObjectKey(msg, key, static_cast<int64_t>(value));
+    } else if constexpr (std::is_same_v<T, float>) {
+        return lwJsonAddFloatToObjectKey(msg, key, value);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return lwJsonAddDoubleToObjectKey(msg, key, static_cast<double>(value));
+    } else if constexpr (detail::IsString<T>::value) {
+        return lwJsonAddStringToObjectKey(msg, key, detail::cString(value));
+    } else if constexpr (detail::IsArray<T>::value) {
+        result = lwJsonAddArrayToObjectKey(msg, key);
+        for (std::size_t i = 0; result == 0 && i < detail::IsArray<T>::size; i++) {
+            result = writeElement(msg, value[i]);
+        }
+        return (result == 0) ? lwJsonCloseArray(msg) : result;
+    } else if constexpr (detail::HasFields<T>::value) {
+        result = lwJsonAddObjectToObjectKey(msg, key);
+        if (result == 0) {
+            result = writeFields(msg, value);
+        }
+        return (result == 0) ? lwJsonCloseObject(msg) : result;
+    } else {
+        static_assert(detail::dependentFalse<T>, "type has no JSON mapping, describe it with LWJSON_FIELDS");
+        return -EINVAL;
+    }
+}
+
+// Value as an element of the current array
+template <typename T>
+int writeElement(LwJsonMsg *msg, const T &value) {
+    int result;
+
+    if constexpr (std::is_same_v<T, bool>) {
+        return lwJsonAddBooleanToArray(msg, value);
+    } else if constexpr (std::is_integral_v<T>) {
+        if (!detail::intInRange(value)) {
+            return -ERANGE;
+        }
+        return lwJsonAddIntToArray(msg, static_cast<int64_t>(value));
+    } else if constexpr (std::is_same_v<T, float>) {
+        return lwJsonAddFloatToArray(msg, value);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return lwJsonAddDoubleToArray(msg, static_cast<double>(value));
+    } else if constexpr (detail::IsString<T>::value) {
+        return lwJsonAddStringToArray(msg, detail::cString(value));
+    } else if constexpr (detail::IsArray<T>::value) {
+        result = lwJsonAddArrayToArray(msg);
+        for (std::size_t i = 0; result == 0 && i < detail::IsArray<T>::size; i++) {
+            result = writeElement(msg, value[i]);
+        }
+        return (result == 0) ? lwJsonCloseArray(msg) : result;
+    } else if constexpr (detail::HasFields<T>::value) {
+        result = lwJsonAddObjectToArray(msg);
+        if (result == 0) {
+            result = writeFields(msg, value);
+        }
+        return (result == 0) ? lwJsonCloseObject(msg) : result;
+    } else {
+        static_assert(detail::dependentFalse<T>, "type has no JSON mapping, describe it with LWJSON_FIELDS");
+        return -EINVAL;
+    }
+}
+
+// Upper bound of the written length of a value of type T
+template <typename T>
+constexpr std::size_t maxSize() {
+    if constexpr (std::is_same_v<T, bool>) {
+        return 5;
+    } else if constexpr (std::is_integral_v<T>) {
+        return std::numeric_limits<T>::digits10 + 2;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return LWJSON_DOUBLE_STRING_LEN - 1;
+    } else if constexpr (std::is_array_v<T> && std::is_same_v<std::remove_extent_t<T>, char>) {
+        // Every char escaped as \u00XX, plus quotes
+        return 6 * (std::extent_v<T> - 1) + 2;
+    } else if constexpr (detail::IsArray<T>::value) {
+        constexpr std::size_t size = detail::IsArray<T>::size;
+        return 2 + size * maxSize<typename detail::IsArray<T>::Element>() + ((size > 0) ? (size - 1) : 0);
+    } else if constexpr (detail::HasFields<T>::value) {
+        return std::apply([](const auto &...field) {
+            constexpr std::size_t count = sizeof...(field);
+            return 2 + ((field.token.size() + maxSize<typename std::decay_t<decltype(field)>::MemberType>()) + ... + 0) +
+                   ((count > 0) ? (count - 1) : 0);
+        }, detail::fieldsOf<T>);
+    } else {
+        static_assert(detail::dependentFalse<T>, "output size of this type is not bounded");
+        return 0;
+    }
+}
+
+// Buffer large enough for any value of type T, including terminator
+template <typename T>
+using Buffer = std::array<char, maxSize<T>() + 1>;
+
+// Value as the top level element of an already started message
+template <typename T>
+int write(LwJsonMsg *msg, const T &value) {
+    int result;
+
+    if constexpr (detail::HasFields<T>::value) {
+        result = lwJsonStartObject(msg);
+        if (result == 0) {
+            result = writeFields(msg, value);
+        }
+        return (result == 0) ? lwJsonCloseObject(msg) : result;
+    } else if constexpr (detail::IsArray<T>::value) {
+        result = lwJsonStartArray(msg);
+        for (std::size_t i = 0; result == 0 && i < detail::IsArray<T>::size; i++) {
+            result = writeElement(msg, value[i]);
+        }
+        return (result == 0) ? lwJsonCloseArray(msg) : result;
+    } else {
+        static_assert(detail::dependentFalse<T>, "top level value must be an object or an array");
+        return -EINVAL;
+    }
+}
+
+// Whole message into buffer. len excludes the terminator, as in LwJsonMsg
+template <typename T>
+int serialize(const T &value, char *buffer, uint32_t len) {
+    LwJsonMsg msg = {};
+    int result;
+
+    msg.string = buffer;
+    msg.len = len;
+    result = lwJsonWriteStart(&msg);
+    if (result == 0) {
+        result = write(&msg, value);
+    }
+    if (result == 0) {
+        result = lwJsonWriteEnd(&msg);
+    }
+
+    return (result == 0) ? static_cast<int>(msg._offset) : result;
+}
+
+template <typename T>
+int serialize(const T &value, Buffer<T> &buffer) {
+    return serialize(value, buffer.data(), static_cast<uint32_t>(buffer.size() - 1));
+}
+
+// Exact written length of value, without writing it
+template <typename T>
+int measure(const T &value) {
+    LwJsonMsg msg = {};
+    uint32_t len = 0;
+    int result;
+
+    result = lwJsonMeasureStart(&msg);
+    if (result == 0) {
+        result = write(&msg, value);
+    }
+    if (result == 0) {
+        result = lwJsonMeasureEnd(&msg, &len);
+    }
+
+    return (result == 0) ? static_cast<int>(len) : result;
+}
+
+} // namespace lwjson
+
+#define LWJSON_EXPAND(x) x
+#define LWJSON_FIELD(Type, field) ::lwjson::detail::makeField(#field, &Type::field)
+
+#define LWJSON_FOR_EACH_1(M, T, a) M(T, a)
+#define LWJSON_FOR_EACH_2(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_1(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_3(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_2(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_4(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_3(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_5(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_4(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_6(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_5(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_7(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_6(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_8(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_7(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_9(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_8(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_10(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_9(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_11(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_10(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_12(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_11(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_13(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_12(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_14(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_13(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_15(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_14(M, T, __VA_ARGS__))
+#define LWJSON_FOR_EACH_16(M, T, a, ...) M(T, a), LWJSON_EXPAND(LWJSON_FOR_EACH_15(M, T, __VA_ARGS__))
+
+#define LWJSON_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, NAME, ...) NAME
+#define LWJSON_FOR_EACH(M, T, ...) \
+    LWJSON_EXPAND(LWJSON_SELECT(__VA_ARGS__, \
+        LWJSON_FOR_EACH_16, LWJSON_FOR_EACH_15, LWJSON_FOR_EACH_14, LWJSON_FOR_EACH_13, \
+        LWJSON_FOR_EACH_12, LWJSON_FOR_EACH_11, LWJSON_FOR_EACH_10, LWJSON_FOR_EACH_9, \
+        LWJSON_FOR_EACH_8, LWJSON_FOR_EACH_7, LWJSON_FOR_EACH_6, LWJSON_FOR_EACH_5, \
+        LWJSON_FOR_EACH_4, LWJSON_FOR_EACH_3, LWJSON_FOR_EACH_2, LWJSON_FOR_EACH_1)(M, T, __VA_ARGS__))
+
+// Describes up to 16 members of Type. Use at namespace scope, after the struct definition
+#define LWJSON_FIELDS(Type, ...) \
+    constexpr auto lwJsonFields(const Type *) { \
+        return std::make_tuple(LWJSON_FOR_EACH(LWJSON_FIELD, Type, __VA_ARGS__)); \
+    }
+
+#endif
@@ -8,6 +8,37 @@ extern "C"{
 // Max parsing depth
 #define LWJSON_DEPTH_MAX    (8)
 
+// Max generation depth (up to 32)
+#define LWJSON_WRITE_DEPTH_MAX      (32)
+
+// Max decimals in fixed precision doubles
+#define LWJSON_FIXED_DECIMALS_MAX   (18)
+
+// Min buffer len for writers with flush callback
+#define LWJSON_FLUSH_LEN_MIN        (32)
+
+// Min buffer len after the first growth of a growable writer
+#define LWJSON_GROW_LEN_MIN         (64)
+
+// Max paths in a projection (up to 32)
+#define LWJSON_PROJECT_PATHS_MAX    (32)
+
+// Hot-path counters and trace hook. Compiled out when 0
+#ifndef LWJSON_STATS
+#define LWJSON_STATS                (0)
+#endif
+
+// Storage class of the counters and trace hook, one copy per thread
+#ifndef LWJSON_THREAD_LOCAL
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define LWJSON_THREAD_LOCAL         _Thread_local
+#elif defined(__GNUC__)
+#define LWJSON_THREAD_LOCAL         __thread
+#else
+#define LWJSON_THREAD_LOCAL
+#endif
+#endif
+
 #ifdef __cplusplus
 }
 #endif
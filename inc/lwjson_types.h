@@ -11,13 +11,16 @@ typedef enum {
     LWJSON_VAL_BOOLEAN,             // Boolean
     LWJSON_VAL_OBJECT,              // Objeto
     LWJSON_VAL_ARRAY,               // Array
-    LWJSON_VAL_NULL                 // Null
+    LWJSON_VAL_NULL,                // Null
+    LWJSON_VAL_DOUBLE,              // Número en coma flotante (sólo generación)
+    LWJSON_VAL_RAW                  // Texto JSON ya formateado (sólo generación)
 } LwJsonValueType;
 
 typedef union {
     char *valueString;              // Puntero a cadena
     int64_t valueInt;               // Valor numérico
     bool valueBool;                 // Valor booleano
+    double valueDouble;             // Valor en coma flotante (sólo generación CBOR)
 } LwJsonValue;
 
 #ifdef __cplusplus
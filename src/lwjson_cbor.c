@@ -0,0 +1,633 @@
+#include "lwjson.h"
+#include "lwjson_internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+
+// Major types (RFC 8949, section 3.1)
+#define LWJSON_CBOR_UINT        (0)
+#define LWJSON_CBOR_NEGATIVE    (1)
+#define LWJSON_CBOR_BYTES       (2)
+#define LWJSON_CBOR_TEXT        (3)
+#define LWJSON_CBOR_ARRAY       (4)
+#define LWJSON_CBOR_MAP         (5)
+#define LWJSON_CBOR_TAG         (6)
+#define LWJSON_CBOR_SIMPLE      (7)
+
+// Simple values
+#define LWJSON_CBOR_FALSE       (20)
+#define LWJSON_CBOR_TRUE        (21)
+#define LWJSON_CBOR_NULL        (22)
+#define LWJSON_CBOR_UNDEFINED   (23)
+#define LWJSON_CBOR_BREAK       (0xFF)
+
+// Argument of items with indefinite length
+#define LWJSON_CBOR_INDEFINITE  (UINT64_MAX)
+
+typedef struct {
+    const uint8_t *p;                               // Current byte
+    const uint8_t *end;                             // One past last byte
+} LwJsonCborCursor;
+
+typedef struct {
+    uint8_t major;
+    uint8_t info;                                   // Additional information, low 5 bits
+    uint64_t arg;                                   // Value, length or count
+} LwJsonCborHead;
+
+typedef struct {
+    uint32_t offset;                                // First byte of the value, after its tags
+    uint32_t len;
+    LwJsonValueType type;
+} LwJsonCborSpan;
+
+
+static int lwJsonCborFindValue(const char **path, const LwJsonMsg *msg, LwJsonValueType expectedType, LwJsonCborSpan *span);
+static void CborInit(LwJsonCborCursor *cursor, const LwJsonMsg *msg, const LwJsonCborSpan *span);
+static int CborReadHead(LwJsonCborCursor *cursor, LwJsonCborHead *head);
+static int CborSkipTags(LwJsonCborCursor *cursor, uint32_t depth);
+static bool CborAtBreak(LwJsonCborCursor *cursor, const LwJsonCborHead *head, uint64_t index);
+static int CborSkipItem(LwJsonCborCursor *cursor, LwJsonValueType *type, uint32_t depth);
+static int CborSkipItems(LwJsonCborCursor *cursor, uint64_t count, uint32_t depth);
+static int CborSkipBytes(LwJsonCborCursor *cursor, uint64_t len);
+static int CborSkipChunks(LwJsonCborCursor *cursor, uint8_t major);
+static int CborMatchName(LwJsonCborCursor *cursor, const char *name, uint32_t depth, bool *match);
+static int CborIntValue(const LwJsonCborHead *head, int *value);
+
+
+int lwJsonCborGetObject(const char **path, const LwJsonMsg *msg, LwJsonMsg *object) {
+    int result;
+    LwJsonCborSpan span;
+
+    if (object == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonCborFindValue(path, msg, LWJSON_VAL_OBJECT, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    object->string = &msg->string[span.offset];
+    object->len = span.len;
+
+    return 0;
+}
+
+int lwJsonCborGetArray(const char **path, const LwJsonMsg *msg, LwJsonMsg *array) {
+    int result;
+    LwJsonCborSpan span;
+
+    if (array == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonCborFindValue(path, msg, LWJSON_VAL_ARRAY, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    array->string = &msg->string[span.offset];
+    array->len = span.len;
+
+    return 0;
+}
+
+int lwJsonCborGetArrayLen(const char **path, const LwJsonMsg *msg) {
+    int result;
+    LwJsonCborSpan span;
+    LwJsonCborCursor cursor;
+    LwJsonCborHead head;
+    LwJsonValueType type;
+    int items = 0;
+
+    result = lwJsonCborFindValue(path, msg, LWJSON_VAL_ARRAY, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    CborInit(&cursor, msg, &span);
+    CborReadHead(&cursor, &head);
+    if (head.arg != LWJSON_CBOR_INDEFINITE) {
+        return (head.arg > INT_MAX) ? -EPERM : (int)head.arg;
+    }
+
+    // Indefinite length. Count items up to the break
+    while (!CborAtBreak(&cursor, &head, 0)) {
+        CborSkipItem(&cursor, &type, 0);
+        items++;
+    }
+
+    return items;
+}
+
+int lwJsonCborGetIntArray(const char **path, const LwJsonMsg *msg, int *intArray, uint32_t intArrayLen) {
+    int result;
+    LwJsonCborSpan span;
+    LwJsonCborCursor cursor;
+    LwJsonCborHead array;
+    LwJsonCborHead head;
+    uint32_t index;
+
+    if (intArray == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonCborFindValue(path, msg, LWJSON_VAL_ARRAY, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    // Extract array values. Every item must be an integer
+    CborInit(&cursor, msg, &span);
+    CborReadHead(&cursor, &array);
+    for (index = 0; !CborAtBreak(&cursor, &array, index); index++) {
+        if (index >= intArrayLen || CborSkipTags(&cursor, 0) != 0 || CborReadHead(&cursor, &head) != 0) {
+            return -EPERM;
+        }
+        if (CborIntValue(&head, &intArray[index]) != 0) {
+            return -EPERM;
+        }
+    }
+
+    // Return number of items
+    return index;
+}
+
+int lwJsonCborGetStringArray(const char **path, const LwJsonMsg *msg, char **stringArray, uint32_t *stringLenArray, uint32_t arrayLen) {
+    int result;
+    LwJsonCborSpan span;
+    LwJsonCborCursor cursor;
+    LwJsonCborHead array;
+    LwJsonCborHead head;
+    uint32_t index;
+
+    if ((stringArray == NULL) || (stringLenArray == NULL)) {
+        return -EINVAL;
+    }
+
+    result = lwJsonCborFindValue(path, msg, LWJSON_VAL_ARRAY, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    // Items point to the text inside the message, without quotes. Chunked strings are not supported
+    CborInit(&cursor, msg, &span);
+    CborReadHead(&cursor, &array);
+    for (index = 0; !CborAtBreak(&cursor, &array, index); index++) {
+        if (index >= arrayLen || CborSkipTags(&cursor, 0) != 0 || CborReadHead(&cursor, &head) != 0) {
+            return -EPERM;
+        }
+        if (head.major != LWJSON_CBOR_TEXT || head.arg == LWJSON_CBOR_INDEFINITE) {
+            return -EPERM;
+        }
+        stringArray[index] = (char*)cursor.p;
+        stringLenArray[index] = head.arg;
+        CborSkipBytes(&cursor, head.arg);
+    }
+
+    // Return number of items
+    return index;
+}
+
+int lwJsonCborGetString(const char **path, const LwJsonMsg *msg, char *value, uint32_t valueLen) {
+    int result;
+    LwJsonCborSpan span;
+    LwJsonCborCursor cursor;
+    LwJsonCborHead head;
+    LwJsonCborHead chunk;
+    uint32_t stringLen = 0;
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonCborFindValue(path, msg, LWJSON_VAL_STRING, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    CborInit(&cursor, msg, &span);
+    CborReadHead(&cursor, &head);
+    if (head.arg != LWJSON_CBOR_INDEFINITE) {
+        if (head.arg > valueLen) {
+            return -ENOMEM;
+        }
+        memcpy(value, cursor.p, head.arg);
+        value[head.arg] = 0;
+        return 0;
+    }
+
+    // Join the chunks of an indefinite length string
+    while (!CborAtBreak(&cursor, &head, 0)) {
+        CborReadHead(&cursor, &chunk);
+        if (chunk.arg > (valueLen - stringLen)) {
+            return -ENOMEM;
+        }
+        memcpy(&value[stringLen], cursor.p, chunk.arg);
+        stringLen += chunk.arg;
+        CborSkipBytes(&cursor, chunk.arg);
+    }
+    value[stringLen] = 0;
+
+    return 0;
+}
+
+int lwJsonCborGetInt(const char **path, const LwJsonMsg *msg, int *value) {
+    int result;
+    LwJsonCborSpan span;
+    LwJsonCborCursor cursor;
+    LwJsonCborHead head;
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonCborFindValue(path, msg, LWJSON_VAL_NUMBER, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    CborInit(&cursor, msg, &span);
+    CborReadHead(&cursor, &head);
+
+    return CborIntValue(&head, value);
+}
+
+int lwJsonCborGetBool(const char **path, const LwJsonMsg *msg, bool *value) {
+    int result;
+    LwJsonCborSpan span;
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonCborFindValue(path, msg, LWJSON_VAL_BOOLEAN, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    // Get Value. Only simple values true and false are booleans
+    (*value) = ((uint8_t)msg->string[span.offset] == ((LWJSON_CBOR_SIMPLE << 5) | LWJSON_CBOR_TRUE));
+
+    return 0;
+}
+
+
+static int lwJsonCborFindValue(const char **path, const LwJsonMsg *msg, LwJsonValueType expectedType, LwJsonCborSpan *span) {
+    LwJsonCborCursor cursor;
+    LwJsonCborHead heads[LWJSON_DEPTH_MAX];         // Containers entered while searching
+    uint64_t indexes[LWJSON_DEPTH_MAX];             // Index of the item selected in each container
+    LwJsonCborHead *head;
+    LwJsonValueType type;
+    uint32_t arrayIndex;
+    uint32_t depth;
+    uint64_t i;
+    bool match;
+    int result;
+
+    if (path == NULL || msg == NULL || msg->string == NULL) {
+        return -EINVAL;
+    }
+
+    CborInit(&cursor, msg, NULL);
+
+    // Descend through path
+    for (depth = 0; path[depth] != NULL; depth++) {
+        if (depth >= LWJSON_DEPTH_MAX) {
+            return -EPERM;
+        }
+
+        head = &heads[depth];
+        result = CborSkipTags(&cursor, depth);
+        if (result == 0) {
+            result = CborReadHead(&cursor, head);
+        }
+        if (result != 0) {
+            return result;
+        }
+        // Every item takes one byte at least
+        if (head->arg != LWJSON_CBOR_INDEFINITE && head->arg > (uint64_t)(cursor.end - cursor.p)) {
+            return -EPERM;
+        }
+
+        if (head->major == LWJSON_CBOR_MAP) {
+            for (i = 0; ; i++) {
+                if (CborAtBreak(&cursor, head, i)) {
+                    return -ENOENT;
+                }
+                // Property name and value
+                result = CborMatchName(&cursor, path[depth], depth + 1, &match);
+                if (result != 0) {
+                    return result;
+                }
+                if (match) {
+                    break;
+                }
+                result = CborSkipItem(&cursor, &type, depth + 1);
+                if (result != 0) {
+                    return result;
+                }
+            }
+        } else if (head->major == LWJSON_CBOR_ARRAY) {
+            if (lwJsonParseArrayIndex(path[depth], &arrayIndex) != 0) {
+                return -ENOENT;
+            }
+            for (i = 0; ; i++) {
+                if (CborAtBreak(&cursor, head, i)) {
+                    return -ENOENT;
+                }
+                if (i == arrayIndex) {
+                    break;
+                }
+                result = CborSkipItem(&cursor, &type, depth + 1);
+                if (result != 0) {
+                    return result;
+                }
+            }
+        } else if (head->major == LWJSON_CBOR_SIMPLE && head->info == 31) {
+            return -EPERM;
+        } else {
+            return -ENOENT;
+        }
+        indexes[depth] = i;
+    }
+
+    // Found. Get value span
+    result = CborSkipTags(&cursor, depth);
+    if (result != 0) {
+        return result;
+    }
+    span->offset = cursor.p - (const uint8_t*)msg->string;
+    result = CborSkipItem(&cursor, &span->type, depth);
+    if (result != 0) {
+        return result;
+    }
+    span->len = (cursor.p - (const uint8_t*)msg->string) - span->offset;
+
+    // Check the rest of the message is well formed
+    while (depth > 0) {
+        depth--;
+        head = &heads[depth];
+        if (head->arg != LWJSON_CBOR_INDEFINITE) {
+            i = head->arg - indexes[depth] - 1;
+            result = CborSkipItems(&cursor, (head->major == LWJSON_CBOR_MAP) ? (i * 2) : i, depth + 1);
+        } else {
+            // Value of the matched name was skipped, the rest are whole pairs or items
+            result = CborSkipItems(&cursor, LWJSON_CBOR_INDEFINITE, depth + 1);
+        }
+        if (result != 0) {
+            return result;
+        }
+    }
+    if (cursor.p != cursor.end) {
+        return -EPERM;
+    }
+
+    if (span->type != expectedType) {
+        return -EPERM;
+    }
+
+    return 0;
+}
+
+static void CborInit(LwJsonCborCursor *cursor, const LwJsonMsg *msg, const LwJsonCborSpan *span) {
+    cursor->p = (const uint8_t*)msg->string;
+    cursor->end = cursor->p + msg->len;
+
+    // Cursor limited to a value already checked by lwJsonCborFindValue
+    if (span != NULL) {
+        cursor->p += span->offset;
+        cursor->end = cursor->p + span->len;
+    }
+}
+
+static int CborReadHead(LwJsonCborCursor *cursor, LwJsonCborHead *head) {
+    uint32_t len;
+    uint32_t i;
+
+    if (cursor->p >= cursor->end) {
+        return -EPERM;
+    }
+
+    head->major = cursor->p[0] >> 5;
+    head->info = cursor->p[0] & 0x1F;
+    head->arg = head->info;
+    cursor->p++;
+
+    if (head->info < 24) {
+        return 0;
+    }
+    if (head->info == 31) {
+        // Indefinite length strings and containers, or break
+        if (head->major == LWJSON_CBOR_BYTES || head->major == LWJSON_CBOR_TEXT ||
+            head->major == LWJSON_CBOR_ARRAY || head->major == LWJSON_CBOR_MAP ||
+            head->major == LWJSON_CBOR_SIMPLE) {
+            head->arg = LWJSON_CBOR_INDEFINITE;
+            return 0;
+        }
+        return -EPERM;
+    }
+    if (head->info > 27) {
+        return -EPERM;
+    }
+
+    // Argument in the next 1, 2, 4 or 8 bytes, big endian
+    len = 1 << (head->info - 24);
+    if (len > (uint32_t)(cursor->end - cursor->p)) {
+        return -EPERM;
+    }
+    head->arg = 0;
+    for (i = 0; i < len; i++) {
+        head->arg = (head->arg << 8) | cursor->p[i];
+    }
+    cursor->p += len;
+    if (head->major >= LWJSON_CBOR_BYTES && head->major <= LWJSON_CBOR_MAP && head->arg == LWJSON_CBOR_INDEFINITE) {
+        return -EPERM;
+    }
+
+    return 0;
+}
+
+static int CborSkipTags(LwJsonCborCursor *cursor, uint32_t depth) {
+    LwJsonCborHead head;
+    int result;
+
+    // Tags only annotate the item that follows
+    while (cursor->p < cursor->end && (cursor->p[0] >> 5) == LWJSON_CBOR_TAG) {
+        if (depth++ > LWJSON_DEPTH_MAX) {
+            return -EPERM;
+        }
+        result = CborReadHead(cursor, &head);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static bool CborAtBreak(LwJsonCborCursor *cursor, const LwJsonCborHead *head, uint64_t index) {
+    // End of a container or chunked string. Consumes the break of indefinite length items
+    if (head->arg != LWJSON_CBOR_INDEFINITE) {
+        return (index >= head->arg);
+    }
+    if (cursor->p < cursor->end && cursor->p[0] == LWJSON_CBOR_BREAK) {
+        cursor->p++;
+        return true;
+    }
+
+    return false;
+}
+
+static int CborSkipItem(LwJsonCborCursor *cursor, LwJsonValueType *type, uint32_t depth) {
+    LwJsonCborHead head;
+    int result;
+
+    if (depth > LWJSON_DEPTH_MAX) {
+        return -EPERM;
+    }
+    result = CborSkipTags(cursor, depth);
+    if (result == 0) {
+        result = CborReadHead(cursor, &head);
+    }
+    if (result != 0) {
+        return result;
+    }
+
+    switch (head.major) {
+    case LWJSON_CBOR_UINT:
+    case LWJSON_CBOR_NEGATIVE:
+        (*type) = LWJSON_VAL_NUMBER;
+        return 0;
+    case LWJSON_CBOR_BYTES:
+    case LWJSON_CBOR_TEXT:
+        // Byte strings have no JSON counterpart
+        (*type) = (head.major == LWJSON_CBOR_TEXT) ? LWJSON_VAL_STRING : LWJSON_VAL_RAW;
+        if (head.arg == LWJSON_CBOR_INDEFINITE) {
+            return CborSkipChunks(cursor, head.major);
+        }
+        return CborSkipBytes(cursor, head.arg);
+    case LWJSON_CBOR_ARRAY:
+        (*type) = LWJSON_VAL_ARRAY;
+        return CborSkipItems(cursor, head.arg, depth + 1);
+    case LWJSON_CBOR_MAP:
+        (*type) = LWJSON_VAL_OBJECT;
+        if (head.arg != LWJSON_CBOR_INDEFINITE && head.arg > (uint64_t)(cursor->end - cursor->p)) {
+            return -EPERM;
+        }
+        return CborSkipItems(cursor, (head.arg == LWJSON_CBOR_INDEFINITE) ? head.arg : (head.arg * 2), depth + 1);
+    default:
+        break;
+    }
+
+    // Simple values and floats
+    if (head.info == LWJSON_CBOR_FALSE || head.info == LWJSON_CBOR_TRUE) {
+        (*type) = LWJSON_VAL_BOOLEAN;
+    } else if (head.info == LWJSON_CBOR_NULL || head.info == LWJSON_CBOR_UNDEFINED) {
+        (*type) = LWJSON_VAL_NULL;
+    } else if (head.info >= 25 && head.info <= 27) {
+        (*type) = LWJSON_VAL_DOUBLE;
+    } else {
+        return -EPERM;
+    }
+
+    return 0;
+}
+
+static int CborSkipItems(LwJsonCborCursor *cursor, uint64_t count, uint32_t depth) {
+    LwJsonCborHead head = {LWJSON_CBOR_ARRAY, 31, LWJSON_CBOR_INDEFINITE};
+    LwJsonValueType type;
+    uint64_t i;
+    int result;
+
+    // Every item takes one byte at least
+    if (count != LWJSON_CBOR_INDEFINITE && count > (uint64_t)(cursor->end - cursor->p)) {
+        return -EPERM;
+    }
+    head.arg = count;
+
+    for (i = 0; !CborAtBreak(cursor, &head, i); i++) {
+        if (cursor->p >= cursor->end) {
+            return -EPERM;
+        }
+        result = CborSkipItem(cursor, &type, depth);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static int CborSkipBytes(LwJsonCborCursor *cursor, uint64_t len) {
+    if (len > (uint64_t)(cursor->end - cursor->p)) {
+        return -EPERM;
+    }
+    cursor->p += len;
+
+    return 0;
+}
+
+static int CborSkipChunks(LwJsonCborCursor *cursor, uint8_t major) {
+    LwJsonCborHead head = {major, 31, LWJSON_CBOR_INDEFINITE};
+    LwJsonCborHead chunk;
+    int result;
+
+    // Chunks are definite length strings of the same type
+    while (!CborAtBreak(cursor, &head, 0)) {
+        result = CborReadHead(cursor, &chunk);
+        if (result != 0) {
+            return result;
+        }
+        if (chunk.major != major || chunk.arg == LWJSON_CBOR_INDEFINITE) {
+            return -EPERM;
+        }
+        result = CborSkipBytes(cursor, chunk.arg);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static int CborMatchName(LwJsonCborCursor *cursor, const char *name, uint32_t depth, bool *match) {
+    LwJsonCborCursor start = *cursor;
+    LwJsonCborHead head;
+    LwJsonValueType type;
+    int result;
+
+    (*match) = false;
+
+    // Only definite length text names can match, any other key is skipped
+    result = CborReadHead(cursor, &head);
+    if (result != 0) {
+        return result;
+    }
+    if (head.major == LWJSON_CBOR_TEXT && head.arg != LWJSON_CBOR_INDEFINITE) {
+        result = CborSkipBytes(cursor, head.arg);
+        if (result == 0 && strlen(name) == head.arg) {
+            (*match) = (memcmp(name, cursor->p - head.arg, head.arg) == 0);
+        }
+        return result;
+    }
+
+    (*cursor) = start;
+    return CborSkipItem(cursor, &type, depth);
+}
+
+static int CborIntValue(const LwJsonCborHead *head, int *value) {
+    // Integers that fit in an int
+    if (head->major == LWJSON_CBOR_UINT && head->arg <= INT_MAX) {
+        (*value) = (int)head->arg;
+    } else if (head->major == LWJSON_CBOR_NEGATIVE && head->arg <= (uint64_t)INT_MAX) {
+        (*value) = -1 - (int)head->arg;
+    } else {
+        return -EPERM;
+    }
+
+    return 0;
+}
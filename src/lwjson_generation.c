@@ -1,122 +1,409 @@
 #include "lwjson.h"
+#include "lwjson_internal.h"
+#include "lwjson_stats.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdio.h>
+#include <float.h>
 #include <errno.h>
 
-static int lwJsonCalculateValueStringLength(LwJsonValueType type, LwJsonValue *value);
+// CBOR major types and simple values (RFC 8949)
+#define LWJSON_CBOR_UINT        (0)
+#define LWJSON_CBOR_NEGATIVE    (1)
+#define LWJSON_CBOR_TEXT        (3)
+#define LWJSON_CBOR_FALSE       (0xF4)
+#define LWJSON_CBOR_TRUE        (0xF5)
+#define LWJSON_CBOR_NULL        (0xF6)
+#define LWJSON_CBOR_FLOAT       (0xFA)
+#define LWJSON_CBOR_DOUBLE      (0xFB)
+#define LWJSON_CBOR_ARRAY       (0x9F)      // Indefinite length
+#define LWJSON_CBOR_MAP         (0xBF)      // Indefinite length
+#define LWJSON_CBOR_BREAK       (0xFF)
+#define LWJSON_CBOR_HEAD_LEN_MAX    (9)
+
+// Two digit decimal strings "00" to "99"
+static const char lwJsonDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Powers of 10 used to adjust the digit count estimated from the bit length
+static const uint64_t lwJsonPowersOf10[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+    100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+    10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+};
+
+// Normalized 64 bit approximations of 10^k for k = -348, -340, ..., 340 (Grisu cached powers)
+static const uint64_t lwJsonCachedPowersF[] = {
+    0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull, 0xcf42894a5dce35eaull,
+    0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull, 0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full,
+    0xbe5691ef416bd60cull, 0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+    0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull, 0xc21094364dfb5637ull,
+    0x9096ea6f3848984full, 0xd77485cb25823ac7ull, 0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull,
+    0xb23867fb2a35b28eull, 0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+    0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull, 0xb5b5ada8aaff80b8ull,
+    0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull, 0x964e858c91ba2655ull, 0xdff9772470297ebdull,
+    0xa6dfbd9fb8e5b88full, 0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+    0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull, 0xaa242499697392d3ull,
+    0xfd87b5f28300ca0eull, 0xbce5086492111aebull, 0x8cbccc096f5088ccull, 0xd1b71758e219652cull,
+    0x9c40000000000000ull, 0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+    0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull, 0x9f4f2726179a2245ull,
+    0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull, 0x83c7088e1aab65dbull, 0xc45d1df942711d9aull,
+    0x924d692ca61be758ull, 0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+    0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull, 0x952ab45cfa97a0b3ull,
+    0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull, 0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull,
+    0x88fcf317f22241e2ull, 0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+    0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull, 0x8bab8eefb6409c1aull,
+    0xd01fef10a657842cull, 0x9b10a4e5e9913129ull, 0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull,
+    0x80444b5e7aa7cf85ull, 0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+    0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull
+};
+
+static const int16_t lwJsonCachedPowersE[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066
+};
+
+#if LWJSON_WRITE_DEPTH_MAX > 32
+#error "LWJSON_WRITE_DEPTH_MAX must fit in the 32 bit nesting stack"
+#endif
+
+// Escape sequence for control chars. 'u' means \u00XX
+static const char lwJsonControlEscapes[] = "uuuuuuuubtnufruuuuuuuuuuuuuuuuuu";
+
+// Double precision float as significand and binary exponent (f * 2^e)
+typedef struct {
+    uint64_t f;
+    int e;
+} LwJsonDiyFp;
+
+static int lwJsonCalculateValueStringLength(LwJsonValueType type, LwJsonValue *value, LwJsonUtf8Policy policy, uint32_t *rawLen);
+static int lwJsonScanString(const char *string, uint32_t len, LwJsonUtf8Policy policy, uint32_t *escapedLen);
+static uint32_t lwJsonWriteEscaped(char *dst, const char *string, uint32_t len, LwJsonUtf8Policy policy);
+static uint32_t lwJsonUtf8SequenceLen(const unsigned char *bytes, uint32_t remaining);
+static LwJsonWord WordNeedsEscape(LwJsonWord word);
+static uint32_t lwJsonIntLength(int64_t value);
+static uint32_t lwJsonUIntLength(uint64_t value);
+static uint32_t lwJsonWriteInt(char *dst, int64_t value);
+static void lwJsonWriteUInt(char *dst, uint64_t value, uint32_t len);
+static uint32_t lwJsonFormatDouble(char *dst, double value, bool single);
+static uint32_t lwJsonFormatFixedDouble(char *dst, double value, uint32_t decimals);
+static void Grisu2(double value, bool single, char *digits, int *len, int *K);
+static void GrisuDigitGen(LwJsonDiyFp W, LwJsonDiyFp Mp, uint64_t delta, char *digits, int *len, int *K);
+static void GrisuRound(char *digits, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpW);
+static uint32_t GrisuPrettify(char *dst, const char *digits, int len, int k);
+static LwJsonDiyFp DiyFpMultiply(LwJsonDiyFp x, LwJsonDiyFp y);
+static LwJsonDiyFp DiyFpNormalize(LwJsonDiyFp x);
 static int lwJsonCheckWriteError(LwJsonMsg *msg);
 static int lwJsonAddNameAndValuePair(LwJsonMsg *msg, const char *name, LwJsonValueType type, LwJsonValue *value);
 static int lwJsonAddValueToArray(LwJsonMsg *msg, LwJsonValueType type, LwJsonValue *value);
-static int lwJsonIsValidUTF8String(const char *string);
+static int lwJsonAddKeyAndValuePair(LwJsonMsg *msg, const LwJsonKey *key, LwJsonValueType type, LwJsonValue *value);
+static int lwJsonAddEntry(LwJsonMsg *msg, const char *name, const LwJsonKey *key, LwJsonValueType type, LwJsonValue *value);
+static int lwJsonAddEntryStreamed(LwJsonMsg *msg, const char *name, uint32_t nameLen, const LwJsonKey *key, LwJsonValueType type, LwJsonValue *value, uint32_t valueLen, bool separator);
+static int lwJsonAddEntryCbor(LwJsonMsg *msg, const char *name, const LwJsonKey *key, LwJsonValueType type, LwJsonValue *value);
+static uint32_t lwJsonCborHead(uint8_t *dst, uint8_t major, uint64_t arg);
+static uint32_t lwJsonCborDouble(uint8_t *dst, double value);
+static void lwJsonCborWrite(LwJsonMsg *msg, const void *data, uint32_t len, bool stream);
+static void lwJsonDoubleValue(const LwJsonMsg *msg, LwJsonValue *jsonValue, char *number, double value, uint32_t decimals);
+static void lwJsonFloatValue(const LwJsonMsg *msg, LwJsonValue *jsonValue, char *number, float value);
+static int lwJsonCheckNesting(LwJsonMsg *msg, bool member, LwJsonValueType type);
+static void lwJsonUpdateNesting(LwJsonMsg *msg, LwJsonValueType type);
+static int lwJsonCloseContainer(LwJsonMsg *msg, bool object);
+static void lwJsonAddReference(LwJsonMsg *msg, const char *string, uint32_t len);
+static void lwJsonAddSegment(LwJsonSegmentList *list, const char *string, uint32_t len);
+static int lwJsonFlush(LwJsonMsg *msg);
+static int lwJsonGrow(LwJsonMsg *msg, uint32_t required);
+static int lwJsonReserve(LwJsonMsg *msg, uint64_t len);
+static int lwJsonStartBulkArray(LwJsonMsg *msg, const char *name);
+static int lwJsonAddSlot(LwJsonTemplate *tpl, const char *name, bool member, LwJsonValueType type, uint32_t width, uint32_t decimals);
+static LwJsonSlot *lwJsonTemplateSlot(LwJsonTemplate *tpl, uint32_t slot, LwJsonValueType type, uint32_t minWidth);
+static void lwJsonSlotWrite(LwJsonTemplate *tpl, const LwJsonSlot *slot, const char *value, uint32_t len);
+static int lwJsonStreamRaw(LwJsonMsg *msg, const char *data, uint32_t len);
+static int lwJsonStreamEscaped(LwJsonMsg *msg, const char *string, uint32_t len);
+static void lwJsonWriteReset(LwJsonMsg *msg);
+static int lwJsonSplitOpen(LwJsonSplitter *split);
+static int lwJsonSplitEmit(LwJsonSplitter *split, bool reopen);
+static int lwJsonSplitElement(LwJsonMsg *msg, LwJsonElementCallback element, void *context);
+static int lwJsonAddMembers(LwJsonMsg *msg, const char *members);
 
 int lwJsonWriteStart(LwJsonMsg *msg) {
     if (msg == NULL) {
         return -EINVAL;
     }
-    if (msg->string == NULL) {
+    // A growable writer may start without buffer, the allocator provides the first one
+    if (msg->string == NULL && msg->len != 0) {
         return -EINVAL;
     }
 
-    msg->_offset = 0;
-    msg->_lastError = 0;
+    lwJsonWriteReset(msg);
 
     return 0;
 }
 
-int lwJsonWriteEnd(LwJsonMsg *msg) {
+int lwJsonMeasureStart(LwJsonMsg *msg) {
     if (msg == NULL) {
-        return -EPERM;
+        return -EINVAL;
     }
-    if (msg->string == NULL) {
+
+    // No buffer. Space checks fail only when the output would not fit in any buffer
+    lwJsonWriteReset(msg);
+    msg->string = NULL;
+    msg->len = UINT32_MAX - 1;
+    msg->_measure = true;
+
+    return 0;
+}
+
+int lwJsonMeasureEnd(LwJsonMsg *msg, uint32_t *len) {
+    int result;
+
+    if (msg == NULL || len == NULL || !msg->_measure) {
         return -EINVAL;
     }
 
-    if (msg->_lastError < 0) {
-        return msg->_lastError;
+    result = lwJsonWriteEnd(msg);
+    if (result != 0) {
+        return result;
     }
 
-    msg->string[msg->_offset] = 0;
+    (*len) = msg->_offset;
 
     return 0;
 }
 
-void LwJsonWriteApplyOffset(LwJsonMsg *msg, uint32_t offset) {
+int lwJsonWriteSetUtf8Policy(LwJsonMsg *msg, LwJsonUtf8Policy policy) {
     if (msg == NULL) {
-        return;
+        return -EINVAL;
+    }
+    if (policy != LWJSON_UTF8_REJECT && policy != LWJSON_UTF8_REPLACE && policy != LWJSON_UTF8_TRUSTED) {
+        return -EINVAL;
     }
 
-    msg->_offset += offset;
+    msg->_utf8Policy = policy;
+
+    return 0;
 }
 
-int lwJsonStartObject(LwJsonMsg *msg) {
-    if (lwJsonCheckWriteError(msg) != 0) {
-        return msg->_lastError;
+int lwJsonWriteSetFormat(LwJsonMsg *msg, LwJsonFormat format) {
+    if (msg == NULL) {
+        return -EINVAL;
+    }
+    if (format != LWJSON_FORMAT_JSON && format != LWJSON_FORMAT_CBOR) {
+        return -EINVAL;
+    }
+    // Output can not switch format halfway
+    if (msg->_offset != 0) {
+        return -EPERM;
     }
 
-    msg->string[msg->_offset] = '{';
-    msg->_offset++;
+    msg->_format = format;
+
     return 0;
 }
 
-int lwJsonStartArray(LwJsonMsg *msg) {
-    if (lwJsonCheckWriteError(msg) != 0) {
-        return msg->_lastError;
+int lwJsonWriteSetFlush(LwJsonMsg *msg, LwJsonFlushCallback flush, void *context) {
+    if (msg == NULL) {
+        return -EINVAL;
+    }
+    if (msg->_segmentList != NULL || msg->_measure) {
+        return -EPERM;
+    }
+    if (flush != NULL && msg->len < LWJSON_FLUSH_LEN_MIN) {
+        return -EINVAL;
     }
 
-    msg->string[msg->_offset] = '[';
-    msg->_offset++;
+    msg->_flush = flush;
+    msg->_flushContext = context;
+
     return 0;
 }
 
-int lwJsonCloseObject(LwJsonMsg *msg) {
-    if (lwJsonCheckWriteError(msg) != 0) {
+int lwJsonWriteSetAllocator(LwJsonMsg *msg, LwJsonReallocCallback allocator, void *context) {
+    if (msg == NULL) {
+        return -EINVAL;
+    }
+    // Segments point into the buffer, it can not move
+    if (msg->_segmentList != NULL || msg->_measure) {
+        return -EPERM;
+    }
+
+    msg->_realloc = allocator;
+    msg->_reallocContext = context;
+
+    return 0;
+}
+
+int lwJsonWriteSetSegments(LwJsonMsg *msg, LwJsonSegmentList *list, uint32_t refMinLen) {
+    if (msg == NULL || list == NULL || list->segments == NULL || list->max == 0) {
+        return -EINVAL;
+    }
+    if (msg->_flush != NULL || msg->_realloc != NULL || msg->_measure) {
+        return -EPERM;
+    }
+
+    list->count = 0;
+    msg->_segmentList = list;
+    msg->_segmentStart = msg->_offset;
+    msg->_refMinLen = refMinLen;
+
+    return 0;
+}
+
+int lwJsonWriteEnd(LwJsonMsg *msg) {
+    if (msg == NULL) {
+        return -EPERM;
+    }
+    if (msg->string == NULL && !msg->_measure) {
+        // Nothing written yet. The terminator still needs a buffer
+        if (msg->_realloc == NULL) {
+            return -EINVAL;
+        }
+        if (lwJsonGrow(msg, 0) != 0) {
+            return msg->_lastError;
+        }
+    }
+
+    if (msg->_lastError < 0) {
         return msg->_lastError;
     }
 
-    msg->string[msg->_offset] = '}';
-    msg->_offset++;
+    // Close containers left open
+    while (msg->_depth > 0) {
+        if (lwJsonCloseContainer(msg, (msg->_stack & 1) != 0) != 0) {
+            return msg->_lastError;
+        }
+    }
+
+    if (msg->_measure) {
+        return 0;
+    }
+
+    msg->string[msg->_offset] = 0;
+    if (msg->_flush == NULL) {
+        LWJSON_STAT_ADD(bytesWritten, msg->_offset);
+    }
+
+    // Last run of the buffer. Room for it is always kept
+    if (msg->_segmentList != NULL && msg->_offset > msg->_segmentStart) {
+        lwJsonAddSegment(msg->_segmentList, msg->string + msg->_segmentStart, msg->_offset - msg->_segmentStart);
+        msg->_segmentStart = msg->_offset;
+    }
+
+    // Drain what is left in the buffer
+    if (msg->_flush != NULL && msg->_offset > 0) {
+        return lwJsonFlush(msg);
+    }
+
     return 0;
 }
 
-int lwJsonCloseArray(LwJsonMsg *msg) {
-    if (lwJsonCheckWriteError(msg) != 0) {
+int lwJsonWriteMark(const LwJsonMsg *msg, LwJsonWriteMark *mark) {
+    if (msg == NULL || mark == NULL) {
+        return -EINVAL;
+    }
+    // Flushed text can not be taken back
+    if (msg->_flush != NULL) {
+        return -EPERM;
+    }
+    if (msg->_lastError < 0) {
         return msg->_lastError;
     }
 
-    msg->string[msg->_offset] = ']';
-    msg->_offset++;
+    mark->_offset = msg->_offset;
+    mark->_stack = msg->_stack;
+    mark->_depth = msg->_depth;
+    mark->_first = msg->_first;
+    mark->_segmentCount = (msg->_segmentList != NULL) ? msg->_segmentList->count : 0;
+    mark->_segmentStart = msg->_segmentStart;
+
+    return 0;
+}
+
+int lwJsonWriteRollback(LwJsonMsg *msg, const LwJsonWriteMark *mark) {
+    if (msg == NULL || mark == NULL) {
+        return -EINVAL;
+    }
+    if (msg->_flush != NULL || mark->_offset > msg->_offset) {
+        return -EPERM;
+    }
+    if (msg->_segmentList != NULL && mark->_segmentCount > msg->_segmentList->count) {
+        return -EPERM;
+    }
+
+    // Drop everything written after the mark, errors included
+    msg->_offset = mark->_offset;
+    msg->_stack = mark->_stack;
+    msg->_depth = mark->_depth;
+    msg->_first = mark->_first;
+    if (msg->_segmentList != NULL) {
+        msg->_segmentList->count = mark->_segmentCount;
+    }
+    msg->_segmentStart = mark->_segmentStart;
+    msg->_lastError = 0;
+
     return 0;
 }
 
+void LwJsonWriteApplyOffset(LwJsonMsg *msg, uint32_t offset) {
+    if (msg == NULL) {
+        return;
+    }
+
+    msg->_offset += offset;
+    msg->_first = false;
+}
+
+int lwJsonStartObject(LwJsonMsg *msg) {
+    LwJsonValueType type = LWJSON_VAL_OBJECT;
+    return lwJsonAddEntry(msg, NULL, NULL, type, NULL);
+}
+
+int lwJsonStartArray(LwJsonMsg *msg) {
+    LwJsonValueType type = LWJSON_VAL_ARRAY;
+    return lwJsonAddEntry(msg, NULL, NULL, type, NULL);
+}
+
+int lwJsonCloseObject(LwJsonMsg *msg) {
+    return lwJsonCloseContainer(msg, true);
+}
+
+int lwJsonCloseArray(LwJsonMsg *msg) {
+    return lwJsonCloseContainer(msg, false);
+}
+
 int lwJsonAddStringToObject(LwJsonMsg *msg, const char *name, const char *string) {
-    char defaultString[] = "";
     LwJsonValueType type = LWJSON_VAL_STRING;
     LwJsonValue jsonValue;
-    if (lwJsonIsValidUTF8String(string)) {
-        jsonValue.valueString = (char*)string;
-    } else {
-        jsonValue.valueString = (char*)defaultString;
-    }
+    jsonValue.valueString = (char*)string;
 
-    return  lwJsonAddNameAndValuePair(msg, name, type, &jsonValue);
+    return lwJsonAddNameAndValuePair(msg, name, type, &jsonValue);
 }
 
 int lwJsonAddStringToArray(LwJsonMsg *msg, const char *string) {
-    char defaultString[] = "";
     LwJsonValueType type = LWJSON_VAL_STRING;
     LwJsonValue jsonValue;
-    if (lwJsonIsValidUTF8String(string)) {
-        jsonValue.valueString = (char*)string;
-    } else {
-        jsonValue.valueString = (char*)defaultString;
-    }
+    jsonValue.valueString = (char*)string;
 
     return lwJsonAddValueToArray(msg, type, &jsonValue);
 }
 
-int lwJsonAddIntToObject(LwJsonMsg *msg, const char *name, long long value) {
+int lwJsonAddIntToObject(LwJsonMsg *msg, const char *name, int64_t value) {
     LwJsonValueType type = LWJSON_VAL_NUMBER;
     LwJsonValue jsonValue;
     jsonValue.valueInt = value;
@@ -130,7 +417,7 @@ int lwJsonAddBooleanToObject(LwJsonMsg *msg, const char *name, bool boolean) {
     return lwJsonAddNameAndValuePair(msg, name, type, &jsonValue);
 }
 
-int lwJsonAddIntToArray(LwJsonMsg *msg, long long value) {
+int lwJsonAddIntToArray(LwJsonMsg *msg, int64_t value) {
     LwJsonValueType type = LWJSON_VAL_NUMBER;
     LwJsonValue jsonValue;
     jsonValue.valueInt = value;
@@ -144,6 +431,60 @@ int lwJsonAddBooleanToArray(LwJsonMsg *msg, bool boolean) {
     return lwJsonAddValueToArray(msg, type, &jsonValue);
 }
 
+int lwJsonAddDoubleToObject(LwJsonMsg *msg, const char *name, double value) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    lwJsonDoubleValue(msg, &jsonValue, number, value, LWJSON_SLOT_SHORTEST);
+    return lwJsonAddNameAndValuePair(msg, name, type, &jsonValue);
+}
+
+int lwJsonAddDoubleToArray(LwJsonMsg *msg, double value) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    lwJsonDoubleValue(msg, &jsonValue, number, value, LWJSON_SLOT_SHORTEST);
+    return lwJsonAddValueToArray(msg, type, &jsonValue);
+}
+
+int lwJsonAddFloatToObject(LwJsonMsg *msg, const char *name, float value) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    lwJsonFloatValue(msg, &jsonValue, number, value);
+    return lwJsonAddNameAndValuePair(msg, name, type, &jsonValue);
+}
+
+int lwJsonAddFloatToArray(LwJsonMsg *msg, float value) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    lwJsonFloatValue(msg, &jsonValue, number, value);
+    return lwJsonAddValueToArray(msg, type, &jsonValue);
+}
+
+int lwJsonAddFixedDoubleToObject(LwJsonMsg *msg, const char *name, double value, uint32_t decimals) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    if (decimals > LWJSON_FIXED_DECIMALS_MAX) {
+        return -EINVAL;
+    }
+    lwJsonDoubleValue(msg, &jsonValue, number, value, decimals);
+    return lwJsonAddNameAndValuePair(msg, name, type, &jsonValue);
+}
+
+int lwJsonAddFixedDoubleToArray(LwJsonMsg *msg, double value, uint32_t decimals) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    if (decimals > LWJSON_FIXED_DECIMALS_MAX) {
+        return -EINVAL;
+    }
+    lwJsonDoubleValue(msg, &jsonValue, number, value, decimals);
+    return lwJsonAddValueToArray(msg, type, &jsonValue);
+}
+
 int lwJsonAddObjectToObject(LwJsonMsg *msg, const char *name) {
     LwJsonValueType type = LWJSON_VAL_OBJECT;
     return lwJsonAddNameAndValuePair(msg, name, type, NULL);
@@ -175,289 +516,1990 @@ int lwJsonAddNullToArray(LwJsonMsg *msg) {
 }
 
 int lwJsonAppendObject(LwJsonMsg *msg, const char *name, const char *objString) {
-    uint32_t objLen;
+    LwJsonValueType type = LWJSON_VAL_RAW;
+    LwJsonValue jsonValue;
+
+    if (objString == NULL) {
+        return -EINVAL;
+    }
+
+    jsonValue.valueString = (char*)objString;
+    return lwJsonAddNameAndValuePair(msg, name, type, &jsonValue);
+}
+
+int lwJsonKeyInit(LwJsonKey *key, const char *name, char *buffer, uint32_t bufferLen) {
     uint32_t nameLen;
-    uint32_t requiredLen;
-    bool separator = false;
+    uint32_t escapedLen;
 
-    if (name == NULL || objString == NULL) {
+    if (key == NULL || name == NULL || buffer == NULL) {
         return -EINVAL;
     }
 
-    objLen = strlen(objString);
     nameLen = strlen(name);
-    requiredLen = nameLen + objLen + 3;
-    if (msg->string[msg->_offset - 1] != '{' && msg->string[msg->_offset - 1] != '[') {
-        requiredLen++;
-        separator = true;
+    if (lwJsonScanString(name, nameLen, LWJSON_UTF8_REJECT, &escapedLen) != 0) {
+        return -EINVAL;
     }
-
-    // Check there is enough space
-    if (msg->_offset > (msg->len - requiredLen) || requiredLen > msg->len) {
-        msg->_lastError = (-ENOMEM);
+    if (escapedLen > (UINT32_MAX - 3) || bufferLen < (escapedLen + 3)) {
         return -ENOMEM;
     }
 
-    // Add separator if necessary
-    if (separator) {
-        msg->string[msg->_offset] = ',';
-        msg->_offset++;
-    }
+    // Quoted name followed by ':'
+    buffer[0] = '"';
+    lwJsonWriteEscaped(buffer + 1, name, nameLen, LWJSON_UTF8_REJECT);
+    buffer[escapedLen + 1] = '"';
+    buffer[escapedLen + 2] = ':';
+    key->token = buffer;
+    key->len = escapedLen + 3;
 
-    // Add name
-    msg->string[msg->_offset] = '"';
-    msg->_offset++;
-    strcpy(msg->string + msg->_offset, name);
-    msg->_offset += nameLen;
-    strcpy(msg->string + msg->_offset, "\":");
-    msg->_offset += 2;
+    return 0;
+}
 
-    // Add object
-    memcpy(&msg->string[msg->_offset], objString, objLen);
-    msg->_offset += objLen;
+int lwJsonAddStringToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, const char *string) {
+    LwJsonValueType type = LWJSON_VAL_STRING;
+    LwJsonValue jsonValue;
+    jsonValue.valueString = (char*)string;
+    return lwJsonAddKeyAndValuePair(msg, key, type, &jsonValue);
+}
 
-    return 0;
+int lwJsonAddIntToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, int64_t value) {
+    LwJsonValueType type = LWJSON_VAL_NUMBER;
+    LwJsonValue jsonValue;
+    jsonValue.valueInt = value;
+    return lwJsonAddKeyAndValuePair(msg, key, type, &jsonValue);
 }
 
+int lwJsonAddDoubleToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, double value) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    lwJsonDoubleValue(msg, &jsonValue, number, value, LWJSON_SLOT_SHORTEST);
+    return lwJsonAddKeyAndValuePair(msg, key, type, &jsonValue);
+}
 
-static int lwJsonCalculateValueStringLength(LwJsonValueType type, LwJsonValue *value) {
-    unsigned int valueLen = 0;
-    char auxString[50];
+int lwJsonAddFloatToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, float value) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    lwJsonFloatValue(msg, &jsonValue, number, value);
+    return lwJsonAddKeyAndValuePair(msg, key, type, &jsonValue);
+}
 
-    switch (type) {
-    case LWJSON_VAL_STRING:
-        if (value == NULL) {
-            return -EINVAL;
-        }
-        valueLen = strlen(value->valueString) + 2;
-        break;
-    case LWJSON_VAL_NUMBER:
-        if (value == NULL) {
-            return -EINVAL;
-        }
-        sprintf(auxString, "%lld", value->valueInt);
-        valueLen = strlen(auxString);
-        break;
-    case LWJSON_VAL_BOOLEAN:
-        if (value == NULL) {
-            return -EINVAL;
-        }
-        if(value->valueBool == true) {
-            // true
-            valueLen += 4;
-        } else {
-            // false
-            valueLen += 5;
-        }
-        break;
-    case LWJSON_VAL_OBJECT:
-    case LWJSON_VAL_ARRAY:
-        valueLen = 1;
-        break;
-    case LWJSON_VAL_NULL:
-        valueLen = 4;
-        break;
+int lwJsonAddFixedDoubleToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, double value, uint32_t decimals) {
+    LwJsonValueType type = LWJSON_VAL_DOUBLE;
+    LwJsonValue jsonValue;
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    if (decimals > LWJSON_FIXED_DECIMALS_MAX) {
+        return -EINVAL;
     }
+    lwJsonDoubleValue(msg, &jsonValue, number, value, decimals);
+    return lwJsonAddKeyAndValuePair(msg, key, type, &jsonValue);
+}
 
-    return valueLen;
+int lwJsonAddBooleanToObjectKey(LwJsonMsg *msg, const LwJsonKey *key, bool boolean) {
+    LwJsonValueType type = LWJSON_VAL_BOOLEAN;
+    LwJsonValue jsonValue;
+    jsonValue.valueBool = boolean;
+    return lwJsonAddKeyAndValuePair(msg, key, type, &jsonValue);
 }
 
-static int lwJsonCheckWriteError(LwJsonMsg *msg) {
-    if (msg == NULL) {
-        msg->_lastError = (-EINVAL);
+int lwJsonAddObjectToObjectKey(LwJsonMsg *msg, const LwJsonKey *key) {
+    LwJsonValueType type = LWJSON_VAL_OBJECT;
+    return lwJsonAddKeyAndValuePair(msg, key, type, NULL);
+}
+
+int lwJsonAddArrayToObjectKey(LwJsonMsg *msg, const LwJsonKey *key) {
+    LwJsonValueType type = LWJSON_VAL_ARRAY;
+    return lwJsonAddKeyAndValuePair(msg, key, type, NULL);
+}
+
+int lwJsonAddNullToObjectKey(LwJsonMsg *msg, const LwJsonKey *key) {
+    LwJsonValueType type = LWJSON_VAL_NULL;
+    return lwJsonAddKeyAndValuePair(msg, key, type, NULL);
+}
+
+int lwJsonAddIntArray(LwJsonMsg *msg, const char *name, const int64_t *values, uint32_t count) {
+    uint64_t total = (count > 0) ? count : 1;
+    uint32_t offset;
+    uint32_t i;
+    int result;
+
+    if (values == NULL && count > 0) {
         return -EINVAL;
     }
-    if (msg->_offset >= msg->len) {
-        msg->_lastError = (-ENOMEM);
-        return -ENOMEM;
+    result = lwJsonStartBulkArray(msg, name);
+    if (result != 0) {
+        return result;
     }
 
-    return 0;
-}
+    // Separators and closing bracket plus exact digits
+    for (i = 0; i < count; i++) {
+        total += lwJsonIntLength(values[i]);
+    }
 
-static int lwJsonAddNameAndValuePair(LwJsonMsg *msg, const char *name, LwJsonValueType type, LwJsonValue *value) {
-    unsigned int entryLen = 0;
-    unsigned int nameLen;
+    if (msg->_format == LWJSON_FORMAT_CBOR || lwJsonReserve(msg, total) != 0) {
+        if (msg->_lastError < 0) {
+            return msg->_lastError;
+        }
+        // Binary output or batch larger than a flushing buffer
+        for (i = 0; i < count; i++) {
+            result = lwJsonAddIntToArray(msg, values[i]);
+            if (result != 0) {
+                return result;
+            }
+        }
+        return lwJsonCloseArray(msg);
+    }
+    if (msg->_measure) {
+        msg->_offset += total - 1;
+        return lwJsonCloseArray(msg);
+    }
+
+    offset = msg->_offset;
+    for (i = 0; i < count; i++) {
+        if (i > 0) {
+            msg->string[offset++] = ',';
+        }
+        offset += lwJsonWriteInt(msg->string + offset, values[i]);
+    }
+    msg->_offset = offset;
+
+    return lwJsonCloseArray(msg);
+}
+
+int lwJsonAddDoubleArray(LwJsonMsg *msg, const char *name, const double *values, uint32_t count) {
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    uint32_t len;
+    uint32_t i;
+    int result;
+
+    if (values == NULL && count > 0) {
+        return -EINVAL;
+    }
+    result = lwJsonStartBulkArray(msg, name);
+    if (result != 0) {
+        return result;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (msg->_format == LWJSON_FORMAT_CBOR) {
+            result = lwJsonAddDoubleToArray(msg, values[i]);
+            if (result != 0) {
+                return result;
+            }
+            continue;
+        }
+        // Format in place while there is room for the longest double
+        if (!msg->_measure && (msg->len - msg->_offset) > LWJSON_DOUBLE_STRING_LEN) {
+            if (i > 0) {
+                msg->string[msg->_offset++] = ',';
+            }
+            msg->_offset += lwJsonFormatDouble(msg->string + msg->_offset, values[i], false);
+            continue;
+        }
+
+        len = lwJsonFormatDouble(number, values[i], false);
+        if (lwJsonReserve(msg, len + 1) != 0) {
+            return (msg->_lastError < 0) ? msg->_lastError : -ENOMEM;
+        }
+        if (msg->_measure) {
+            msg->_offset += (i > 0) ? (len + 1) : len;
+            continue;
+        }
+        if (i > 0) {
+            msg->string[msg->_offset++] = ',';
+        }
+        memcpy(msg->string + msg->_offset, number, len);
+        msg->_offset += len;
+    }
+
+    return lwJsonCloseArray(msg);
+}
+
+int lwJsonAddBooleanArray(LwJsonMsg *msg, const char *name, const bool *values, uint32_t count) {
+    uint64_t total = (count > 0) ? count : 1;
+    uint32_t offset;
+    uint32_t i;
+    int result;
+
+    if (values == NULL && count > 0) {
+        return -EINVAL;
+    }
+    result = lwJsonStartBulkArray(msg, name);
+    if (result != 0) {
+        return result;
+    }
+
+    for (i = 0; i < count; i++) {
+        total += values[i] ? 4 : 5;
+    }
+
+    if (msg->_format == LWJSON_FORMAT_CBOR || lwJsonReserve(msg, total) != 0) {
+        if (msg->_lastError < 0) {
+            return msg->_lastError;
+        }
+        // Binary output or batch larger than a flushing buffer
+        for (i = 0; i < count; i++) {
+            result = lwJsonAddBooleanToArray(msg, values[i]);
+            if (result != 0) {
+                return result;
+            }
+        }
+        return lwJsonCloseArray(msg);
+    }
+    if (msg->_measure) {
+        msg->_offset += total - 1;
+        return lwJsonCloseArray(msg);
+    }
+
+    offset = msg->_offset;
+    for (i = 0; i < count; i++) {
+        if (i > 0) {
+            msg->string[offset++] = ',';
+        }
+        if (values[i]) {
+            memcpy(msg->string + offset, "true", 4);
+            offset += 4;
+        } else {
+            memcpy(msg->string + offset, "false", 5);
+            offset += 5;
+        }
+    }
+    msg->_offset = offset;
+
+    return lwJsonCloseArray(msg);
+}
+
+int lwJsonAddStringArray(LwJsonMsg *msg, const char *name, const char *const *values, uint32_t count) {
+    uint64_t total = (count > 0) ? count : 1;
+    uint32_t escapedLen;
+    uint32_t len;
+    uint32_t i;
+    int result;
+
+    if (msg == NULL || (values == NULL && count > 0)) {
+        return -EINVAL;
+    }
+
+    // Validate the whole batch before writing anything
+    for (i = 0; i < count; i++) {
+        if (values[i] == NULL ||
+            lwJsonScanString(values[i], strlen(values[i]), msg->_utf8Policy, &escapedLen) != 0) {
+            msg->_lastError = (-EINVAL);
+            return -EINVAL;
+        }
+        total += (uint64_t)escapedLen + 2;
+    }
+
+    result = lwJsonStartBulkArray(msg, name);
+    if (result != 0) {
+        return result;
+    }
+
+    if (msg->_format == LWJSON_FORMAT_CBOR || lwJsonReserve(msg, total) != 0) {
+        if (msg->_lastError < 0) {
+            return msg->_lastError;
+        }
+        // Binary output or batch larger than a flushing buffer
+        for (i = 0; i < count; i++) {
+            result = lwJsonAddStringToArray(msg, values[i]);
+            if (result != 0) {
+                return result;
+            }
+        }
+        return lwJsonCloseArray(msg);
+    }
+    if (msg->_measure) {
+        msg->_offset += total - 1;
+        return lwJsonCloseArray(msg);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (i > 0) {
+            msg->string[msg->_offset++] = ',';
+        }
+        len = strlen(values[i]);
+        msg->string[msg->_offset++] = '"';
+        msg->_offset += lwJsonWriteEscaped(msg->string + msg->_offset, values[i], len, msg->_utf8Policy);
+        msg->string[msg->_offset++] = '"';
+    }
+
+    return lwJsonCloseArray(msg);
+}
+
+int lwJsonChunkStart(LwJsonMsg *msg) {
+    int result = lwJsonWriteStart(msg);
+
+    if (result != 0) {
+        return result;
+    }
+
+    // Elements of an array opened by the message the chunk is stitched into
+    msg->_stack = 0;
+    msg->_depth = 1;
+    msg->_first = true;
+
+    return 0;
+}
+
+int lwJsonChunkEnd(LwJsonMsg *msg) {
+    if (msg == NULL || msg->string == NULL) {
+        return -EINVAL;
+    }
+    if (msg->_lastError < 0) {
+        return msg->_lastError;
+    }
+
+    // Close containers left open, but not the implicit array
+    while (msg->_depth > 1) {
+        if (lwJsonCloseContainer(msg, (msg->_stack & 1) != 0) != 0) {
+            return msg->_lastError;
+        }
+    }
+    if (msg->_depth != 1) {
+        msg->_lastError = (-EPERM);
+        return -EPERM;
+    }
+
+    msg->string[msg->_offset] = 0;
+
+    return 0;
+}
+
+int lwJsonStitchChunks(LwJsonMsg *msg, const LwJsonMsg *chunks, uint32_t count) {
+    const LwJsonMsg *chunk;
+    uint32_t i;
+
+    if (msg == NULL || (msg->string == NULL && !msg->_measure) || (chunks == NULL && count > 0)) {
+        return -EINVAL;
+    }
+    if (msg->_lastError < 0) {
+        return msg->_lastError;
+    }
+    if (msg->_depth == 0 || (msg->_stack & 1) != 0) {
+        msg->_lastError = (-EPERM);
+        return -EPERM;
+    }
+
+    for (i = 0; i < count; i++) {
+        chunk = &chunks[i];
+        if (chunk->_lastError < 0) {
+            msg->_lastError = chunk->_lastError;
+            return chunk->_lastError;
+        }
+        if (chunk->_offset == 0) {
+            continue;
+        }
+
+        if (!msg->_first && msg->_format != LWJSON_FORMAT_CBOR) {
+            if (lwJsonReserve(msg, 1) != 0) {
+                return msg->_lastError;
+            }
+            if (!msg->_measure) {
+                msg->string[msg->_offset] = ',';
+            }
+            msg->_offset++;
+        }
+
+        // Referenced by a segmented writer, copied otherwise
+        if (msg->_measure) {
+            if (lwJsonReserve(msg, chunk->_offset) != 0) {
+                return msg->_lastError;
+            }
+            msg->_offset += chunk->_offset;
+        } else if (msg->_segmentList != NULL && (msg->_segmentList->count + 3) <= msg->_segmentList->max) {
+            lwJsonAddReference(msg, chunk->string, chunk->_offset);
+        } else if (lwJsonReserve(msg, chunk->_offset) == 0) {
+            memcpy(msg->string + msg->_offset, chunk->string, chunk->_offset);
+            msg->_offset += chunk->_offset;
+        } else if (msg->_lastError < 0 || lwJsonStreamRaw(msg, chunk->string, chunk->_offset) != 0) {
+            return msg->_lastError;
+        }
+        msg->_first = false;
+    }
+
+    return 0;
+}
+
+int lwJsonTemplateStart(LwJsonTemplate *tpl, LwJsonMsg *msg, LwJsonSlot *slots, uint32_t slotMax) {
+    if (tpl == NULL || msg == NULL || (slots == NULL && slotMax > 0)) {
+        return -EINVAL;
+    }
+    // Slot offsets must stay valid, so the text can not be flushed or split into segments
+    if (msg->_flush != NULL || msg->_segmentList != NULL || msg->_measure || msg->_format != LWJSON_FORMAT_JSON) {
+        return -EPERM;
+    }
+
+    tpl->msg = msg;
+    tpl->slots = slots;
+    tpl->slotCount = 0;
+    tpl->slotMax = slotMax;
+
+    return 0;
+}
+
+int lwJsonAddIntSlotToObject(LwJsonTemplate *tpl, const char *name, uint32_t width) {
+    return lwJsonAddSlot(tpl, name, true, LWJSON_VAL_NUMBER, width, 0);
+}
+
+int lwJsonAddIntSlotToArray(LwJsonTemplate *tpl, uint32_t width) {
+    return lwJsonAddSlot(tpl, NULL, false, LWJSON_VAL_NUMBER, width, 0);
+}
+
+int lwJsonAddDoubleSlotToObject(LwJsonTemplate *tpl, const char *name, uint32_t width) {
+    return lwJsonAddSlot(tpl, name, true, LWJSON_VAL_DOUBLE, width, LWJSON_SLOT_SHORTEST);
+}
+
+int lwJsonAddDoubleSlotToArray(LwJsonTemplate *tpl, uint32_t width) {
+    return lwJsonAddSlot(tpl, NULL, false, LWJSON_VAL_DOUBLE, width, LWJSON_SLOT_SHORTEST);
+}
+
+int lwJsonAddFixedDoubleSlotToObject(LwJsonTemplate *tpl, const char *name, uint32_t width, uint32_t decimals) {
+    if (decimals > LWJSON_FIXED_DECIMALS_MAX) {
+        return -EINVAL;
+    }
+    return lwJsonAddSlot(tpl, name, true, LWJSON_VAL_DOUBLE, width, decimals);
+}
+
+int lwJsonAddFixedDoubleSlotToArray(LwJsonTemplate *tpl, uint32_t width, uint32_t decimals) {
+    if (decimals > LWJSON_FIXED_DECIMALS_MAX) {
+        return -EINVAL;
+    }
+    return lwJsonAddSlot(tpl, NULL, false, LWJSON_VAL_DOUBLE, width, decimals);
+}
+
+int lwJsonAddStringSlotToObject(LwJsonTemplate *tpl, const char *name, uint32_t width) {
+    return lwJsonAddSlot(tpl, name, true, LWJSON_VAL_STRING, width, 0);
+}
+
+int lwJsonAddStringSlotToArray(LwJsonTemplate *tpl, uint32_t width) {
+    return lwJsonAddSlot(tpl, NULL, false, LWJSON_VAL_STRING, width, 0);
+}
+
+int lwJsonAddBooleanSlotToObject(LwJsonTemplate *tpl, const char *name) {
+    return lwJsonAddSlot(tpl, name, true, LWJSON_VAL_BOOLEAN, 5, 0);
+}
+
+int lwJsonAddBooleanSlotToArray(LwJsonTemplate *tpl) {
+    return lwJsonAddSlot(tpl, NULL, false, LWJSON_VAL_BOOLEAN, 5, 0);
+}
+
+int lwJsonTemplateSetInt(LwJsonTemplate *tpl, uint32_t slot, int64_t value) {
+    LwJsonSlot *pSlot = lwJsonTemplateSlot(tpl, slot, LWJSON_VAL_NUMBER, 1);
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    uint32_t len;
+
+    if (pSlot == NULL) {
+        return -EINVAL;
+    }
+
+    len = lwJsonIntLength(value);
+    if (len > pSlot->width) {
+        return -ENOMEM;
+    }
+    lwJsonWriteInt(number, value);
+    lwJsonSlotWrite(tpl, pSlot, number, len);
+
+    return 0;
+}
+
+int lwJsonTemplateSetDouble(LwJsonTemplate *tpl, uint32_t slot, double value) {
+    LwJsonSlot *pSlot = lwJsonTemplateSlot(tpl, slot, LWJSON_VAL_DOUBLE, 1);
+    char number[LWJSON_DOUBLE_STRING_LEN];
+    uint32_t len;
+
+    if (pSlot == NULL) {
+        return -EINVAL;
+    }
+
+    if (pSlot->decimals == LWJSON_SLOT_SHORTEST) {
+        len = lwJsonFormatDouble(number, value, false);
+    } else {
+        len = lwJsonFormatFixedDouble(number, value, pSlot->decimals);
+    }
+    if (len > pSlot->width) {
+        return -ENOMEM;
+    }
+    lwJsonSlotWrite(tpl, pSlot, number, len);
+
+    return 0;
+}
+
+int lwJsonTemplateSetString(LwJsonTemplate *tpl, uint32_t slot, const char *string) {
+    LwJsonSlot *pSlot = lwJsonTemplateSlot(tpl, slot, LWJSON_VAL_STRING, 2);
+    char *dst;
+    uint32_t len;
+    uint32_t escapedLen;
+
+    if (pSlot == NULL || string == NULL) {
+        return -EINVAL;
+    }
+
+    len = strlen(string);
+    if (lwJsonScanString(string, len, tpl->msg->_utf8Policy, &escapedLen) != 0) {
+        return -EINVAL;
+    }
+    if (escapedLen > (pSlot->width - 2)) {
+        return -ENOMEM;
+    }
+
+    // Escaped directly into the slot, padded after the closing quote
+    dst = tpl->msg->string + pSlot->offset;
+    dst[0] = '"';
+    lwJsonWriteEscaped(dst + 1, string, len, tpl->msg->_utf8Policy);
+    dst[escapedLen + 1] = '"';
+    memset(dst + escapedLen + 2, ' ', pSlot->width - escapedLen - 2);
+
+    return 0;
+}
+
+int lwJsonTemplateSetBoolean(LwJsonTemplate *tpl, uint32_t slot, bool boolean) {
+    LwJsonSlot *pSlot = lwJsonTemplateSlot(tpl, slot, LWJSON_VAL_BOOLEAN, 5);
+
+    if (pSlot == NULL) {
+        return -EINVAL;
+    }
+
+    if (boolean) {
+        lwJsonSlotWrite(tpl, pSlot, "true", 4);
+    } else {
+        lwJsonSlotWrite(tpl, pSlot, "false", 5);
+    }
+
+    return 0;
+}
+
+int lwJsonTemplateSetNull(LwJsonTemplate *tpl, uint32_t slot) {
+    LwJsonSlot *pSlot;
+
+    if (tpl == NULL || slot >= tpl->slotCount) {
+        return -EINVAL;
+    }
+
+    // Any slot type can be set to null
+    pSlot = &tpl->slots[slot];
+    if (pSlot->width < 4) {
+        return -ENOMEM;
+    }
+    lwJsonSlotWrite(tpl, pSlot, "null", 4);
+
+    return 0;
+}
+
+int lwJsonTemplateCompact(const LwJsonTemplate *tpl, LwJsonMsg *dst) {
+    const char *src;
+    uint32_t start = 0;
+    uint32_t out = 0;
+    uint32_t len;
+    uint32_t i;
+
+    if (tpl == NULL || tpl->msg == NULL || dst == NULL || dst->string == NULL) {
+        return -EINVAL;
+    }
+
+    // Constant fragments between slots plus slot values without padding
+    src = tpl->msg->string;
+    for (i = 0; i <= tpl->slotCount; i++) {
+        len = ((i < tpl->slotCount) ? tpl->slots[i].offset : tpl->msg->_offset) - start;
+        if (len > (dst->len - out)) {
+            return -ENOMEM;
+        }
+        memcpy(dst->string + out, src + start, len);
+        out += len;
+        if (i == tpl->slotCount) {
+            break;
+        }
+
+        start = tpl->slots[i].offset;
+        for (len = tpl->slots[i].width; len > 0 && src[start + len - 1] == ' '; len--) {
+        }
+        if (len > (dst->len - out)) {
+            return -ENOMEM;
+        }
+        memcpy(dst->string + out, src + start, len);
+        out += len;
+        start += tpl->slots[i].width;
+    }
+
+    // Terminate output if there is room for it
+    if (out < dst->len) {
+        dst->string[out] = 0;
+    }
+    dst->len = out;
+
+    return 0;
+}
+
+int lwJsonSplitStart(LwJsonSplitter *split, LwJsonMsg *msg, const char *prefix, const char *name, const char *suffix, LwJsonFlushCallback sink, void *context) {
+    int result;
+
+    if (split == NULL || msg == NULL || name == NULL || sink == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonWriteStart(msg);
+    if (result != 0) {
+        return result;
+    }
+
+    split->msg = msg;
+    split->prefix = prefix;
+    split->name = name;
+    split->suffix = suffix;
+    split->sink = sink;
+    split->context = context;
+    split->maxLen = msg->len;
+
+    return lwJsonSplitOpen(split);
+}
+
+int lwJsonSplitAdd(LwJsonSplitter *split, LwJsonElementCallback element, void *context) {
+    LwJsonWriteMark mark;
+    LwJsonMsg *msg;
+    int result;
+
+    if (split == NULL || split->msg == NULL || element == NULL) {
+        return -EINVAL;
+    }
+    msg = split->msg;
+
+    result = lwJsonWriteMark(msg, &mark);
+    if (result != 0) {
+        return result;
+    }
+
+    result = lwJsonSplitElement(msg, element, context);
+    if (result == -ENOMEM && split->count > 0) {
+        // Send what fits, then retry in a new message
+        lwJsonWriteRollback(msg, &mark);
+        result = lwJsonSplitEmit(split, true);
+        if (result != 0) {
+            return result;
+        }
+        lwJsonWriteMark(msg, &mark);
+        result = lwJsonSplitElement(msg, element, context);
+    }
+
+    if (result != 0) {
+        lwJsonWriteRollback(msg, &mark);
+        return result;
+    }
+    split->count++;
+
+    return 0;
+}
+
+int lwJsonSplitEnd(LwJsonSplitter *split) {
+    if (split == NULL || split->msg == NULL) {
+        return -EINVAL;
+    }
+    if (split->count == 0) {
+        split->msg->len = split->maxLen;
+        return 0;
+    }
+
+    return lwJsonSplitEmit(split, false);
+}
+
+
+static int lwJsonCalculateValueStringLength(LwJsonValueType type, LwJsonValue *value, LwJsonUtf8Policy policy, uint32_t *rawLen) {
     unsigned int valueLen = 0;
-    char auxString[50];
+    uint32_t escapedLen;
+
+    switch (type) {
+    case LWJSON_VAL_STRING:
+        if (value == NULL || value->valueString == NULL) {
+            return -EINVAL;
+        }
+        (*rawLen) = strlen(value->valueString);
+        if (lwJsonScanString(value->valueString, *rawLen, policy, &escapedLen) != 0) {
+            return -EINVAL;
+        }
+        valueLen = escapedLen + 2;
+        break;
+    case LWJSON_VAL_NUMBER:
+        if (value == NULL) {
+            return -EINVAL;
+        }
+        valueLen = lwJsonIntLength(value->valueInt);
+        break;
+    case LWJSON_VAL_DOUBLE:
+    case LWJSON_VAL_RAW:
+        if (value == NULL) {
+            return -EINVAL;
+        }
+        valueLen = strlen(value->valueString);
+        break;
+    case LWJSON_VAL_BOOLEAN:
+        if (value == NULL) {
+            return -EINVAL;
+        }
+        if(value->valueBool == true) {
+            // true
+            valueLen += 4;
+        } else {
+            // false
+            valueLen += 5;
+        }
+        break;
+    case LWJSON_VAL_OBJECT:
+    case LWJSON_VAL_ARRAY:
+        valueLen = 1;
+        break;
+    case LWJSON_VAL_NULL:
+        valueLen = 4;
+        break;
+    }
+
+    return valueLen;
+}
+
+static uint32_t lwJsonIntLength(int64_t value) {
+    if (value < 0) {
+        return lwJsonUIntLength(0 - (uint64_t)value) + 1;
+    }
+    return lwJsonUIntLength(value);
+}
+
+static uint32_t lwJsonUIntLength(uint64_t value) {
+    uint32_t bits;
+    uint32_t digits;
+
+    // Estimate digits from bit length (log10(2) ~= 1233 / 4096) and adjust with a power of 10
+#if defined(__GNUC__)
+    bits = 64 - __builtin_clzll(value | 1);
+#else
+    for (bits = 1; bits < 64 && (value >> bits) != 0; bits++);
+#endif
+    digits = (bits * 1233) >> 12;
+    if (value >= lwJsonPowersOf10[digits]) {
+        digits++;
+    }
+
+    return (digits == 0) ? 1 : digits;
+}
+
+static uint32_t lwJsonWriteInt(char *dst, int64_t value) {
+    uint64_t magnitude;
+    uint32_t len;
+
+    if (value < 0) {
+        magnitude = 0 - (uint64_t)value;
+        len = lwJsonUIntLength(magnitude);
+        dst[0] = '-';
+        lwJsonWriteUInt(dst + 1, magnitude, len);
+        return len + 1;
+    }
+
+    len = lwJsonUIntLength(value);
+    lwJsonWriteUInt(dst, value, len);
+    return len;
+}
+
+static void lwJsonWriteUInt(char *dst, uint64_t value, uint32_t len) {
+    uint32_t pair;
+
+    // Write from the end, two digits at a time
+    dst += len;
+    while (value >= 100) {
+        pair = (value % 100) * 2;
+        value /= 100;
+        dst -= 2;
+        dst[0] = lwJsonDigitPairs[pair];
+        dst[1] = lwJsonDigitPairs[pair + 1];
+    }
+    if (value >= 10) {
+        pair = value * 2;
+        dst -= 2;
+        dst[0] = lwJsonDigitPairs[pair];
+        dst[1] = lwJsonDigitPairs[pair + 1];
+    } else {
+        dst--;
+        dst[0] = '0' + value;
+    }
+}
+
+static uint32_t lwJsonFormatDouble(char *dst, double value, bool single) {
+    uint64_t bits;
+    uint32_t len = 0;
+    char digits[LWJSON_DOUBLE_STRING_LEN];
+    int digitsLen;
+    int K;
+
+    // NaN and infinity can't be represented in JSON
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FF0000000000000ull) == 0x7FF0000000000000ull) {
+        memcpy(dst, "null", 4);
+        return 4;
+    }
+
+    if ((bits >> 63) != 0) {
+        dst[len] = '-';
+        len++;
+        value = -value;
+    }
+    if (value == 0) {
+        dst[len] = '0';
+        return len + 1;
+    }
+
+    // Shortest digits that round trip and decimal exponent
+    Grisu2(value, single, digits, &digitsLen, &K);
+
+    return len + GrisuPrettify(&dst[len], digits, digitsLen, K);
+}
+
+static uint32_t lwJsonFormatFixedDouble(char *dst, double value, uint32_t decimals) {
+    uint64_t bits;
+    uint64_t units;
+    uint64_t integer;
+    uint32_t len = 0;
+    bool negative;
+    double scaled;
+
+    memcpy(&bits, &value, sizeof(bits));
+    negative = ((bits >> 63) != 0);
+    scaled = (negative ? -value : value) * lwJsonPowersOf10[decimals] + 0.5;
+
+    // Values that don't fit in fixed point (or aren't finite) use shortest representation
+    if (!(scaled < 18446744073709551616.0)) {
+        return lwJsonFormatDouble(dst, value, false);
+    }
+
+    units = (uint64_t)scaled;
+    if (negative && units != 0) {
+        dst[len] = '-';
+        len++;
+    }
+
+    // Integer part
+    integer = units / lwJsonPowersOf10[decimals];
+    lwJsonWriteUInt(&dst[len], integer, lwJsonUIntLength(integer));
+    len += lwJsonUIntLength(integer);
+
+    // Decimal part, zero padded
+    if (decimals > 0) {
+        dst[len] = '.';
+        len++;
+        memset(&dst[len], '0', decimals);
+        lwJsonWriteUInt(&dst[len], units % lwJsonPowersOf10[decimals], decimals);
+        len += decimals;
+    }
+
+    return len;
+}
+
+static void Grisu2(double value, bool single, char *digits, int *len, int *K) {
+    uint64_t bits;
+    uint64_t hidden;
+    uint32_t bits32;
+    float valueFloat;
+    LwJsonDiyFp v, plus, minus, cached, W, Wp, Wm;
+    double dk;
+    int k;
+    int shift;
+    uint32_t index;
+
+    // Decompose value. Single precision values get the wider boundaries of a float
+    if (single) {
+        valueFloat = (float)value;
+        memcpy(&bits32, &valueFloat, sizeof(bits32));
+        hidden = 0x00800000ull;
+        shift = 39;
+        v.f = bits32 & 0x007FFFFF;
+        v.e = (int)((bits32 >> 23) & 0xFF);
+        if (v.e != 0) {
+            v.f += hidden;
+            v.e -= 150;
+        } else {
+            v.e = -149;
+        }
+    } else {
+        memcpy(&bits, &value, sizeof(bits));
+        hidden = 0x0010000000000000ull;
+        shift = 10;
+        v.f = bits & 0x000FFFFFFFFFFFFFull;
+        v.e = (int)((bits >> 52) & 0x7FF);
+        if (v.e != 0) {
+            v.f += hidden;
+            v.e -= 1075;
+        } else {
+            v.e = -1074;
+        }
+    }
+
+    // Boundaries m+ and m- with the same exponent
+    plus.f = (v.f << 1) + 1;
+    plus.e = v.e - 1;
+    while ((plus.f & (hidden << 1)) == 0) {
+        plus.f <<= 1;
+        plus.e--;
+    }
+    plus.f <<= shift;
+    plus.e -= shift;
+    if (v.f == hidden) {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    } else {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    // Cached power of 10 that brings the exponent into [-60, -32]
+    dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    k = (int)dk;
+    if (dk - k > 0.0) {
+        k++;
+    }
+    index = (uint32_t)((k >> 3) + 1);
+    (*K) = -(-348 + (int)(index << 3));
+    cached.f = lwJsonCachedPowersF[index];
+    cached.e = lwJsonCachedPowersE[index];
+
+    W = DiyFpMultiply(DiyFpNormalize(v), cached);
+    Wp = DiyFpMultiply(plus, cached);
+    Wm = DiyFpMultiply(minus, cached);
+    Wm.f++;
+    Wp.f--;
+
+    (*len) = 0;
+    GrisuDigitGen(W, Wp, Wp.f - Wm.f, digits, len, K);
+}
+
+static void GrisuDigitGen(LwJsonDiyFp W, LwJsonDiyFp Mp, uint64_t delta, char *digits, int *len, int *K) {
+    LwJsonDiyFp one;
+    uint64_t wpW;
+    uint32_t p1;
+    uint64_t p2;
+    uint64_t rest;
+    uint32_t d;
+    int kappa;
+
+    one.f = (uint64_t)1 << -Mp.e;
+    one.e = Mp.e;
+    wpW = Mp.f - W.f;
+    p1 = (uint32_t)(Mp.f >> -one.e);
+    p2 = Mp.f & (one.f - 1);
+    kappa = lwJsonUIntLength(p1);
+
+    // Integer part digits
+    while (kappa > 0) {
+        d = p1 / lwJsonPowersOf10[kappa - 1];
+        p1 %= lwJsonPowersOf10[kappa - 1];
+        if (d != 0 || (*len) != 0) {
+            digits[(*len)++] = '0' + d;
+        }
+        kappa--;
+        rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            (*K) += kappa;
+            GrisuRound(digits, *len, delta, rest, lwJsonPowersOf10[kappa] << -one.e, wpW);
+            return;
+        }
+    }
+
+    // Fractional part digits
+    while (true) {
+        p2 *= 10;
+        delta *= 10;
+        d = (uint32_t)(p2 >> -one.e);
+        if (d != 0 || (*len) != 0) {
+            digits[(*len)++] = '0' + d;
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            (*K) += kappa;
+            GrisuRound(digits, *len, delta, p2, one.f, wpW * ((-kappa < 20) ? lwJsonPowersOf10[-kappa] : 0));
+            return;
+        }
+    }
+}
+
+static void GrisuRound(char *digits, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpW) {
+    // Move last digit towards the exact value while staying inside the rounding interval
+    while (rest < wpW && delta - rest >= tenKappa && (rest + tenKappa < wpW || wpW - rest > rest + tenKappa - wpW)) {
+        digits[len - 1]--;
+        rest += tenKappa;
+    }
+}
+
+static uint32_t GrisuPrettify(char *dst, const char *digits, int len, int k) {
+    int kk = len + k;
+    int exponent;
+    uint32_t out;
+
+    if (k >= 0 && kk <= 21) {
+        // Integer: 1234e7 -> 12340000000
+        memcpy(dst, digits, len);
+        memset(&dst[len], '0', k);
+        return kk;
+    } else if (kk > 0 && kk <= 21) {
+        // Decimal point inside digits: 1234e-2 -> 12.34
+        memcpy(dst, digits, kk);
+        dst[kk] = '.';
+        memcpy(&dst[kk + 1], &digits[kk], len - kk);
+        return len + 1;
+    } else if (kk > -6 && kk <= 0) {
+        // Leading zeros: 1234e-6 -> 0.001234
+        dst[0] = '0';
+        dst[1] = '.';
+        memset(&dst[2], '0', -kk);
+        memcpy(&dst[2 - kk], digits, len);
+        return 2 - kk + len;
+    }
+
+    // Exponent notation: 1234e30 -> 1.234e33
+    out = 0;
+    dst[out++] = digits[0];
+    if (len > 1) {
+        dst[out++] = '.';
+        memcpy(&dst[out], &digits[1], len - 1);
+        out += len - 1;
+    }
+    dst[out++] = 'e';
+    exponent = kk - 1;
+    if (exponent < 0) {
+        dst[out++] = '-';
+        exponent = -exponent;
+    }
+    lwJsonWriteUInt(&dst[out], exponent, lwJsonUIntLength(exponent));
+    out += lwJsonUIntLength(exponent);
+
+    return out;
+}
+
+static LwJsonDiyFp DiyFpMultiply(LwJsonDiyFp x, LwJsonDiyFp y) {
+    LwJsonDiyFp result;
+    uint64_t a = x.f >> 32;
+    uint64_t b = x.f & 0xFFFFFFFFu;
+    uint64_t c = y.f >> 32;
+    uint64_t d = y.f & 0xFFFFFFFFu;
+    uint64_t ac = a * c;
+    uint64_t bc = b * c;
+    uint64_t ad = a * d;
+    uint64_t bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & 0xFFFFFFFFu) + (bc & 0xFFFFFFFFu);
+
+    // Upper 64 bits of the 128 bit product, rounded
+    tmp += 1u << 31;
+    result.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    result.e = x.e + y.e + 64;
+
+    return result;
+}
+
+static LwJsonDiyFp DiyFpNormalize(LwJsonDiyFp x) {
+    while ((x.f & 0x8000000000000000ull) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+
+    return x;
+}
+
+static int lwJsonScanString(const char *string, uint32_t len, LwJsonUtf8Policy policy, uint32_t *escapedLen) {
+    const unsigned char *bytes = (const unsigned char*)string;
+    LwJsonWord highs = (policy == LWJSON_UTF8_TRUSTED) ? 0 : LWJSON_WORD_HIGHS;
+    uint32_t outLen = len;
+    uint32_t i = 0;
+    uint32_t end;
+    uint32_t sequenceLen;
+    LwJsonWord word;
+    unsigned char c;
+
+    while (i < len) {
+        // Skip whole ASCII words without chars to escape
+        if ((i + LWJSON_WORD_SIZE) <= len) {
+            memcpy(&word, &bytes[i], LWJSON_WORD_SIZE);
+            if ((WordNeedsEscape(word) | (word & highs)) == 0) {
+                i += LWJSON_WORD_SIZE;
+                continue;
+            }
+            end = i + LWJSON_WORD_SIZE;
+        } else {
+            end = len;
+        }
+
+        while (i < end) {
+            c = bytes[i];
+            if (c >= 0x80 && policy != LWJSON_UTF8_TRUSTED) {
+                sequenceLen = lwJsonUtf8SequenceLen(&bytes[i], len - i);
+                if (sequenceLen == 0) {
+                    if (policy == LWJSON_UTF8_REJECT) {
+                        return -EINVAL;
+                    }
+                    // Invalid byte is replaced by U+FFFD (3 bytes)
+                    outLen += 2;
+                    sequenceLen = 1;
+                }
+                i += sequenceLen;
+                continue;
+            }
+
+            if (c == '"' || c == '\\') {
+                outLen += 1;
+            } else if (c < 0x20) {
+                outLen += (lwJsonControlEscapes[c] == 'u') ? 5 : 1;
+            }
+            i++;
+        }
+    }
+
+    (*escapedLen) = outLen;
+
+    return 0;
+}
+
+static uint32_t lwJsonWriteEscaped(char *dst, const char *string, uint32_t len, LwJsonUtf8Policy policy) {
+    static const char hexDigits[] = "0123456789abcdef";
+    const unsigned char *bytes = (const unsigned char*)string;
+    LwJsonWord highs = (policy == LWJSON_UTF8_REPLACE) ? LWJSON_WORD_HIGHS : 0;
+    uint32_t out = 0;
+    uint32_t runStart = 0;
+    uint32_t i = 0;
+    uint32_t end;
+    uint32_t sequenceLen;
+    LwJsonWord word;
+    unsigned char c;
+
+    while (i < len) {
+        // Clean words are left in the current run and copied in bulk
+        if ((i + LWJSON_WORD_SIZE) <= len) {
+            memcpy(&word, &bytes[i], LWJSON_WORD_SIZE);
+            if ((WordNeedsEscape(word) | (word & highs)) == 0) {
+                i += LWJSON_WORD_SIZE;
+                continue;
+            }
+            end = i + LWJSON_WORD_SIZE;
+        } else {
+            end = len;
+        }
+
+        while (i < end) {
+            c = bytes[i];
+            if (c >= 0x80) {
+                // Only invalid sequences in replace mode break the run
+                sequenceLen = 1;
+                if (policy == LWJSON_UTF8_REPLACE) {
+                    sequenceLen = lwJsonUtf8SequenceLen(&bytes[i], len - i);
+                    if (sequenceLen == 0) {
+                        memcpy(&dst[out], &string[runStart], i - runStart);
+                        out += i - runStart;
+                        memcpy(&dst[out], "\xEF\xBF\xBD", 3);
+                        out += 3;
+                        runStart = i + 1;
+                        sequenceLen = 1;
+                    }
+                }
+                i += sequenceLen;
+                continue;
+            }
+            if (c != '"' && c != '\\' && c >= 0x20) {
+                i++;
+                continue;
+            }
+
+            // Flush clean run and write escape sequence
+            memcpy(&dst[out], &string[runStart], i - runStart);
+            out += i - runStart;
+            runStart = i + 1;
+            dst[out++] = '\\';
+            if (c >= 0x20) {
+                dst[out++] = c;
+            } else if (lwJsonControlEscapes[c] != 'u') {
+                dst[out++] = lwJsonControlEscapes[c];
+            } else {
+                dst[out++] = 'u';
+                dst[out++] = '0';
+                dst[out++] = '0';
+                dst[out++] = hexDigits[c >> 4];
+                dst[out++] = hexDigits[c & 0x0F];
+            }
+            i++;
+        }
+    }
+
+    memcpy(&dst[out], &string[runStart], len - runStart);
+    out += len - runStart;
+    LWJSON_STAT_ADD(stringsCopied, 1);
+
+    return out;
+}
+
+static LwJsonWord WordNeedsEscape(LwJsonWord word) {
+    LwJsonWord quotes = word ^ (LWJSON_WORD_ONES * '"');
+    LwJsonWord backslashes = word ^ (LWJSON_WORD_ONES * '\\');
+
+    // Non zero if any byte is a control char, a quote or a backslash
+    return ((word - LWJSON_WORD_ONES * 0x20) & ~word & LWJSON_WORD_HIGHS) |
+           ((quotes - LWJSON_WORD_ONES) & ~quotes & LWJSON_WORD_HIGHS) |
+           ((backslashes - LWJSON_WORD_ONES) & ~backslashes & LWJSON_WORD_HIGHS);
+}
+
+static int lwJsonCheckWriteError(LwJsonMsg *msg) {
+    if (msg == NULL) {
+        return -EINVAL;
+    }
+    // First error sticks until the writer is restarted or rolled back
+    if (msg->_lastError < 0) {
+        return msg->_lastError;
+    }
+    if (msg->_offset >= msg->len && msg->_flush != NULL) {
+        LWJSON_STAT_ADD(enomemRetries, 1);
+        return lwJsonFlush(msg);
+    }
+    if (msg->_offset >= msg->len && msg->_realloc != NULL) {
+        LWJSON_STAT_ADD(enomemRetries, 1);
+        return lwJsonGrow(msg, 1);
+    }
+    if (msg->_offset >= msg->len) {
+        msg->_lastError = (-ENOMEM);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+static int lwJsonAddNameAndValuePair(LwJsonMsg *msg, const char *name, LwJsonValueType type, LwJsonValue *value) {
+    if (name == NULL) {
+        if (msg != NULL) {
+            msg->_lastError = (-EINVAL);
+        }
+        return -EINVAL;
+    }
+
+    return lwJsonAddEntry(msg, name, NULL, type, value);
+}
+
+static int lwJsonAddKeyAndValuePair(LwJsonMsg *msg, const LwJsonKey *key, LwJsonValueType type, LwJsonValue *value) {
+    if (key == NULL || key->token == NULL) {
+        if (msg != NULL) {
+            msg->_lastError = (-EINVAL);
+        }
+        return -EINVAL;
+    }
+
+    return lwJsonAddEntry(msg, NULL, key, type, value);
+}
+
+static int lwJsonAddValueToArray(LwJsonMsg *msg, LwJsonValueType type, LwJsonValue *value) {
+    return lwJsonAddEntry(msg, NULL, NULL, type, value);
+}
+
+static int lwJsonAddEntry(LwJsonMsg *msg, const char *name, const LwJsonKey *key, LwJsonValueType type, LwJsonValue *value) {
+    unsigned int entryLen = 0;
+    uint32_t nameLen = 0;
+    uint32_t escapedNameLen = 0;
+    uint32_t stringLen = 0;
+    int valueLen = 0;
     unsigned char flagSeparator = 0;
+    bool reference = false;
+
+    if (lwJsonCheckWriteError(msg) != 0) {
+        return (msg == NULL) ? -EINVAL : msg->_lastError;
+    }
+    if (lwJsonCheckNesting(msg, name != NULL || key != NULL, type) != 0) {
+        return msg->_lastError;
+    }
+    if (msg->_format == LWJSON_FORMAT_CBOR) {
+        return lwJsonAddEntryCbor(msg, name, key, type, value);
+    }
+
+    // Calculate and check len
+    valueLen = lwJsonCalculateValueStringLength(type, value, msg->_utf8Policy, &stringLen);
+    if (valueLen < 0) {
+        msg->_lastError = (-EINVAL);
+        return -EINVAL;
+    }
+    entryLen = valueLen;
+
+    // Long strings without escapes are referenced in place by a segmented writer
+    if (msg->_segmentList != NULL && type == LWJSON_VAL_STRING && stringLen > 0 && stringLen >= msg->_refMinLen &&
+        (uint32_t)valueLen == (stringLen + 2) && (msg->_segmentList->count + 3) <= msg->_segmentList->max) {
+        reference = true;
+        entryLen -= stringLen;
+    }
+
+    // Name is escaped and quoted, followed by ':'
+    if (name != NULL) {
+        nameLen = strlen(name);
+        if (lwJsonScanString(name, nameLen, msg->_utf8Policy, &escapedNameLen) != 0) {
+            msg->_lastError = (-EINVAL);
+            return -EINVAL;
+        }
+        entryLen += escapedNameLen + 3;
+    } else if (key != NULL) {
+        entryLen += key->len;
+    }
+
+    if (!msg->_first) {
+        entryLen ++;
+        flagSeparator = 1;
+    }
+
+    // Check space. A streaming writer drains the buffer first, a growable one grows it
+    if (entryLen > msg->len || msg->_offset > (msg->len - entryLen)) {
+        if (msg->_flush != NULL) {
+            LWJSON_STAT_ADD(enomemRetries, 1);
+            if (lwJsonFlush(msg) != 0) {
+                return msg->_lastError;
+            }
+            if (entryLen > msg->len) {
+                // Entry does not fit even in an empty buffer
+                lwJsonUpdateNesting(msg, type);
+                return lwJsonAddEntryStreamed(msg, name, nameLen, key, type, value,
+                                              (type == LWJSON_VAL_STRING) ? stringLen : (uint32_t)valueLen, flagSeparator);
+            }
+        } else if (msg->_realloc != NULL) {
+            LWJSON_STAT_ADD(enomemRetries, 1);
+            if (lwJsonGrow(msg, entryLen) != 0) {
+                return msg->_lastError;
+            }
+        } else {
+            msg->_lastError = (-ENOMEM);
+            return -ENOMEM;
+        }
+    }
+
+    if (msg->_measure) {
+        msg->_offset += entryLen;
+        lwJsonUpdateNesting(msg, type);
+        return 0;
+    }
+
+    // Add separator if necessary
+    if (flagSeparator != 0) {
+        msg->string[msg->_offset] = ',';
+        msg->_offset++;
+    }
+
+    // Add name
+    if (name != NULL) {
+        msg->string[msg->_offset] = '"';
+        msg->_offset++;
+        msg->_offset += lwJsonWriteEscaped(msg->string + msg->_offset, name, nameLen, msg->_utf8Policy);
+        msg->string[msg->_offset] = '"';
+        msg->string[msg->_offset + 1] = ':';
+        msg->_offset += 2;
+    } else if (key != NULL) {
+        memcpy(msg->string + msg->_offset, key->token, key->len);
+        msg->_offset += key->len;
+    }
+
+    // Add value
+    switch (type) {
+    case LWJSON_VAL_STRING:
+        msg->string[msg->_offset] = '"';
+        msg->_offset++;
+        if (reference) {
+            lwJsonAddReference(msg, value->valueString, stringLen);
+        } else {
+            msg->_offset += lwJsonWriteEscaped(msg->string + msg->_offset, value->valueString, stringLen, msg->_utf8Policy);
+        }
+        msg->string[msg->_offset] = '"';
+        msg->_offset++;
+        break;
+    case LWJSON_VAL_NUMBER:
+        msg->_offset += lwJsonWriteInt(msg->string + msg->_offset, value->valueInt);
+        break;
+    case LWJSON_VAL_DOUBLE:
+    case LWJSON_VAL_RAW:
+        memcpy(msg->string + msg->_offset, value->valueString, valueLen);
+        msg->_offset += valueLen;
+        break;
+    case LWJSON_VAL_BOOLEAN:
+        if (value->valueBool == true) {
+            memcpy(msg->string + msg->_offset, "true", 4);
+        } else {
+            memcpy(msg->string + msg->_offset, "false", 5);
+        }
+        msg->_offset += valueLen;
+        break;
+    case LWJSON_VAL_OBJECT:
+        msg->string[msg->_offset] = '{';
+        msg->_offset++;
+        break;
+    case LWJSON_VAL_ARRAY:
+        msg->string[msg->_offset] = '[';
+        msg->_offset++;
+        break;
+    case LWJSON_VAL_NULL:
+        memcpy(msg->string + msg->_offset, "null", 4);
+        msg->_offset += valueLen;
+        break;
+    }
+
+    lwJsonUpdateNesting(msg, type);
+
+    return 0;
+}
+
+static int lwJsonAddEntryStreamed(LwJsonMsg *msg, const char *name, uint32_t nameLen, const LwJsonKey *key, LwJsonValueType type, LwJsonValue *value, uint32_t valueLen, bool separator) {
+    char number[LWJSON_DOUBLE_STRING_LEN];
+
+    if (separator) {
+        lwJsonStreamRaw(msg, ",", 1);
+    }
+
+    if (name != NULL) {
+        lwJsonStreamRaw(msg, "\"", 1);
+        lwJsonStreamEscaped(msg, name, nameLen);
+        lwJsonStreamRaw(msg, "\":", 2);
+    } else if (key != NULL) {
+        lwJsonStreamRaw(msg, key->token, key->len);
+    }
+
+    switch (type) {
+    case LWJSON_VAL_STRING:
+        lwJsonStreamRaw(msg, "\"", 1);
+        lwJsonStreamEscaped(msg, value->valueString, valueLen);
+        lwJsonStreamRaw(msg, "\"", 1);
+        break;
+    case LWJSON_VAL_NUMBER:
+        lwJsonStreamRaw(msg, number, lwJsonWriteInt(number, value->valueInt));
+        break;
+    case LWJSON_VAL_DOUBLE:
+    case LWJSON_VAL_RAW:
+        lwJsonStreamRaw(msg, value->valueString, valueLen);
+        break;
+    case LWJSON_VAL_BOOLEAN:
+        lwJsonStreamRaw(msg, (value->valueBool == true) ? "true" : "false", valueLen);
+        break;
+    case LWJSON_VAL_OBJECT:
+        lwJsonStreamRaw(msg, "{", 1);
+        break;
+    case LWJSON_VAL_ARRAY:
+        lwJsonStreamRaw(msg, "[", 1);
+        break;
+    case LWJSON_VAL_NULL:
+        lwJsonStreamRaw(msg, "null", 4);
+        break;
+    }
+
+    return msg->_lastError;
+}
+
+static int lwJsonAddEntryCbor(LwJsonMsg *msg, const char *name, const LwJsonKey *key, LwJsonValueType type, LwJsonValue *value) {
+    uint8_t nameHead[LWJSON_CBOR_HEAD_LEN_MAX];
+    uint8_t valueHead[LWJSON_CBOR_HEAD_LEN_MAX];
+    LwJsonUtf8Policy policy;
+    const char *nameString = NULL;
+    const char *payload = NULL;
+    uint32_t nameHeadLen = 0;
+    uint32_t nameLen = 0;
+    uint32_t valueHeadLen = 0;
+    uint32_t payloadLen = 0;
+    uint32_t escapedLen;
+    uint64_t entryLen;
+    bool stream = false;
+    int result = 0;
+
+    // Text strings are copied as they are, so invalid UTF-8 can not be replaced
+    policy = (msg->_utf8Policy == LWJSON_UTF8_TRUSTED) ? LWJSON_UTF8_TRUSTED : LWJSON_UTF8_REJECT;
+
+    // Member name as a text string. Keys are used when they need no escaping
+    if (name != NULL) {
+        nameString = name;
+        nameLen = strlen(name);
+        if (lwJsonScanString(name, nameLen, policy, &escapedLen) != 0) {
+            result = -EINVAL;
+        }
+    } else if (key != NULL) {
+        if (key->len < 3 || memchr(key->token, '\\', key->len) != NULL) {
+            result = -EPERM;
+        }
+        nameString = key->token + 1;
+        nameLen = key->len - 3;
+    }
+    if (nameString != NULL) {
+        nameHeadLen = lwJsonCborHead(nameHead, LWJSON_CBOR_TEXT, nameLen);
+    }
+
+    switch (type) {
+    case LWJSON_VAL_STRING:
+        if (value == NULL || value->valueString == NULL) {
+            result = -EINVAL;
+            break;
+        }
+        payload = value->valueString;
+        payloadLen = strlen(payload);
+        if (lwJsonScanString(payload, payloadLen, policy, &escapedLen) != 0) {
+            result = -EINVAL;
+        }
+        valueHeadLen = lwJsonCborHead(valueHead, LWJSON_CBOR_TEXT, payloadLen);
+        break;
+    case LWJSON_VAL_NUMBER:
+        if (value == NULL) {
+            result = -EINVAL;
+        } else if (value->valueInt >= 0) {
+            valueHeadLen = lwJsonCborHead(valueHead, LWJSON_CBOR_UINT, (uint64_t)value->valueInt);
+        } else {
+            valueHeadLen = lwJsonCborHead(valueHead, LWJSON_CBOR_NEGATIVE, (uint64_t)(-(value->valueInt + 1)));
+        }
+        break;
+    case LWJSON_VAL_DOUBLE:
+        if (value == NULL) {
+            result = -EINVAL;
+            break;
+        }
+        valueHeadLen = lwJsonCborDouble(valueHead, value->valueDouble);
+        break;
+    case LWJSON_VAL_BOOLEAN:
+        if (value == NULL) {
+            result = -EINVAL;
+            break;
+        }
+        valueHead[0] = value->valueBool ? LWJSON_CBOR_TRUE : LWJSON_CBOR_FALSE;
+        valueHeadLen = 1;
+        break;
+    case LWJSON_VAL_OBJECT:
+        valueHead[0] = LWJSON_CBOR_MAP;
+        valueHeadLen = 1;
+        break;
+    case LWJSON_VAL_ARRAY:
+        valueHead[0] = LWJSON_CBOR_ARRAY;
+        valueHeadLen = 1;
+        break;
+    case LWJSON_VAL_NULL:
+        valueHead[0] = LWJSON_CBOR_NULL;
+        valueHeadLen = 1;
+        break;
+    case LWJSON_VAL_RAW:
+        // JSON text can not be embedded
+        result = -EPERM;
+        break;
+    }
+    if (result != 0) {
+        msg->_lastError = result;
+        return result;
+    }
+
+    // A streaming writer sends entries larger than its buffer in pieces
+    entryLen = (uint64_t)nameHeadLen + nameLen + valueHeadLen + payloadLen;
+    if (lwJsonReserve(msg, entryLen) != 0) {
+        if (msg->_lastError < 0) {
+            return msg->_lastError;
+        }
+        stream = true;
+    }
+
+    if (msg->_measure) {
+        msg->_offset += entryLen;
+    } else {
+        lwJsonCborWrite(msg, nameHead, nameHeadLen, stream);
+        lwJsonCborWrite(msg, nameString, nameLen, stream);
+        lwJsonCborWrite(msg, valueHead, valueHeadLen, stream);
+        lwJsonCborWrite(msg, payload, payloadLen, stream);
+        if (msg->_lastError < 0) {
+            return msg->_lastError;
+        }
+    }
+
+    lwJsonUpdateNesting(msg, type);
+
+    return 0;
+}
+
+static uint32_t lwJsonCborHead(uint8_t *dst, uint8_t major, uint64_t arg) {
+    uint32_t len;
+    uint32_t i;
+
+    // Shortest argument encoding, big endian
+    if (arg < 24) {
+        dst[0] = (major << 5) | (uint8_t)arg;
+        return 1;
+    } else if (arg <= UINT8_MAX) {
+        dst[0] = (major << 5) | 24;
+        len = 1;
+    } else if (arg <= UINT16_MAX) {
+        dst[0] = (major << 5) | 25;
+        len = 2;
+    } else if (arg <= UINT32_MAX) {
+        dst[0] = (major << 5) | 26;
+        len = 4;
+    } else {
+        dst[0] = (major << 5) | 27;
+        len = 8;
+    }
+    for (i = 0; i < len; i++) {
+        dst[len - i] = (uint8_t)(arg >> (8 * i));
+    }
 
-    if (lwJsonCheckWriteError(msg) != 0) {
-        return msg->_lastError;
+    return len + 1;
+}
+
+static uint32_t lwJsonCborDouble(uint8_t *dst, double value) {
+    uint64_t bits;
+    uint32_t floatBits;
+    float single;
+    uint32_t i;
+
+    // Single precision when no information is lost
+    if (value >= -FLT_MAX && value <= FLT_MAX && (double)(float)value == value) {
+        single = (float)value;
+        memcpy(&floatBits, &single, sizeof(floatBits));
+        dst[0] = LWJSON_CBOR_FLOAT;
+        for (i = 0; i < 4; i++) {
+            dst[4 - i] = (uint8_t)(floatBits >> (8 * i));
+        }
+        return 5;
     }
-    if (name == NULL) {
-        msg->_lastError = (-EINVAL);
-        return -EINVAL;
+
+    memcpy(&bits, &value, sizeof(bits));
+    dst[0] = LWJSON_CBOR_DOUBLE;
+    for (i = 0; i < 8; i++) {
+        dst[8 - i] = (uint8_t)(bits >> (8 * i));
     }
 
-    // Calculate and check len
-    valueLen = lwJsonCalculateValueStringLength(type, value);
-    if (valueLen < 0) {
-        return -EINVAL;
+    return 9;
+}
+
+static void lwJsonCborWrite(LwJsonMsg *msg, const void *data, uint32_t len, bool stream) {
+    if (len == 0) {
+        return;
+    }
+    if (stream) {
+        lwJsonStreamRaw(msg, (const char*)data, len);
+        return;
     }
 
-    // Calculate space
-    nameLen = strlen(name);
-    entryLen = nameLen + valueLen + 3;
-    if (msg->string[msg->_offset - 1] != '{') {
-        entryLen ++;
-        flagSeparator = 1;
+    memcpy(msg->string + msg->_offset, data, len);
+    msg->_offset += len;
+}
+
+static void lwJsonDoubleValue(const LwJsonMsg *msg, LwJsonValue *jsonValue, char *number, double value, uint32_t decimals) {
+    // Binary output keeps the value, text output the formatted number
+    if (msg != NULL && msg->_format == LWJSON_FORMAT_CBOR) {
+        jsonValue->valueDouble = value;
+        return;
     }
 
-    // Check space
-    if (msg->_offset > (msg->len - entryLen)) {
-        msg->_lastError = (-ENOMEM);
-        return -ENOMEM;
+    if (decimals == LWJSON_SLOT_SHORTEST) {
+        number[lwJsonFormatDouble(number, value, false)] = 0;
+    } else {
+        number[lwJsonFormatFixedDouble(number, value, decimals)] = 0;
     }
+    jsonValue->valueString = number;
+}
 
-    // Add separator if necessary
-    if (flagSeparator != 0) {
-        msg->string[msg->_offset] = ',';
-        msg->_offset++;
+static void lwJsonFloatValue(const LwJsonMsg *msg, LwJsonValue *jsonValue, char *number, float value) {
+    // Every float is exact as double, only the text needs the float precision
+    if (msg != NULL && msg->_format == LWJSON_FORMAT_CBOR) {
+        jsonValue->valueDouble = value;
+        return;
     }
 
-    // Add name
-    msg->string[msg->_offset] = '"';
-    msg->_offset++;
-    strcpy(msg->string + msg->_offset, name);
-    msg->_offset += nameLen;
-    strcpy(msg->string + msg->_offset, "\":");
-    msg->_offset += 2;
+    number[lwJsonFormatDouble(number, value, true)] = 0;
+    jsonValue->valueString = number;
+}
 
-    // Add value
-    switch (type) {
-    case LWJSON_VAL_STRING:
-        msg->string[msg->_offset] = '"';
-        msg->_offset++;
-        strcpy(msg->string + msg->_offset, value->valueString);
-        msg->_offset += valueLen - 2;
-        msg->string[msg->_offset] = '"';
-        msg->_offset++;
-        break;
-    case LWJSON_VAL_NUMBER:
-        sprintf(auxString, "%lld", value->valueInt);
-        strcpy(msg->string + msg->_offset, auxString);
-        msg->_offset += valueLen;
-        break;
-    case LWJSON_VAL_BOOLEAN:
-        if (value->valueBool == true) {
-            strcpy(msg->string + msg->_offset, "true");
-        } else {
-            strcpy(msg->string + msg->_offset, "false");
-        }
-        msg->_offset += valueLen;
-        break;
-    case LWJSON_VAL_OBJECT:
-        msg->string[msg->_offset] = '{';
-        msg->_offset++;
-        break;
-    case LWJSON_VAL_ARRAY:
-        msg->string[msg->_offset] = '[';
-        msg->_offset++;
-        break;
-    case LWJSON_VAL_NULL:
-        strcpy(msg->string + msg->_offset, "null");
-        msg->_offset += valueLen;
-        break;
+static int lwJsonCheckNesting(LwJsonMsg *msg, bool member, LwJsonValueType type) {
+    bool inObject = (msg->_depth > 0) && ((msg->_stack & 1) != 0);
+
+    // Members only inside objects, plain values anywhere else
+    if (member != inObject) {
+        msg->_lastError = (-EPERM);
+        return -EPERM;
+    }
+    if ((type == LWJSON_VAL_OBJECT || type == LWJSON_VAL_ARRAY) && msg->_depth >= LWJSON_WRITE_DEPTH_MAX) {
+        msg->_lastError = (-EPERM);
+        return -EPERM;
     }
 
     return 0;
 }
 
-static int lwJsonAddValueToArray(LwJsonMsg *msg, LwJsonValueType type, LwJsonValue *value) {
-    unsigned int entryLen = 0;
-    unsigned int valueLen = 0;
-    char auxString[50];
-    unsigned char flagSeparator = 0;
+static void lwJsonUpdateNesting(LwJsonMsg *msg, LwJsonValueType type) {
+    msg->_first = false;
 
+    // Push container, 1 for objects and 0 for arrays
+    if (type == LWJSON_VAL_OBJECT || type == LWJSON_VAL_ARRAY) {
+        msg->_stack = (msg->_stack << 1) | ((type == LWJSON_VAL_OBJECT) ? 1 : 0);
+        msg->_depth++;
+        msg->_first = true;
+    }
+}
+
+static int lwJsonCloseContainer(LwJsonMsg *msg, bool object) {
     if (lwJsonCheckWriteError(msg) != 0) {
+        return (msg == NULL) ? -EINVAL : msg->_lastError;
+    }
+
+    // Closing must match the innermost open container
+    if (msg->_depth == 0 || ((msg->_stack & 1) != 0) != object) {
+        msg->_lastError = (-EPERM);
+        return -EPERM;
+    }
+
+    if (msg->_format == LWJSON_FORMAT_CBOR && !msg->_measure) {
+        msg->string[msg->_offset] = (char)LWJSON_CBOR_BREAK;
+    } else if (!msg->_measure) {
+        msg->string[msg->_offset] = object ? '}' : ']';
+    }
+    msg->_offset++;
+    msg->_stack >>= 1;
+    msg->_depth--;
+    msg->_first = false;
+
+    return 0;
+}
+
+static void lwJsonAddReference(LwJsonMsg *msg, const char *string, uint32_t len) {
+    // Close the current run of the buffer, then point to the caller string
+    if (msg->_offset > msg->_segmentStart) {
+        lwJsonAddSegment(msg->_segmentList, msg->string + msg->_segmentStart, msg->_offset - msg->_segmentStart);
+    }
+    lwJsonAddSegment(msg->_segmentList, string, len);
+    msg->_segmentStart = msg->_offset;
+}
+
+static void lwJsonAddSegment(LwJsonSegmentList *list, const char *string, uint32_t len) {
+    list->segments[list->count].string = string;
+    list->segments[list->count].len = len;
+    list->count++;
+}
+
+static int lwJsonFlush(LwJsonMsg *msg) {
+    int result;
+
+    if (msg->_lastError < 0) {
         return msg->_lastError;
     }
+    if (msg->_offset == 0) {
+        return 0;
+    }
 
-    // Calculate and check len
-    valueLen = lwJsonCalculateValueStringLength(type, value);
-    if (valueLen < 0) {
-        msg->_lastError = (-EINVAL);
-        return -EINVAL;
+    LWJSON_TRACE(LWJSON_TRACE_WRITE_FLUSH, msg->_offset);
+    result = msg->_flush(msg->_flushContext, msg->string, msg->_offset);
+    if (result < 0) {
+        msg->_lastError = result;
+        return result;
     }
+    LWJSON_STAT_ADD(bytesWritten, msg->_offset);
 
-    entryLen = valueLen;
-    if (msg->string[msg->_offset - 1] != '[') {
-        entryLen ++;
-        flagSeparator = 1;
+    msg->_offset = 0;
+
+    return 0;
+}
+
+static int lwJsonGrow(LwJsonMsg *msg, uint32_t required) {
+    uint32_t newLen = msg->len;
+    char *string;
+
+    if (msg->_lastError < 0) {
+        return msg->_lastError;
+    }
+
+    // Keep room for the terminator, as in caller provided buffers
+    if (required > (UINT32_MAX - 1) || msg->_offset > (UINT32_MAX - 1 - required)) {
+        msg->_lastError = (-ENOMEM);
+        return -ENOMEM;
+    }
+    if (newLen < LWJSON_GROW_LEN_MIN) {
+        newLen = LWJSON_GROW_LEN_MIN;
+    }
+    while (newLen < (msg->_offset + required)) {
+        newLen = (newLen > (UINT32_MAX - 1) / 2) ? (UINT32_MAX - 1) : (newLen * 2);
     }
-    if (msg->_offset > (msg->len - entryLen)) {
+
+    LWJSON_TRACE(LWJSON_TRACE_WRITE_GROW, newLen);
+    string = msg->_realloc(msg->_reallocContext, msg->string, (msg->string != NULL) ? (msg->len + 1) : 0, newLen + 1);
+    if (string == NULL) {
         msg->_lastError = (-ENOMEM);
         return -ENOMEM;
     }
 
-    // Add separator if necessary
-    if (flagSeparator != 0) {
-        msg->string[msg->_offset] = ',';
-        msg->_offset++;
+    msg->string = string;
+    msg->len = newLen;
+
+    return 0;
+}
+
+static int lwJsonReserve(LwJsonMsg *msg, uint64_t len) {
+    if (len <= msg->len && msg->_offset <= (msg->len - len)) {
+        return 0;
     }
 
-    // Add value
+    if (msg->_flush != NULL) {
+        LWJSON_STAT_ADD(enomemRetries, 1);
+        if (lwJsonFlush(msg) != 0) {
+            return msg->_lastError;
+        }
+        // Not an error, the caller writes in smaller pieces
+        return (len <= msg->len) ? 0 : -ENOMEM;
+    }
+
+    if (msg->_realloc != NULL && len <= UINT32_MAX) {
+        LWJSON_STAT_ADD(enomemRetries, 1);
+        return lwJsonGrow(msg, len);
+    }
+
+    msg->_lastError = (-ENOMEM);
+    return -ENOMEM;
+}
+
+static int lwJsonStartBulkArray(LwJsonMsg *msg, const char *name) {
+    if (name != NULL) {
+        return lwJsonAddArrayToObject(msg, name);
+    }
+
+    return lwJsonAddArrayToArray(msg);
+}
+
+static int lwJsonAddSlot(LwJsonTemplate *tpl, const char *name, bool member, LwJsonValueType type, uint32_t width, uint32_t decimals) {
+    LwJsonValue jsonValue;
+    LwJsonSlot *slot;
+    LwJsonMsg *msg;
+    uint32_t minWidth = 1;
+    int result;
+
+    if (tpl == NULL || tpl->msg == NULL) {
+        return -EINVAL;
+    }
+    if (tpl->slotCount >= tpl->slotMax) {
+        return -ENOMEM;
+    }
+    if (tpl->msg->_flush != NULL) {
+        return -EPERM;
+    }
+
+    // Slot must hold the default value
+    if (type == LWJSON_VAL_STRING) {
+        minWidth = 2;
+    } else if (type == LWJSON_VAL_DOUBLE && decimals != LWJSON_SLOT_SHORTEST && decimals > 0) {
+        minWidth = decimals + 2;
+    }
+    if (width < minWidth) {
+        return -EINVAL;
+    }
+
+    // Member name or separator, then width bytes of padding for the value
+    msg = tpl->msg;
+    jsonValue.valueString = (char*)"";
+    if (member) {
+        result = lwJsonAddNameAndValuePair(msg, name, LWJSON_VAL_RAW, &jsonValue);
+    } else {
+        result = lwJsonAddValueToArray(msg, LWJSON_VAL_RAW, &jsonValue);
+    }
+    if (result != 0) {
+        return result;
+    }
+    if (lwJsonReserve(msg, width) != 0) {
+        return msg->_lastError;
+    }
+    memset(msg->string + msg->_offset, ' ', width);
+
+    slot = &tpl->slots[tpl->slotCount];
+    slot->offset = msg->_offset;
+    slot->width = width;
+    slot->type = type;
+    slot->decimals = decimals;
+    msg->_offset += width;
+    tpl->slotCount++;
+
+    // Template is valid JSON before any value is set
     switch (type) {
-    case LWJSON_VAL_STRING:
-        msg->string[msg->_offset] = '"';
-        msg->_offset++;
-        strcpy(msg->string + msg->_offset, value->valueString);
-        msg->_offset += valueLen - 2;
-        msg->string[msg->_offset] = '"';
-        msg->_offset++;
-        break;
     case LWJSON_VAL_NUMBER:
-        sprintf(auxString, "%lld", value->valueInt);
-        strcpy(msg->string + msg->_offset, auxString);
-        msg->_offset += valueLen;
-        break;
-    case LWJSON_VAL_BOOLEAN:
-        if (value->valueBool == true) {
-            strcpy(msg->string + msg->_offset, "true");
-        } else {
-            strcpy(msg->string + msg->_offset, "false");
-        }
-        msg->_offset += valueLen;
+        lwJsonTemplateSetInt(tpl, tpl->slotCount - 1, 0);
         break;
-    case LWJSON_VAL_OBJECT:
-        msg->string[msg->_offset] = '{';
-        msg->_offset++;
+    case LWJSON_VAL_DOUBLE:
+        lwJsonTemplateSetDouble(tpl, tpl->slotCount - 1, 0);
         break;
-    case LWJSON_VAL_ARRAY:
-        msg->string[msg->_offset] = '[';
-        msg->_offset++;
+    case LWJSON_VAL_STRING:
+        lwJsonTemplateSetString(tpl, tpl->slotCount - 1, "");
         break;
-    case LWJSON_VAL_NULL:
-        strcpy(msg->string + msg->_offset, "null");
-        msg->_offset += valueLen;
+    default:
+        lwJsonTemplateSetBoolean(tpl, tpl->slotCount - 1, false);
         break;
     }
 
-    return 0;
+    return tpl->slotCount - 1;
+}
+
+static LwJsonSlot *lwJsonTemplateSlot(LwJsonTemplate *tpl, uint32_t slot, LwJsonValueType type, uint32_t minWidth) {
+    if (tpl == NULL || tpl->msg == NULL || slot >= tpl->slotCount) {
+        return NULL;
+    }
+    if (tpl->slots[slot].type != type || tpl->slots[slot].width < minWidth) {
+        return NULL;
+    }
+
+    return &tpl->slots[slot];
 }
 
-static int lwJsonIsValidUTF8String(const char *string) {
-    unsigned char *bytes = (unsigned char*)string;
+static void lwJsonSlotWrite(LwJsonTemplate *tpl, const LwJsonSlot *slot, const char *value, uint32_t len) {
+    char *dst = tpl->msg->string + slot->offset;
 
-    if (string == NULL) {
-        return 0;
+    // Left aligned, padded with whitespace
+    memcpy(dst, value, len);
+    memset(dst + len, ' ', slot->width - len);
+}
+
+static int lwJsonStreamRaw(LwJsonMsg *msg, const char *data, uint32_t len) {
+    uint32_t chunk;
+
+    while (len > 0) {
+        if (msg->_offset >= msg->len && lwJsonFlush(msg) != 0) {
+            return msg->_lastError;
+        }
+
+        chunk = msg->len - msg->_offset;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(msg->string + msg->_offset, data, chunk);
+        msg->_offset += chunk;
+        data += chunk;
+        len -= chunk;
     }
 
-    while (*bytes) {
-        if (bytes[0] == 0x09 || bytes[0] == 0x0A || bytes[0] == 0x0D || (0x20 <= bytes[0] && bytes[0] <= 0x7E)) {
-            // Allow ASCII, TAB, LF y CR
-            bytes += 1;
-            continue;
+    return 0;
+}
+
+static int lwJsonStreamEscaped(LwJsonMsg *msg, const char *string, uint32_t len) {
+    const unsigned char *bytes = (const unsigned char*)string;
+    uint32_t chunk;
+    uint32_t backtrack;
+
+    while (len > 0) {
+        // Each input byte takes 6 output bytes at most. Keep room for a whole 4 byte sequence
+        if ((msg->len - msg->_offset) < 24 && lwJsonFlush(msg) != 0) {
+            return msg->_lastError;
         }
 
-        if ((0xC2 <= bytes[0] && bytes[0] <= 0xDF) && (0x80 <= bytes[1] && bytes[1] <= 0xBF)) {
-            // 2 byte chars (see http://tools.ietf.org/html/rfc3629)
-            bytes += 2;
-            continue;
+        chunk = (msg->len - msg->_offset) / 6;
+        if (chunk >= len) {
+            chunk = len;
+        } else {
+            // Do not split a multibyte sequence between chunks
+            for (backtrack = 1; backtrack <= 3; backtrack++) {
+                if (bytes[chunk - backtrack] >= 0xC0) {
+                    if (lwJsonUtf8SequenceLen(&bytes[chunk - backtrack], len - chunk + backtrack) > backtrack) {
+                        chunk -= backtrack;
+                    }
+                    break;
+                }
+            }
         }
 
-        if ( (// exclude overlongs
+        msg->_offset += lwJsonWriteEscaped(msg->string + msg->_offset, (const char*)bytes, chunk, msg->_utf8Policy);
+        bytes += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static uint32_t lwJsonUtf8SequenceLen(const unsigned char *bytes, uint32_t remaining) {
+    // Length of the valid sequence starting at bytes, 0 if invalid (see http://tools.ietf.org/html/rfc3629)
+    if (remaining >= 2 && (0xC2 <= bytes[0] && bytes[0] <= 0xDF) && (0x80 <= bytes[1] && bytes[1] <= 0xBF)) {
+        return 2;
+    }
+
+    if (remaining >= 3 && (
+            (// exclude overlongs
                 bytes[0] == 0xE0 &&
                 (0xA0 <= bytes[1] && bytes[1] <= 0xBF) &&
                 (0x80 <= bytes[2] && bytes[2] <= 0xBF)
@@ -474,13 +2516,12 @@ static int lwJsonIsValidUTF8String(const char *string) {
                 (0x80 <= bytes[1] && bytes[1] <= 0x9F) &&
                 (0x80 <= bytes[2] && bytes[2] <= 0xBF)
             )
-        ) {
-            // 3 byte chars (see http://tools.ietf.org/html/rfc3629)
-            bytes += 3;
-            continue;
-        }
+        )) {
+        return 3;
+    }
 
-        if( (// planes 1-3
+    if (remaining >= 4 && (
+            (// planes 1-3
                 bytes[0] == 0xF0 &&
                 (0x90 <= bytes[1] && bytes[1] <= 0xBF) &&
                 (0x80 <= bytes[2] && bytes[2] <= 0xBF) &&
@@ -498,14 +2539,116 @@ static int lwJsonIsValidUTF8String(const char *string) {
                 (0x80 <= bytes[2] && bytes[2] <= 0xBF) &&
                 (0x80 <= bytes[3] && bytes[3] <= 0xBF)
             )
-        ) {
-            // 4 bytes chars (see http://tools.ietf.org/html/rfc3629)
-            bytes += 4;
-            continue;
-        }
+        )) {
+        return 4;
+    }
+
+    return 0;
+}
+
+static void lwJsonWriteReset(LwJsonMsg *msg) {
+    msg->_offset = 0;
+    msg->_lastError = 0;
+    msg->_utf8Policy = LWJSON_UTF8_REJECT;
+    msg->_flush = NULL;
+    msg->_flushContext = NULL;
+    msg->_stack = 0;
+    msg->_depth = 0;
+    msg->_first = true;
+    msg->_realloc = NULL;
+    msg->_reallocContext = NULL;
+    msg->_segmentList = NULL;
+    msg->_segmentStart = 0;
+    msg->_refMinLen = 0;
+    msg->_measure = false;
+    msg->_format = LWJSON_FORMAT_JSON;
+}
+
+static int lwJsonSplitOpen(LwJsonSplitter *split) {
+    LwJsonMsg *msg = split->msg;
+    uint32_t closeLen = 2;
+
+    // Room for "]", suffix and "}" is kept out of the buffer while elements are added
+    if (split->suffix != NULL && split->suffix[0] != 0) {
+        closeLen += strlen(split->suffix) + 1;
+    }
+    if (closeLen >= split->maxLen) {
+        return -ENOMEM;
+    }
+    msg->len = split->maxLen - closeLen;
+    split->count = 0;
+
+    lwJsonStartObject(msg);
+    if (split->prefix != NULL) {
+        lwJsonAddMembers(msg, split->prefix);
+    }
+    lwJsonAddArrayToObject(msg, split->name);
+
+    return msg->_lastError;
+}
+
+static int lwJsonSplitEmit(LwJsonSplitter *split, bool reopen) {
+    LwJsonMsg *msg = split->msg;
+    LwJsonUtf8Policy policy = msg->_utf8Policy;
+    int result;
+
+    msg->len = split->maxLen;
+    lwJsonCloseArray(msg);
+    if (split->suffix != NULL) {
+        lwJsonAddMembers(msg, split->suffix);
+    }
+    result = lwJsonWriteEnd(msg);
+    if (result != 0) {
+        return result;
+    }
+
+    result = split->sink(split->context, msg->string, msg->_offset);
+    if (result < 0) {
+        msg->_lastError = result;
+        return result;
+    }
+    split->count = 0;
+    if (!reopen) {
+        return 0;
+    }
+
+    lwJsonWriteStart(msg);
+    msg->_utf8Policy = policy;
 
+    return lwJsonSplitOpen(split);
+}
+
+static int lwJsonSplitElement(LwJsonMsg *msg, LwJsonElementCallback element, void *context) {
+    int result = element(msg, context);
+
+    if (result == 0) {
+        result = msg->_lastError;
+    }
+    // Element left a container open or closed the envelope
+    if (result == 0 && msg->_depth != 2) {
+        result = -EPERM;
+    }
+
+    return result;
+}
+
+static int lwJsonAddMembers(LwJsonMsg *msg, const char *members) {
+    uint32_t len = strlen(members);
+
+    if (len == 0) {
         return 0;
     }
+    if (lwJsonReserve(msg, (uint64_t)len + 1) != 0) {
+        return msg->_lastError;
+    }
+
+    if (!msg->_first) {
+        msg->string[msg->_offset] = ',';
+        msg->_offset++;
+    }
+    memcpy(msg->string + msg->_offset, members, len);
+    msg->_offset += len;
+    msg->_first = false;
 
-    return 1;
+    return 0;
 }
@@ -0,0 +1,689 @@
+#include "lwjson.h"
+#include "lwjson_internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Structural index layout. Everything is stored in native byte order:
+ *
+ *   LwJsonIndexHeader
+ *   LwJsonIndexEntry[entryCount]   (document order, entry 0 is the root value)
+ *
+ * The first child of a container entry i is entry i + 1 (when children > 0) and
+ * the rest of the children are reached following the next links. The index
+ * can be stored next to the document and mapped again by another process,
+ * lwJsonIndexCheck must be called before using a loaded index.
+ */
+
+#define LWJSON_INDEX_MAGIC      (0x494A574Cu)       // "LWJI"
+#define LWJSON_INDEX_VERSION    (1)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t indexSize;                             // Bytes used by header and entries
+    uint32_t docLen;                                // Length of indexed document
+    uint32_t docChecksum;                           // Checksum of indexed document
+    uint32_t entryCount;
+    uint32_t checksum;                              // Checksum of the index (computed with this field set to 0)
+} LwJsonIndexHeader;
+
+typedef struct {
+    uint32_t nameOffset;                            // Offset of property name (without quotes)
+    uint32_t valueOffset;                           // Offset of first value char
+    uint32_t valueLen;                              // Value length (quotes and brackets included)
+    uint32_t next;                                  // Next sibling entry. 0 if last
+    uint32_t children;                              // Number of children in objects and arrays
+    uint16_t nameLen;                               // Property name length. 0 in array items and root
+    uint8_t type;                                   // LwJsonValueType
+    uint8_t reserved;
+} LwJsonIndexEntry;
+
+typedef struct {
+    const LwJsonMsg *msg;
+    LwJsonIndexEntry *entries;                      // NULL when only calculating size
+    uint32_t maxEntries;
+    uint32_t count;
+    uint32_t stack[LWJSON_DEPTH_MAX + 1];           // Open containers
+    LwJsonValueType types[LWJSON_DEPTH_MAX + 1];    // Type of open containers
+    uint32_t lastChild[LWJSON_DEPTH_MAX + 1];       // Last child added to each open container
+    uint32_t depth;
+    uint32_t p;                                     // Current offset
+    uint32_t end;
+} LwJsonIndexBuilder;
+
+
+static int lwJsonIndexFindValue(const void *index, const char **path, const LwJsonMsg *msg, LwJsonValueType expectedType, const LwJsonIndexEntry **value);
+static int lwJsonIndexFindChild(const LwJsonIndexEntry *entries, uint32_t entryCount, const LwJsonMsg *msg, uint32_t parent, const char *name, uint32_t after, uint32_t *child);
+static int BuildDocument(LwJsonIndexBuilder *builder);
+static int BuildValue(LwJsonIndexBuilder *builder, uint32_t nameOffset, uint32_t nameLen);
+static int BuildAddEntry(LwJsonIndexBuilder *builder, uint32_t nameOffset, uint32_t nameLen, LwJsonValueType type);
+static int BuildSkipString(LwJsonIndexBuilder *builder);
+static void BuildSkipWhitespace(LwJsonIndexBuilder *builder);
+static uint32_t lwJsonIndexChecksum(uint32_t checksum, const void *data, uint32_t len);
+static bool lwJsonIndexSpanValid(uint32_t offset, uint32_t len, uint32_t docLen);
+
+
+int lwJsonIndexBuild(const LwJsonMsg *msg, void *index, uint32_t indexLen) {
+    LwJsonIndexBuilder builder;
+    LwJsonIndexHeader header;
+    uint32_t indexSize;
+    const char *docEnd;
+    int result;
+
+    if (msg == NULL || msg->string == NULL) {
+        return -EINVAL;
+    }
+    if (index != NULL && (((uintptr_t)index) % sizeof(uint32_t)) != 0) {
+        return -EINVAL;
+    }
+
+    // Init builder. A NULL index only calculates required size
+    builder.msg = msg;
+    builder.entries = NULL;
+    builder.maxEntries = 0;
+    if (index != NULL) {
+        if (indexLen < sizeof(LwJsonIndexHeader)) {
+            return -ENOMEM;
+        }
+        builder.entries = (LwJsonIndexEntry*)((char*)index + sizeof(LwJsonIndexHeader));
+        builder.maxEntries = (indexLen - sizeof(LwJsonIndexHeader)) / sizeof(LwJsonIndexEntry);
+    }
+    builder.count = 0;
+    builder.depth = 0;
+    builder.p = 0;
+    builder.end = msg->len;
+    docEnd = memchr(msg->string, 0, msg->len);
+    if (docEnd != NULL) {
+        builder.end = docEnd - msg->string;
+    }
+
+    result = BuildDocument(&builder);
+    if (result != 0) {
+        return result;
+    }
+
+    indexSize = sizeof(LwJsonIndexHeader) + builder.count * sizeof(LwJsonIndexEntry);
+    if (index == NULL) {
+        return indexSize;
+    }
+
+    // Fill header
+    header.magic = LWJSON_INDEX_MAGIC;
+    header.version = LWJSON_INDEX_VERSION;
+    header.headerSize = sizeof(LwJsonIndexHeader);
+    header.indexSize = indexSize;
+    header.docLen = builder.end;
+    header.docChecksum = lwJsonIndexChecksum(0, msg->string, builder.end);
+    header.entryCount = builder.count;
+    header.checksum = 0;
+    header.checksum = lwJsonIndexChecksum(lwJsonIndexChecksum(0, &header, sizeof(header)), builder.entries, builder.count * sizeof(LwJsonIndexEntry));
+    memcpy(index, &header, sizeof(header));
+
+    return indexSize;
+}
+
+int lwJsonIndexCheck(const void *index, uint32_t indexLen, const LwJsonMsg *msg, bool checkDocument) {
+    LwJsonIndexHeader header;
+    const LwJsonIndexEntry *entries;
+    uint32_t checksum;
+    uint32_t i;
+
+    if (index == NULL || msg == NULL || msg->string == NULL) {
+        return -EINVAL;
+    }
+    if ((((uintptr_t)index) % sizeof(uint32_t)) != 0) {
+        return -EINVAL;
+    }
+    if (indexLen < sizeof(LwJsonIndexHeader)) {
+        return -EPERM;
+    }
+
+    // Check header
+    memcpy(&header, index, sizeof(header));
+    if (header.magic != LWJSON_INDEX_MAGIC || header.version != LWJSON_INDEX_VERSION || header.headerSize != sizeof(LwJsonIndexHeader)) {
+        return -EPERM;
+    }
+    if (header.entryCount == 0 || header.entryCount > ((indexLen - sizeof(LwJsonIndexHeader)) / sizeof(LwJsonIndexEntry))) {
+        return -EPERM;
+    }
+    if (header.indexSize != sizeof(LwJsonIndexHeader) + header.entryCount * sizeof(LwJsonIndexEntry) || header.indexSize > indexLen) {
+        return -EPERM;
+    }
+
+    // Check index integrity
+    checksum = header.checksum;
+    header.checksum = 0;
+    header.checksum = lwJsonIndexChecksum(lwJsonIndexChecksum(0, &header, sizeof(header)), (const char*)index + sizeof(header), header.entryCount * sizeof(LwJsonIndexEntry));
+    if (header.checksum != checksum) {
+        return -EPERM;
+    }
+
+    // Check index belongs to document
+    if (header.docLen > msg->len) {
+        return -EPERM;
+    }
+    if (checkDocument && header.docChecksum != lwJsonIndexChecksum(0, msg->string, header.docLen)) {
+        return -EPERM;
+    }
+
+    // Check entries. The checksum only catches accidental corruption
+    entries = (const LwJsonIndexEntry*)((const char*)index + sizeof(LwJsonIndexHeader));
+    for (i = 0; i < header.entryCount; i++) {
+        if (!lwJsonIndexSpanValid(entries[i].nameOffset, entries[i].nameLen, header.docLen) ||
+            !lwJsonIndexSpanValid(entries[i].valueOffset, entries[i].valueLen, header.docLen)) {
+            return -EPERM;
+        }
+        // Links only go forward, so lookups always end
+        if (entries[i].next != 0 && (entries[i].next <= i || entries[i].next >= header.entryCount)) {
+            return -EPERM;
+        }
+        if (entries[i].children > 0 && (i + 1) >= header.entryCount) {
+            return -EPERM;
+        }
+    }
+
+    return 0;
+}
+
+int lwJsonIndexGetObject(const void *index, const char **path, const LwJsonMsg *msg, LwJsonMsg *object) {
+    int result;
+    const LwJsonIndexEntry *entry;
+
+    if (object == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonIndexFindValue(index, path, msg, LWJSON_VAL_OBJECT, &entry);
+    if (result != 0) {
+        return result;
+    }
+
+    object->string = &msg->string[entry->valueOffset];
+    object->len = entry->valueLen;
+
+    return 0;
+}
+
+int lwJsonIndexGetArray(const void *index, const char **path, const LwJsonMsg *msg, LwJsonMsg *array) {
+    int result;
+    const LwJsonIndexEntry *entry;
+
+    if (array == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonIndexFindValue(index, path, msg, LWJSON_VAL_ARRAY, &entry);
+    if (result != 0) {
+        return result;
+    }
+
+    array->string = &msg->string[entry->valueOffset];
+    array->len = entry->valueLen;
+
+    return 0;
+}
+
+int lwJsonIndexGetArrayLen(const void *index, const char **path, const LwJsonMsg *msg) {
+    int result;
+    const LwJsonIndexEntry *entry;
+
+    result = lwJsonIndexFindValue(index, path, msg, LWJSON_VAL_ARRAY, &entry);
+    if (result != 0) {
+        return result;
+    }
+
+    return entry->children;
+}
+
+int lwJsonIndexGetString(const void *index, const char **path, const LwJsonMsg *msg, char *value, unsigned int valueLen) {
+    int result;
+    uint32_t stringLen;
+    const LwJsonIndexEntry *entry;
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonIndexFindValue(index, path, msg, LWJSON_VAL_STRING, &entry);
+    if (result != 0) {
+        return result;
+    }
+
+    // Check size
+    stringLen = entry->valueLen - 2;
+    if (stringLen > valueLen) {
+        return -ENOMEM;
+    }
+
+    // Get String
+    memcpy(value, &msg->string[entry->valueOffset + 1], stringLen);
+    value[stringLen] = 0;
+
+    return 0;
+}
+
+int lwJsonIndexGetInt(const void *index, const char **path, const LwJsonMsg *msg, int *value) {
+    int result;
+    const LwJsonIndexEntry *entry;
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonIndexFindValue(index, path, msg, LWJSON_VAL_NUMBER, &entry);
+    if (result != 0) {
+        return result;
+    }
+
+    // Get integer
+    (*value) = atoi(&msg->string[entry->valueOffset]);
+
+    return 0;
+}
+
+int lwJsonIndexGetBool(const void *index, const char **path, const LwJsonMsg *msg, bool *value) {
+    int result;
+    const LwJsonIndexEntry *entry;
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonIndexFindValue(index, path, msg, LWJSON_VAL_BOOLEAN, &entry);
+    if (result != 0) {
+        return result;
+    }
+
+    // Get Value. Only "true" and "false" are indexed as booleans
+    (*value) = (entry->valueLen == strlen("true"));
+
+    return 0;
+}
+
+int lwJsonParseArrayIndex(const char *name, uint32_t *arrayIndex) {
+    uint32_t value = 0;
+
+    // Array items are selected with "[n]", written as lwJsonFind writes them: no leading zeros
+    if (name[0] != '[' || name[1] == ']' || (name[1] == '0' && name[2] != ']')) {
+        return -EPERM;
+    }
+    for (name++; (*name) >= '0' && (*name) <= '9'; name++) {
+        if (value > (UINT32_MAX - ((*name) - '0')) / 10) {
+            return -EPERM;
+        }
+        value = value * 10 + ((*name) - '0');
+    }
+    if (name[0] != ']' || name[1] != 0) {
+        return -EPERM;
+    }
+
+    (*arrayIndex) = value;
+
+    return 0;
+}
+
+
+static int lwJsonIndexFindValue(const void *index, const char **path, const LwJsonMsg *msg, LwJsonValueType expectedType, const LwJsonIndexEntry **value) {
+    const LwJsonIndexHeader *header;
+    const LwJsonIndexEntry *entries;
+    uint32_t chosen[LWJSON_DEPTH_MAX];
+    uint32_t current = 0;
+    uint32_t child;
+    uint32_t depth = 0;
+    int result;
+
+    if (index == NULL || path == NULL || msg == NULL || msg->string == NULL) {
+        return -EINVAL;
+    }
+
+    header = (const LwJsonIndexHeader*)index;
+    entries = (const LwJsonIndexEntry*)((const char*)index + sizeof(LwJsonIndexHeader));
+    if (header->entryCount == 0) {
+        return -EPERM;
+    }
+
+    // Descend one path level at a time. Like lwJsonFind, a level that can't be completed
+    // goes back and tries the next member with the same name
+    child = 0;
+    while (path[depth] != NULL) {
+        if (depth >= LWJSON_DEPTH_MAX) {
+            return -EPERM;
+        }
+
+        result = lwJsonIndexFindChild(entries, header->entryCount, msg, current, path[depth], child, &child);
+        if (result == -ENOENT) {
+            if (depth == 0) {
+                return -ENOENT;
+            }
+            depth--;
+            current = (depth > 0) ? chosen[depth - 1] : 0;
+            child = chosen[depth];
+            continue;
+        }
+        if (result != 0) {
+            return result;
+        }
+
+        chosen[depth] = child;
+        current = child;
+        child = 0;
+        depth++;
+    }
+
+    if (entries[current].type != expectedType) {
+        return -EPERM;
+    }
+    if (!lwJsonIndexSpanValid(entries[current].valueOffset, entries[current].valueLen, msg->len)) {
+        return -EPERM;
+    }
+
+    (*value) = &entries[current];
+
+    return 0;
+}
+
+static int lwJsonIndexFindChild(const LwJsonIndexEntry *entries, uint32_t entryCount, const LwJsonMsg *msg, uint32_t parent, const char *name, uint32_t after, uint32_t *child) {
+    uint32_t candidate = parent + 1;
+    uint32_t next;
+    uint32_t arrayIndex;
+    uint32_t nameLen;
+
+    // Array items are unique, only object members can be tried again
+    if (entries[parent].children == 0 || (after != 0 && entries[parent].type != LWJSON_VAL_OBJECT)) {
+        return -ENOENT;
+    }
+    if (candidate >= entryCount) {
+        return -EPERM;
+    }
+
+    // Every entry is bounds checked before use
+    if (entries[parent].type == LWJSON_VAL_OBJECT) {
+        nameLen = strlen(name);
+        if (after != 0) {
+            candidate = entries[after].next;
+            if (candidate == 0) {
+                return -ENOENT;
+            }
+            if (candidate <= after || candidate >= entryCount) {
+                return -EPERM;
+            }
+        }
+        while (true) {
+            if (!lwJsonIndexSpanValid(entries[candidate].nameOffset, entries[candidate].nameLen, msg->len)) {
+                return -EPERM;
+            }
+            if (entries[candidate].nameLen == nameLen && memcmp(&msg->string[entries[candidate].nameOffset], name, nameLen) == 0) {
+                break;
+            }
+            next = entries[candidate].next;
+            if (next == 0) {
+                return -ENOENT;
+            }
+            if (next <= candidate || next >= entryCount) {
+                return -EPERM;
+            }
+            candidate = next;
+        }
+    } else if (entries[parent].type == LWJSON_VAL_ARRAY) {
+        if (lwJsonParseArrayIndex(name, &arrayIndex) != 0 || arrayIndex >= entries[parent].children) {
+            return -ENOENT;
+        }
+        while (arrayIndex > 0) {
+            next = entries[candidate].next;
+            if (next <= candidate || next >= entryCount) {
+                return -EPERM;
+            }
+            candidate = next;
+            arrayIndex--;
+        }
+    } else {
+        return -ENOENT;
+    }
+
+    (*child) = candidate;
+
+    return 0;
+}
+
+static int BuildDocument(LwJsonIndexBuilder *builder) {
+    const char *s = builder->msg->string;
+    uint32_t nameOffset;
+    uint32_t nameLen;
+    uint32_t parent;
+    int result;
+    char c;
+
+    // Root value
+    BuildSkipWhitespace(builder);
+    result = BuildValue(builder, 0, 0);
+    if (result != 0) {
+        return result;
+    }
+
+    // Containers are indexed iteratively keeping a stack of open entries
+    while (builder->depth > 0) {
+        parent = builder->stack[builder->depth - 1];
+        BuildSkipWhitespace(builder);
+        if (builder->p >= builder->end) {
+            return -EPERM;
+        }
+        c = s[builder->p];
+
+        // Container end
+        if (c == '}' || c == ']') {
+            if ((c == '}') != (builder->types[builder->depth - 1] == LWJSON_VAL_OBJECT)) {
+                return -EPERM;
+            }
+            if (builder->entries != NULL) {
+                builder->entries[parent].valueLen = builder->p + 1 - builder->entries[parent].valueOffset;
+            }
+            builder->p++;
+            builder->depth--;
+            continue;
+        }
+
+        // Separator between items
+        if (builder->lastChild[builder->depth - 1] != 0) {
+            if (c != ',') {
+                return -EPERM;
+            }
+            builder->p++;
+            BuildSkipWhitespace(builder);
+        }
+
+        // Property name
+        nameOffset = 0;
+        nameLen = 0;
+        if (builder->types[builder->depth - 1] == LWJSON_VAL_OBJECT) {
+            if (builder->p >= builder->end || s[builder->p] != '"') {
+                return -EPERM;
+            }
+            nameOffset = builder->p + 1;
+            result = BuildSkipString(builder);
+            if (result != 0) {
+                return result;
+            }
+            nameLen = builder->p - nameOffset - 1;
+            BuildSkipWhitespace(builder);
+            if (builder->p >= builder->end || s[builder->p] != ':') {
+                return -EPERM;
+            }
+            builder->p++;
+            BuildSkipWhitespace(builder);
+        }
+
+        // Item value
+        result = BuildValue(builder, nameOffset, nameLen);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    // Trailing chars are not allowed
+    BuildSkipWhitespace(builder);
+    if (builder->p != builder->end) {
+        return -EPERM;
+    }
+
+    return 0;
+}
+
+static int BuildValue(LwJsonIndexBuilder *builder, uint32_t nameOffset, uint32_t nameLen) {
+    const char *s = builder->msg->string;
+    uint32_t entry = builder->count;
+    uint32_t left;
+    int result;
+    char c;
+
+    if (builder->p >= builder->end) {
+        return -EPERM;
+    }
+    c = s[builder->p];
+    left = builder->end - builder->p;
+
+    if (c == '{' || c == '[') {
+        // Container. Its length is updated when closed
+        result = BuildAddEntry(builder, nameOffset, nameLen, (c == '{') ? LWJSON_VAL_OBJECT : LWJSON_VAL_ARRAY);
+        builder->p++;
+        return result;
+    } else if (c == '"') {
+        result = BuildAddEntry(builder, nameOffset, nameLen, LWJSON_VAL_STRING);
+        if (result == 0) {
+            result = BuildSkipString(builder);
+        }
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        result = BuildAddEntry(builder, nameOffset, nameLen, LWJSON_VAL_NUMBER);
+        builder->p++;
+        while (builder->p < builder->end) {
+            c = s[builder->p];
+            if ((c < '0' || c > '9') && c != '.' && c != 'e' && c != 'E' && c != '+' && c != '-') {
+                break;
+            }
+            builder->p++;
+        }
+    } else if (left >= strlen("true") && strncmp(&s[builder->p], "true", strlen("true")) == 0) {
+        result = BuildAddEntry(builder, nameOffset, nameLen, LWJSON_VAL_BOOLEAN);
+        builder->p += strlen("true");
+    } else if (left >= strlen("false") && strncmp(&s[builder->p], "false", strlen("false")) == 0) {
+        result = BuildAddEntry(builder, nameOffset, nameLen, LWJSON_VAL_BOOLEAN);
+        builder->p += strlen("false");
+    } else if (left >= strlen("null") && strncmp(&s[builder->p], "null", strlen("null")) == 0) {
+        result = BuildAddEntry(builder, nameOffset, nameLen, LWJSON_VAL_NULL);
+        builder->p += strlen("null");
+    } else {
+        return -EPERM;
+    }
+    if (result != 0) {
+        return result;
+    }
+
+    if (builder->entries != NULL) {
+        builder->entries[entry].valueLen = builder->p - builder->entries[entry].valueOffset;
+    }
+
+    return 0;
+}
+
+static int BuildAddEntry(LwJsonIndexBuilder *builder, uint32_t nameOffset, uint32_t nameLen, LwJsonValueType type) {
+    LwJsonIndexEntry *entry;
+    uint32_t parent;
+    uint32_t entryIndex = builder->count;
+
+    if (nameLen > UINT16_MAX) {
+        return -EPERM;
+    }
+
+    // Link entry with its parent and previous sibling
+    if (builder->depth > 0) {
+        parent = builder->stack[builder->depth - 1];
+        if (builder->entries != NULL) {
+            builder->entries[parent].children++;
+            if (builder->lastChild[builder->depth - 1] != 0) {
+                builder->entries[builder->lastChild[builder->depth - 1]].next = entryIndex;
+            }
+        }
+        builder->lastChild[builder->depth - 1] = entryIndex;
+    }
+
+    if (builder->entries != NULL) {
+        if (entryIndex >= builder->maxEntries) {
+            return -ENOMEM;
+        }
+        entry = &builder->entries[entryIndex];
+        entry->nameOffset = nameOffset;
+        entry->valueOffset = builder->p;
+        entry->valueLen = 0;
+        entry->next = 0;
+        entry->children = 0;
+        entry->nameLen = nameLen;
+        entry->type = type;
+        entry->reserved = 0;
+    }
+    builder->count++;
+
+    // Open container
+    if (type == LWJSON_VAL_OBJECT || type == LWJSON_VAL_ARRAY) {
+        if (builder->depth >= LWJSON_DEPTH_MAX) {
+            return -EPERM;
+        }
+        builder->stack[builder->depth] = entryIndex;
+        builder->types[builder->depth] = type;
+        builder->lastChild[builder->depth] = 0;
+        builder->depth++;
+    }
+
+    return 0;
+}
+
+static int BuildSkipString(LwJsonIndexBuilder *builder) {
+    const char *s = builder->msg->string;
+
+    // Skip opening quote
+    builder->p++;
+    while (builder->p < builder->end) {
+        if (s[builder->p] == '"') {
+            builder->p++;
+            return 0;
+        } else if (s[builder->p] == '\\') {
+            builder->p++;
+        } else if ((unsigned char)s[builder->p] < 32) {
+            return -EPERM;
+        }
+        builder->p++;
+    }
+
+    return -EPERM;
+}
+
+static void BuildSkipWhitespace(LwJsonIndexBuilder *builder) {
+    const char *s = builder->msg->string;
+
+    while (builder->p < builder->end && (s[builder->p] == ' ' || s[builder->p] == '\t' || s[builder->p] == '\r' || s[builder->p] == '\n')) {
+        builder->p++;
+    }
+}
+
+static uint32_t lwJsonIndexChecksum(uint32_t checksum, const void *data, uint32_t len) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    uint32_t i;
+
+    // FNV-1a
+    if (checksum == 0) {
+        checksum = 2166136261u;
+    }
+    for (i = 0; i < len; i++) {
+        checksum ^= bytes[i];
+        checksum *= 16777619u;
+    }
+
+    return checksum;
+}
+
+static bool lwJsonIndexSpanValid(uint32_t offset, uint32_t len, uint32_t docLen) {
+    return (offset <= docLen) && (len <= (docLen - offset));
+}
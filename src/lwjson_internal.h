@@ -0,0 +1,19 @@
+#ifndef LWJSON_INTERNAL_H
+#define LWJSON_INTERNAL_H
+
+#include <stddef.h>
+#include "lwjson.h"
+
+// Helpers shared by the library sources, not part of the API
+
+// Machine word used to scan several bytes per iteration (SWAR)
+typedef size_t LwJsonWord;
+
+#define LWJSON_WORD_SIZE        (sizeof(LwJsonWord))
+#define LWJSON_WORD_ONES        ((LwJsonWord)-1 / 0xFF)
+#define LWJSON_WORD_HIGHS       (LWJSON_WORD_ONES * 0x80)
+
+// Parses a "[n]" path element. Returns 0 or -EPERM when name is not an array index
+int lwJsonParseArrayIndex(const char *name, uint32_t *arrayIndex);
+
+#endif
@@ -1,4 +1,5 @@
 #include "lwjson.h"
+#include "lwjson_stats.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -69,14 +70,22 @@ static void lwJsonParserPop(LwJsonParser *parser, LwJsonParentType expectedParen
 static int GetArrayLen(const LwJsonMsg *jsonArray);
 static int GetIntArray(const LwJsonMsg *jsonArray, int *intArray, uint32_t intArrayLen);
 static int GetStringArray(const LwJsonMsg *jsonArray, char **stringArray, uint32_t *stringLenArray, uint32_t arrayLen);
+static bool lwJsonIsCbor(const LwJsonMsg *msg);
 
 
 int lwJsonGetObject(const char **path, const LwJsonMsg *msg, LwJsonMsg *object) {
+    if (lwJsonIsCbor(msg)) {
+        return lwJsonCborGetObject(path, msg, object);
+    }
 
     return lwJsonFindValue(path, msg, LWJSON_VAL_OBJECT, object);
 }
 
 int lwJsonGetArray(const char **path, const LwJsonMsg *msg, LwJsonMsg *array) {
+    if (lwJsonIsCbor(msg)) {
+        return lwJsonCborGetArray(path, msg, array);
+    }
+
     return lwJsonFindValue(path, msg, LWJSON_VAL_ARRAY, array);
 }
 
@@ -84,6 +93,10 @@ int lwJsonGetArrayLen(const char **path, const LwJsonMsg *msg) {
     int result;
     LwJsonMsg jsonArray;
 
+    if (lwJsonIsCbor(msg)) {
+        return lwJsonCborGetArrayLen(path, msg);
+    }
+
     result = lwJsonFindValue(path, msg, LWJSON_VAL_ARRAY, &jsonArray);
     if (result != 0) {
         return result;
@@ -96,6 +109,10 @@ int lwJsonGetIntArray(const char **path, const LwJsonMsg *msg, int *intArray, ui
     int result;
     LwJsonMsg jsonArray;
 
+    if (lwJsonIsCbor(msg)) {
+        return lwJsonCborGetIntArray(path, msg, intArray, intArrayLen);
+    }
+
     result = lwJsonFindValue(path, msg, LWJSON_VAL_ARRAY, &jsonArray);
     if (result != 0) {
         return result;
@@ -108,6 +125,10 @@ int lwJsonGetStringArray(const char **path, const LwJsonMsg *msg, char **stringA
     int result;
     LwJsonMsg jsonArray;
 
+    if (lwJsonIsCbor(msg)) {
+        return lwJsonCborGetStringArray(path, msg, stringArray, stringLenArray, arrayLen);
+    }
+
     result = lwJsonFindValue(path, msg, LWJSON_VAL_ARRAY, &jsonArray);
     if (result != 0) {
         return result;
@@ -121,6 +142,10 @@ int lwJsonGetString(const char **path, const LwJsonMsg *msg, char *value, uint32
     uint32_t stringLen;
     LwJsonMsg jsonString;
 
+    if (lwJsonIsCbor(msg)) {
+        return lwJsonCborGetString(path, msg, value, valueLen);
+    }
+
     result = lwJsonFindValue(path, msg, LWJSON_VAL_STRING, &jsonString);
     if (result != 0) {
         return result;
@@ -135,6 +160,7 @@ int lwJsonGetString(const char **path, const LwJsonMsg *msg, char *value, uint32
     // Get String
     strncpy(value, jsonString.string + 1, stringLen);
     value[stringLen] = 0;
+    LWJSON_STAT_ADD(stringsCopied, 1);
 
     return 0;
 }
@@ -143,6 +169,10 @@ int lwJsonGetInt(const char **path, const LwJsonMsg *msg, int *value) {
     int result;
     LwJsonMsg jsonNumber;
 
+    if (lwJsonIsCbor(msg)) {
+        return lwJsonCborGetInt(path, msg, value);
+    }
+
     result = lwJsonFindValue(path, msg, LWJSON_VAL_NUMBER, &jsonNumber);
     if (result != 0) {
         return result;
@@ -158,6 +188,10 @@ int lwJsonGetBool(const char **path, const LwJsonMsg *msg, bool *value) {
     int result;
     LwJsonMsg jsonBoolean;
 
+    if (lwJsonIsCbor(msg)) {
+        return lwJsonCborGetBool(path, msg, value);
+    }
+
     result = lwJsonFindValue(path, msg, LWJSON_VAL_BOOLEAN, &jsonBoolean);
     if (result != 0) {
         return result;
@@ -200,6 +234,7 @@ static int lwJsonFindValue(const char **path, const LwJsonMsg *msg, LwJsonValueT
 
 static int lwJsonFind(const char **path, const LwJsonMsg *msg, LwJsonFindResult *findResult) {
     LwJsonParser parser;
+    int result = 0;
 
     if (path == NULL || msg == NULL || findResult == NULL) {
         return -EINVAL;
@@ -216,14 +251,19 @@ static int lwJsonFind(const char **path, const LwJsonMsg *msg, LwJsonFindResult
     parser.findDepth = 0;
     parser.state = LWJSON_SM_START;
     parser.findResult = findResult;
+    parser.found = false;
+    parser.searchValuePending = false;
+    parser.currentArrayIndex = 0;
+    LWJSON_TRACE(LWJSON_TRACE_FIND_START, parser.searchDepth);
 
-    for (parser.p = msg->string; (parser.p[0] != 0) && ((parser.p - msg->string) < msg->len); parser.p++) {
+    for (parser.p = msg->string; (result == 0) && (parser.p[0] != 0) && ((parser.p - msg->string) < msg->len); parser.p++) {
         // Filter chars
         PrefilterChar(parser.p);
         if (SkippableChar(parser.p[0])) {
             continue;
         }
 
+        LWJSON_STAT_ADD(stateTransitions, 1);
         switch (parser.state) {
         case LWJSON_SM_START:
             FindSmStartHandler(&parser);
@@ -257,9 +297,17 @@ static int lwJsonFind(const char **path, const LwJsonMsg *msg, LwJsonFindResult
             FindSmLevelEndHandler(&parser);
             break;
         default:
-            return -EPERM;
+            // Counters still run, the loop stops here
+            result = -EPERM;
+            break;
         }
     }
+    LWJSON_STAT_ADD(bytesScanned, parser.p - msg->string);
+    LWJSON_TRACE(LWJSON_TRACE_FIND_END, parser.p - msg->string);
+
+    if (result != 0) {
+        return result;
+    }
 
     if (parser.state != LWJSON_SM_END) {
         return -EPERM;
@@ -492,6 +540,10 @@ static void FindSmValueEndHandler(LwJsonParser *parser) {
 static void FindSmLevelEndHandler(LwJsonParser *parser) {
     if ((parser->findDepth < parser->searchDepth) && (parser->depth == parser->findDepth)) {
         // Start search again
+        if (parser->findDepth > 0) {
+            LWJSON_STAT_ADD(rescans, 1);
+            LWJSON_TRACE(LWJSON_TRACE_FIND_RESCAN, parser->p - parser->msg->string);
+        }
         parser->findDepth = 0;
     }
     if(parser->found) {
@@ -521,6 +573,8 @@ static void lwJsonParserPush(LwJsonParser *parser, LwJsonParentType parent) {
     // Actualizar parser path
     parser->stack[parser->depth] = parent;
     parser->depth++;
+    LWJSON_STAT_ADD(stackPushes, 1);
+    LWJSON_TRACE(LWJSON_TRACE_FIND_PUSH, parser->p - parser->msg->string);
 
     if (parent == LWJSON_PARENT_ARRAY) {
         parser->currentArrayIndex = 0;
@@ -725,3 +779,14 @@ static int GetStringArray(const LwJsonMsg *jsonArray, char **stringArray, uint32
 
 }
 
+static bool lwJsonIsCbor(const LwJsonMsg *msg) {
+    uint8_t first;
+
+    if (msg == NULL || msg->string == NULL || msg->len == 0) {
+        return false;
+    }
+
+    // Arrays, maps and tags. JSON text never starts with these bytes
+    first = (uint8_t)msg->string[0];
+    return (first >= 0x80 && first <= 0xDF);
+}
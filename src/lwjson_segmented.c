@@ -0,0 +1,613 @@
+#include "lwjson.h"
+#include "lwjson_internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// Max length of a number copied out when it crosses a segment boundary
+#define LWJSON_SEG_NUMBER_LEN_MAX   (24)
+
+typedef struct {
+    const LwJsonSegment *segment;                   // Current segment
+    const LwJsonSegment *last;                      // One past last segment
+    const char *p;                                  // Current char
+    const char *end;                                // End of current segment
+    uint32_t pos;                                   // Logical offset in the message
+} LwJsonSegCursor;
+
+typedef struct {
+    LwJsonSegCursor start;                          // Cursor at first value char
+    uint32_t len;
+    LwJsonValueType type;
+} LwJsonSegSpan;
+
+
+static int lwJsonSegFindValue(const char **path, const LwJsonSegmentedMsg *msg, LwJsonValueType expectedType, LwJsonSegSpan *span);
+static int lwJsonSegView(const LwJsonSegSpan *span, LwJsonMsg *value, char *buffer, uint32_t bufferLen);
+static int lwJsonRingSegments(const LwJsonRing *ring, LwJsonSegment *segments, LwJsonSegmentedMsg *msg);
+static int SegFindChild(LwJsonSegCursor *cursor, const char *name, char close, bool resume);
+static void SegCopy(LwJsonSegCursor cursor, char *dst, uint32_t len);
+static void SegInit(LwJsonSegCursor *cursor, const LwJsonSegmentedMsg *msg);
+static void SegSkipEmpty(LwJsonSegCursor *cursor);
+static int SegPeek(const LwJsonSegCursor *cursor);
+static void SegNext(LwJsonSegCursor *cursor);
+static void SegSkipWhitespace(LwJsonSegCursor *cursor);
+static int SegSkipString(LwJsonSegCursor *cursor);
+static int SegMatchName(LwJsonSegCursor *cursor, const char *name, bool *match);
+static int SegSkipLiteral(LwJsonSegCursor *cursor, const char *literal);
+static int SegSkipValue(LwJsonSegCursor *cursor, LwJsonValueType *type);
+static int SegSkipToContainerEnd(LwJsonSegCursor *cursor, char close);
+
+
+int lwJsonSegGetObject(const char **path, const LwJsonSegmentedMsg *msg, LwJsonMsg *object, char *buffer, uint32_t bufferLen) {
+    int result;
+    LwJsonSegSpan span;
+
+    result = lwJsonSegFindValue(path, msg, LWJSON_VAL_OBJECT, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    return lwJsonSegView(&span, object, buffer, bufferLen);
+}
+
+int lwJsonSegGetArray(const char **path, const LwJsonSegmentedMsg *msg, LwJsonMsg *array, char *buffer, uint32_t bufferLen) {
+    int result;
+    LwJsonSegSpan span;
+
+    result = lwJsonSegFindValue(path, msg, LWJSON_VAL_ARRAY, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    return lwJsonSegView(&span, array, buffer, bufferLen);
+}
+
+int lwJsonSegGetString(const char **path, const LwJsonSegmentedMsg *msg, char *value, uint32_t valueLen) {
+    int result;
+    uint32_t stringLen;
+    LwJsonSegSpan span;
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonSegFindValue(path, msg, LWJSON_VAL_STRING, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    // Check size
+    stringLen = span.len - 2;
+    if (stringLen > valueLen) {
+        return -ENOMEM;
+    }
+
+    // Get String. Copy skips opening quote
+    SegNext(&span.start);
+    SegCopy(span.start, value, stringLen);
+    value[stringLen] = 0;
+
+    return 0;
+}
+
+int lwJsonSegGetInt(const char **path, const LwJsonSegmentedMsg *msg, int *value) {
+    int result;
+    LwJsonSegSpan span;
+    char number[LWJSON_SEG_NUMBER_LEN_MAX + 1];
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonSegFindValue(path, msg, LWJSON_VAL_NUMBER, &span);
+    if (result != 0) {
+        return result;
+    }
+    if (span.len > LWJSON_SEG_NUMBER_LEN_MAX) {
+        return -ENOMEM;
+    }
+
+    // Get integer
+    SegCopy(span.start, number, span.len);
+    number[span.len] = 0;
+    (*value) = atoi(number);
+
+    return 0;
+}
+
+int lwJsonSegGetBool(const char **path, const LwJsonSegmentedMsg *msg, bool *value) {
+    int result;
+    LwJsonSegSpan span;
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonSegFindValue(path, msg, LWJSON_VAL_BOOLEAN, &span);
+    if (result != 0) {
+        return result;
+    }
+
+    // Get Value. Only "true" and "false" are accepted as booleans
+    (*value) = (span.len == strlen("true"));
+
+    return 0;
+}
+
+int lwJsonRingGetObject(const char **path, const LwJsonRing *ring, LwJsonMsg *object, char *buffer, uint32_t bufferLen) {
+    int result;
+    LwJsonSegment segments[2];
+    LwJsonSegmentedMsg msg;
+
+    result = lwJsonRingSegments(ring, segments, &msg);
+    if (result != 0) {
+        return result;
+    }
+
+    return lwJsonSegGetObject(path, &msg, object, buffer, bufferLen);
+}
+
+int lwJsonRingGetArray(const char **path, const LwJsonRing *ring, LwJsonMsg *array, char *buffer, uint32_t bufferLen) {
+    int result;
+    LwJsonSegment segments[2];
+    LwJsonSegmentedMsg msg;
+
+    result = lwJsonRingSegments(ring, segments, &msg);
+    if (result != 0) {
+        return result;
+    }
+
+    return lwJsonSegGetArray(path, &msg, array, buffer, bufferLen);
+}
+
+int lwJsonRingGetString(const char **path, const LwJsonRing *ring, char *value, uint32_t valueLen) {
+    int result;
+    LwJsonSegment segments[2];
+    LwJsonSegmentedMsg msg;
+
+    result = lwJsonRingSegments(ring, segments, &msg);
+    if (result != 0) {
+        return result;
+    }
+
+    return lwJsonSegGetString(path, &msg, value, valueLen);
+}
+
+int lwJsonRingGetInt(const char **path, const LwJsonRing *ring, int *value) {
+    int result;
+    LwJsonSegment segments[2];
+    LwJsonSegmentedMsg msg;
+
+    result = lwJsonRingSegments(ring, segments, &msg);
+    if (result != 0) {
+        return result;
+    }
+
+    return lwJsonSegGetInt(path, &msg, value);
+}
+
+int lwJsonRingGetBool(const char **path, const LwJsonRing *ring, bool *value) {
+    int result;
+    LwJsonSegment segments[2];
+    LwJsonSegmentedMsg msg;
+
+    result = lwJsonRingSegments(ring, segments, &msg);
+    if (result != 0) {
+        return result;
+    }
+
+    return lwJsonSegGetBool(path, &msg, value);
+}
+
+
+static int lwJsonSegFindValue(const char **path, const LwJsonSegmentedMsg *msg, LwJsonValueType expectedType, LwJsonSegSpan *span) {
+    LwJsonSegCursor cursor;
+    LwJsonSegCursor chosen[LWJSON_DEPTH_MAX];       // Value of the child taken at each level
+    char stack[LWJSON_DEPTH_MAX + 1];               // Closing char of containers entered while searching
+    uint32_t depth = 0;
+    uint32_t start;
+    bool resume = false;
+    int result;
+    int c;
+
+    if (path == NULL || msg == NULL || (msg->segments == NULL && msg->count > 0)) {
+        return -EINVAL;
+    }
+
+    SegInit(&cursor, msg);
+    SegSkipWhitespace(&cursor);
+
+    // Descend through path
+    while (path[depth] != NULL) {
+        if (depth >= LWJSON_DEPTH_MAX) {
+            return -EPERM;
+        }
+
+        if (!resume) {
+            c = SegPeek(&cursor);
+            if (c == '{' || c == '[') {
+                stack[depth] = (c == '{') ? '}' : ']';
+                SegNext(&cursor);
+                SegSkipWhitespace(&cursor);
+            } else if (c < 0) {
+                return -EPERM;
+            } else {
+                // Nothing to descend into
+                stack[depth] = 0;
+            }
+        }
+        result = (stack[depth] != 0) ? SegFindChild(&cursor, path[depth], stack[depth], resume) : -ENOENT;
+        resume = false;
+
+        // Like lwJsonFind, try the next member with the same name one level up
+        if (result == -ENOENT && depth > 0) {
+            depth--;
+            cursor = chosen[depth];
+            resume = true;
+            continue;
+        }
+        if (result != 0) {
+            return result;
+        }
+
+        chosen[depth] = cursor;
+        depth++;
+    }
+
+    // Found. Get value span
+    span->start = cursor;
+    start = cursor.pos;
+    result = SegSkipValue(&cursor, &span->type);
+    if (result != 0) {
+        return result;
+    }
+    span->len = cursor.pos - start;
+
+    // Check the rest of the message is well formed
+    while (depth > 0) {
+        depth--;
+        result = SegSkipToContainerEnd(&cursor, stack[depth]);
+        if (result != 0) {
+            return result;
+        }
+    }
+    SegSkipWhitespace(&cursor);
+    if (SegPeek(&cursor) >= 0) {
+        return -EPERM;
+    }
+
+    if (span->type != expectedType) {
+        return -EPERM;
+    }
+
+    return 0;
+}
+
+static int lwJsonSegView(const LwJsonSegSpan *span, LwJsonMsg *value, char *buffer, uint32_t bufferLen) {
+
+    if (value == NULL) {
+        return -EINVAL;
+    }
+
+    // Contiguous values are returned in place
+    if ((uint32_t)(span->start.end - span->start.p) >= span->len) {
+        value->string = (char*)span->start.p;
+        value->len = span->len;
+        return 0;
+    }
+
+    // Value crosses a segment boundary. Copy it out
+    if (buffer == NULL || span->len > bufferLen) {
+        return -ENOMEM;
+    }
+    SegCopy(span->start, buffer, span->len);
+    value->string = buffer;
+    value->len = span->len;
+
+    return 0;
+}
+
+static int lwJsonRingSegments(const LwJsonRing *ring, LwJsonSegment *segments, LwJsonSegmentedMsg *msg) {
+    uint32_t firstLen;
+
+    if (ring == NULL || ring->base == NULL) {
+        return -EINVAL;
+    }
+    if (ring->head >= ring->capacity || ring->len > ring->capacity) {
+        return -EINVAL;
+    }
+
+    // A ring frame is at most two segments: up to the end of the buffer and the wrapped part
+    firstLen = ring->capacity - ring->head;
+    if (firstLen > ring->len) {
+        firstLen = ring->len;
+    }
+    segments[0].string = &ring->base[ring->head];
+    segments[0].len = firstLen;
+    segments[1].string = ring->base;
+    segments[1].len = ring->len - firstLen;
+
+    msg->segments = segments;
+    msg->count = 2;
+
+    return 0;
+}
+
+static int SegFindChild(LwJsonSegCursor *cursor, const char *name, char close, bool resume) {
+    uint32_t arrayIndex;
+    LwJsonValueType type;
+    bool match;
+    int result;
+    int c;
+
+    // Cursor is after the opening char, or at the value of the member to resume from
+    if (close == ']') {
+        // Array items are unique, they are not tried again
+        if (resume || lwJsonParseArrayIndex(name, &arrayIndex) != 0 || SegPeek(cursor) == ']') {
+            return -ENOENT;
+        }
+        while (arrayIndex > 0) {
+            result = SegSkipValue(cursor, &type);
+            if (result != 0) {
+                return result;
+            }
+            SegSkipWhitespace(cursor);
+            c = SegPeek(cursor);
+            if (c == ']') {
+                return -ENOENT;
+            } else if (c != ',') {
+                return -EPERM;
+            }
+            SegNext(cursor);
+            SegSkipWhitespace(cursor);
+            arrayIndex--;
+        }
+        return 0;
+    }
+
+    if (!resume && SegPeek(cursor) == '}') {
+        return -ENOENT;
+    }
+    while (true) {
+        if (!resume) {
+            // Property name and value
+            result = SegMatchName(cursor, name, &match);
+            if (result != 0) {
+                return result;
+            }
+            SegSkipWhitespace(cursor);
+            if (SegPeek(cursor) != ':') {
+                return -EPERM;
+            }
+            SegNext(cursor);
+            SegSkipWhitespace(cursor);
+            if (match) {
+                return 0;
+            }
+        }
+        resume = false;
+        result = SegSkipValue(cursor, &type);
+        if (result != 0) {
+            return result;
+        }
+
+        // Another attribute or object end
+        SegSkipWhitespace(cursor);
+        c = SegPeek(cursor);
+        if (c == '}') {
+            return -ENOENT;
+        } else if (c != ',') {
+            return -EPERM;
+        }
+        SegNext(cursor);
+        SegSkipWhitespace(cursor);
+    }
+}
+
+static void SegCopy(LwJsonSegCursor cursor, char *dst, uint32_t len) {
+    uint32_t chunk;
+
+    while (len > 0) {
+        chunk = cursor.end - cursor.p;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(dst, cursor.p, chunk);
+        dst += chunk;
+        len -= chunk;
+        cursor.p += chunk;
+        SegSkipEmpty(&cursor);
+    }
+}
+
+static void SegInit(LwJsonSegCursor *cursor, const LwJsonSegmentedMsg *msg) {
+    cursor->segment = msg->segments;
+    cursor->last = msg->segments + msg->count;
+    cursor->pos = 0;
+    cursor->p = NULL;
+    cursor->end = NULL;
+    if (msg->count > 0) {
+        cursor->p = cursor->segment->string;
+        cursor->end = cursor->p + cursor->segment->len;
+    }
+    SegSkipEmpty(cursor);
+}
+
+static void SegSkipEmpty(LwJsonSegCursor *cursor) {
+    // Move to the next segment with data
+    while (cursor->p == cursor->end && cursor->segment < cursor->last) {
+        cursor->segment++;
+        if (cursor->segment < cursor->last) {
+            cursor->p = cursor->segment->string;
+            cursor->end = cursor->p + cursor->segment->len;
+        }
+    }
+}
+
+static int SegPeek(const LwJsonSegCursor *cursor) {
+    if (cursor->segment >= cursor->last) {
+        return -1;
+    }
+    return (unsigned char)cursor->p[0];
+}
+
+static void SegNext(LwJsonSegCursor *cursor) {
+    cursor->p++;
+    cursor->pos++;
+    if (cursor->p == cursor->end) {
+        SegSkipEmpty(cursor);
+    }
+}
+
+static void SegSkipWhitespace(LwJsonSegCursor *cursor) {
+    int c;
+
+    for (c = SegPeek(cursor); c == ' ' || c == '\t' || c == '\r' || c == '\n'; c = SegPeek(cursor)) {
+        SegNext(cursor);
+    }
+}
+
+static int SegSkipString(LwJsonSegCursor *cursor) {
+    int c;
+
+    // Skip opening quote
+    SegNext(cursor);
+    while ((c = SegPeek(cursor)) >= 32) {
+        SegNext(cursor);
+        if (c == '"') {
+            return 0;
+        } else if (c == '\\') {
+            if (SegPeek(cursor) < 0) {
+                break;
+            }
+            SegNext(cursor);
+        }
+    }
+
+    return -EPERM;
+}
+
+static int SegMatchName(LwJsonSegCursor *cursor, const char *name, bool *match) {
+    int c;
+
+    if (SegPeek(cursor) != '"') {
+        return -EPERM;
+    }
+
+    // Compare name while skipping it
+    (*match) = true;
+    SegNext(cursor);
+    while ((c = SegPeek(cursor)) >= 32) {
+        SegNext(cursor);
+        if (c == '"') {
+            if ((*name) != 0) {
+                (*match) = false;
+            }
+            return 0;
+        }
+        if ((*match) && (unsigned char)(*name) == c) {
+            name++;
+        } else {
+            (*match) = false;
+        }
+        if (c == '\\') {
+            if (SegPeek(cursor) < 0) {
+                break;
+            }
+            (*match) = false;
+            SegNext(cursor);
+        }
+    }
+
+    return -EPERM;
+}
+
+static int SegSkipLiteral(LwJsonSegCursor *cursor, const char *literal) {
+    for (; (*literal) != 0; literal++) {
+        if (SegPeek(cursor) != (*literal)) {
+            return -EPERM;
+        }
+        SegNext(cursor);
+    }
+
+    return 0;
+}
+
+static int SegSkipValue(LwJsonSegCursor *cursor, LwJsonValueType *type) {
+    int c;
+
+    c = SegPeek(cursor);
+    if (c == '"') {
+        (*type) = LWJSON_VAL_STRING;
+        return SegSkipString(cursor);
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        (*type) = LWJSON_VAL_NUMBER;
+        do {
+            SegNext(cursor);
+            c = SegPeek(cursor);
+        } while ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-');
+        return 0;
+    } else if (c == '{') {
+        (*type) = LWJSON_VAL_OBJECT;
+        SegNext(cursor);
+        return SegSkipToContainerEnd(cursor, '}');
+    } else if (c == '[') {
+        (*type) = LWJSON_VAL_ARRAY;
+        SegNext(cursor);
+        return SegSkipToContainerEnd(cursor, ']');
+    } else if (c == 't') {
+        (*type) = LWJSON_VAL_BOOLEAN;
+        return SegSkipLiteral(cursor, "true");
+    } else if (c == 'f') {
+        (*type) = LWJSON_VAL_BOOLEAN;
+        return SegSkipLiteral(cursor, "false");
+    } else if (c == 'n') {
+        (*type) = LWJSON_VAL_NULL;
+        return SegSkipLiteral(cursor, "null");
+    }
+
+    return -EPERM;
+}
+
+static int SegSkipToContainerEnd(LwJsonSegCursor *cursor, char close) {
+    char stack[LWJSON_DEPTH_MAX + 1];
+    uint32_t depth = 0;
+    int result;
+    int c;
+
+    // Skip nested containers until the matching close char
+    stack[depth] = close;
+    while (true) {
+        c = SegPeek(cursor);
+        if (c < 0) {
+            return -EPERM;
+        }
+        if (c == '"') {
+            result = SegSkipString(cursor);
+            if (result != 0) {
+                return result;
+            }
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+            if (depth > LWJSON_DEPTH_MAX) {
+                return -EPERM;
+            }
+            stack[depth] = (c == '{') ? '}' : ']';
+        } else if (c == '}' || c == ']') {
+            if (c != stack[depth]) {
+                return -EPERM;
+            }
+            if (depth == 0) {
+                SegNext(cursor);
+                return 0;
+            }
+            depth--;
+        }
+        SegNext(cursor);
+    }
+}
@@ -0,0 +1,29 @@
+#include "lwjson_stats.h"
+#include <string.h>
+
+#if LWJSON_STATS
+LWJSON_THREAD_LOCAL LwJsonStats lwJsonStats;
+LWJSON_THREAD_LOCAL LwJsonTraceCallback lwJsonTrace;
+LWJSON_THREAD_LOCAL void *lwJsonTraceContext;
+
+
+void lwJsonStatsGet(LwJsonStats *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    (*stats) = lwJsonStats;
+}
+
+void lwJsonStatsReset(void) {
+    memset(&lwJsonStats, 0, sizeof(LwJsonStats));
+}
+
+void lwJsonSetTrace(LwJsonTraceCallback trace, void *context) {
+    lwJsonTrace = trace;
+    lwJsonTraceContext = context;
+}
+#else
+// ISO C needs at least one declaration per translation unit
+typedef int LwJsonStatsDisabled;
+#endif
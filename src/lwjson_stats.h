@@ -0,0 +1,19 @@
+#ifndef LWJSON_STATS_H
+#define LWJSON_STATS_H
+
+#include "lwjson.h"
+
+// Internal counter and trace macros. Without LWJSON_STATS they compile to nothing
+#if LWJSON_STATS
+extern LWJSON_THREAD_LOCAL LwJsonStats lwJsonStats;
+extern LWJSON_THREAD_LOCAL LwJsonTraceCallback lwJsonTrace;
+extern LWJSON_THREAD_LOCAL void *lwJsonTraceContext;
+
+#define LWJSON_STAT_ADD(counter, n)     (lwJsonStats.counter += (uint32_t)(n))
+#define LWJSON_TRACE(event, arg)        do { if (lwJsonTrace != NULL) { lwJsonTrace(lwJsonTraceContext, (event), (uint32_t)(arg)); } } while (0)
+#else
+#define LWJSON_STAT_ADD(counter, n)     ((void)0)
+#define LWJSON_TRACE(event, arg)        ((void)0)
+#endif
+
+#endif
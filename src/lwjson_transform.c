@@ -0,0 +1,747 @@
+#include "lwjson.h"
+#include "lwjson_internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+// Projection and redaction state. Bit n of a path mask is set while paths[n] matches the current position
+typedef struct {
+    const char *src;
+    uint32_t srcLen;
+    uint32_t i;                     // Next input char
+    char *dst;
+    uint32_t dstLen;
+    uint32_t o;                     // Output length
+    const char **const *paths;
+    uint32_t pathCount;
+    bool keep;
+    uint32_t kept;                  // Values copied in LWJSON_PROJECT_KEEP mode
+    char mask;                      // Redaction char
+    uint32_t redacted;              // Redacted values
+} LwJsonProjector;
+
+static int lwJsonMinifyBuffer(const char *src, uint32_t srcLen, char *dst, uint32_t dstLen, uint32_t *outLen);
+static LwJsonWord WordHasByte(LwJsonWord word, unsigned char c);
+static LwJsonWord WordHasLess(LwJsonWord word, unsigned char c);
+static bool WhitespaceChar(char c);
+static int ProjectValue(LwJsonProjector *proj, uint32_t depth, uint32_t mask);
+static int ProjectObject(LwJsonProjector *proj, uint32_t depth, uint32_t mask);
+static int ProjectArray(LwJsonProjector *proj, uint32_t depth, uint32_t mask);
+static int RedactValue(LwJsonProjector *proj, uint32_t depth, uint32_t mask, bool all);
+static int RedactObject(LwJsonProjector *proj, uint32_t depth, uint32_t mask, bool all);
+static int RedactArray(LwJsonProjector *proj, uint32_t depth, uint32_t mask, bool all);
+static bool ProjectSelected(const LwJsonProjector *proj, uint32_t depth, uint32_t mask);
+static bool ProjectFullMatch(const LwJsonProjector *proj, uint32_t depth, uint32_t mask);
+static uint32_t ProjectMatchName(const LwJsonProjector *proj, uint32_t depth, uint32_t mask, const char *name, uint32_t nameLen);
+static uint32_t ProjectMatchIndex(const LwJsonProjector *proj, uint32_t depth, uint32_t mask, uint32_t index);
+static int ProjectSkipValue(LwJsonProjector *proj);
+static int ProjectSkipString(LwJsonProjector *proj);
+static void ProjectSkipWhitespace(LwJsonProjector *proj);
+static char ProjectPeek(const LwJsonProjector *proj);
+static int ProjectEmit(LwJsonProjector *proj, const char *data, uint32_t len);
+static int ProjectInit(LwJsonProjector *proj, const LwJsonMsg *src, const char **const *paths, uint32_t pathCount, uint32_t *mask);
+
+
+int lwJsonMinify(LwJsonMsg *msg) {
+    int result;
+    uint32_t len;
+
+    if (msg == NULL || msg->string == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonMinifyBuffer(msg->string, msg->len, msg->string, msg->len, &len);
+    if (result != 0) {
+        return result;
+    }
+
+    msg->len = len;
+
+    return 0;
+}
+
+int lwJsonMinifyTo(const LwJsonMsg *src, LwJsonMsg *dst) {
+    int result;
+    uint32_t len;
+
+    if (src == NULL || dst == NULL || src->string == NULL || dst->string == NULL) {
+        return -EINVAL;
+    }
+
+    result = lwJsonMinifyBuffer(src->string, src->len, dst->string, dst->len, &len);
+    if (result != 0) {
+        return result;
+    }
+
+    dst->len = len;
+
+    return 0;
+}
+
+int lwJsonProject(const LwJsonMsg *src, const char **const *paths, uint32_t pathCount, LwJsonProjectMode mode, LwJsonMsg *dst) {
+    LwJsonProjector proj;
+    uint32_t mask;
+    int result;
+
+    if (dst == NULL || dst->string == NULL) {
+        return -EINVAL;
+    }
+    if (mode != LWJSON_PROJECT_KEEP && mode != LWJSON_PROJECT_DROP) {
+        return -EINVAL;
+    }
+
+    result = ProjectInit(&proj, src, paths, pathCount, &mask);
+    if (result != 0) {
+        return result;
+    }
+    proj.dst = dst->string;
+    proj.dstLen = dst->len;
+    proj.keep = (mode == LWJSON_PROJECT_KEEP);
+
+    ProjectSkipWhitespace(&proj);
+    result = ProjectValue(&proj, 0, mask);
+    if (result != 0) {
+        return result;
+    }
+    ProjectSkipWhitespace(&proj);
+    if (ProjectPeek(&proj) != 0) {
+        return -EPERM;
+    }
+
+    // Terminate output if there is room for it
+    if (proj.o < proj.dstLen) {
+        proj.dst[proj.o] = 0;
+    }
+    dst->len = proj.o;
+
+    return 0;
+}
+
+int lwJsonRedact(LwJsonMsg *msg, const char **const *paths, uint32_t pathCount, char mask) {
+    LwJsonProjector proj;
+    uint32_t pathMask;
+    int result;
+
+    // Mask must keep strings valid
+    if (mask < 0x20 || mask > 0x7E || mask == '"' || mask == '\\') {
+        return -EINVAL;
+    }
+
+    result = ProjectInit(&proj, msg, paths, pathCount, &pathMask);
+    if (result != 0) {
+        return result;
+    }
+    proj.dst = msg->string;
+    proj.mask = mask;
+
+    ProjectSkipWhitespace(&proj);
+    result = RedactValue(&proj, 0, pathMask, false);
+    if (result != 0) {
+        return result;
+    }
+    ProjectSkipWhitespace(&proj);
+    if (ProjectPeek(&proj) != 0) {
+        return -EPERM;
+    }
+
+    return (int)proj.redacted;
+}
+
+
+static int lwJsonMinifyBuffer(const char *src, uint32_t srcLen, char *dst, uint32_t dstLen, uint32_t *outLen) {
+    uint32_t i = 0;
+    uint32_t o = 0;
+    uint32_t end;
+    bool inString = false;
+    bool escape = false;
+    LwJsonWord word;
+    LwJsonWord special;
+    char c;
+
+    while (i < srcLen) {
+        // Fast path. Copy a whole word when it contains nothing that changes the minifier state
+        if (!escape && (i + LWJSON_WORD_SIZE) <= srcLen && (o + LWJSON_WORD_SIZE) <= dstLen) {
+            memcpy(&word, &src[i], LWJSON_WORD_SIZE);
+            if (inString) {
+                // Quotes, escapes and string terminator
+                special = WordHasByte(word, '"') | WordHasByte(word, '\\') | WordHasLess(word, 1);
+            } else {
+                // Quotes, whitespace, control chars and string terminator
+                special = WordHasByte(word, '"') | WordHasLess(word, 0x21);
+            }
+            if (special == 0) {
+                memcpy(&dst[o], &word, LWJSON_WORD_SIZE);
+                i += LWJSON_WORD_SIZE;
+                o += LWJSON_WORD_SIZE;
+                continue;
+            }
+        }
+
+        // Slow path. Process the next word byte by byte
+        end = i + LWJSON_WORD_SIZE;
+        if (end > srcLen) {
+            end = srcLen;
+        }
+        for (; i < end; i++) {
+            c = src[i];
+            if (c == 0) {
+                srcLen = i;
+                break;
+            }
+            if (!inString && WhitespaceChar(c)) {
+                continue;
+            }
+            if (o >= dstLen) {
+                return -ENOMEM;
+            }
+            dst[o] = c;
+            o++;
+
+            if (escape) {
+                escape = false;
+            } else if (c == '"') {
+                inString = !inString;
+            } else if (inString && c == '\\') {
+                escape = true;
+            }
+        }
+    }
+
+    if (inString) {
+        return -EPERM;
+    }
+
+    // Terminate output if there is room for it
+    if (o < dstLen) {
+        dst[o] = 0;
+    }
+    (*outLen) = o;
+
+    return 0;
+}
+
+static LwJsonWord WordHasByte(LwJsonWord word, unsigned char c) {
+    // Non zero if any byte of word equals c
+    return WordHasLess(word ^ (LWJSON_WORD_ONES * c), 1);
+}
+
+static LwJsonWord WordHasLess(LwJsonWord word, unsigned char c) {
+    // Non zero if any byte of word is lower than c (c <= 128)
+    return (word - (LWJSON_WORD_ONES * c)) & ~word & LWJSON_WORD_HIGHS;
+}
+
+static bool WhitespaceChar(char c) {
+
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        return true;
+    }
+
+    return false;
+}
+
+static int ProjectValue(LwJsonProjector *proj, uint32_t depth, uint32_t mask) {
+    uint32_t start = proj->i;
+    char c = ProjectPeek(proj);
+    int result;
+
+    // Containers with selected paths below are rebuilt, anything else is copied raw
+    if (mask != 0 && !(proj->keep && ProjectFullMatch(proj, depth, mask))) {
+        if (c == '{') {
+            return ProjectObject(proj, depth, mask);
+        }
+        if (c == '[') {
+            return ProjectArray(proj, depth, mask);
+        }
+    }
+
+    result = ProjectSkipValue(proj);
+    if (result != 0) {
+        return result;
+    }
+    if (proj->keep) {
+        proj->kept++;
+    }
+
+    return ProjectEmit(proj, &proj->src[start], proj->i - start);
+}
+
+static int ProjectObject(LwJsonProjector *proj, uint32_t depth, uint32_t mask) {
+    uint32_t nameStart;
+    uint32_t nameLen;
+    uint32_t childMask;
+    uint32_t mark;
+    uint32_t kept;
+    bool first = true;
+    char c;
+    int result;
+
+    if (depth >= LWJSON_DEPTH_MAX) {
+        return -EPERM;
+    }
+
+    proj->i++;
+    result = ProjectEmit(proj, "{", 1);
+    if (result != 0) {
+        return result;
+    }
+
+    ProjectSkipWhitespace(proj);
+    if (ProjectPeek(proj) == '}') {
+        proj->i++;
+        return ProjectEmit(proj, "}", 1);
+    }
+
+    while (true) {
+        if (ProjectPeek(proj) != '"') {
+            return -EPERM;
+        }
+        nameStart = proj->i;
+        result = ProjectSkipString(proj);
+        if (result != 0) {
+            return result;
+        }
+        nameLen = proj->i - nameStart;
+
+        ProjectSkipWhitespace(proj);
+        if (ProjectPeek(proj) != ':') {
+            return -EPERM;
+        }
+        proj->i++;
+        ProjectSkipWhitespace(proj);
+
+        childMask = ProjectMatchName(proj, depth, mask, &proj->src[nameStart + 1], nameLen - 2);
+        if (ProjectSelected(proj, depth + 1, childMask)) {
+            mark = proj->o;
+            kept = proj->kept;
+            // Quoted name is copied as is, separators come from the projection
+            if (!first) {
+                result = ProjectEmit(proj, ",", 1);
+                if (result != 0) {
+                    return result;
+                }
+            }
+            result = ProjectEmit(proj, &proj->src[nameStart], nameLen);
+            if (result == 0) {
+                result = ProjectEmit(proj, ":", 1);
+            }
+            if (result == 0) {
+                result = ProjectValue(proj, depth + 1, childMask);
+            }
+            // Kept parents only, a container with nothing selected below is left out
+            if (proj->keep && proj->kept == kept) {
+                proj->o = mark;
+            } else {
+                first = false;
+            }
+        } else {
+            result = ProjectSkipValue(proj);
+        }
+        if (result != 0) {
+            return result;
+        }
+
+        ProjectSkipWhitespace(proj);
+        c = ProjectPeek(proj);
+        proj->i++;
+        if (c == '}') {
+            break;
+        }
+        if (c != ',') {
+            return -EPERM;
+        }
+        ProjectSkipWhitespace(proj);
+    }
+
+    return ProjectEmit(proj, "}", 1);
+}
+
+static int ProjectArray(LwJsonProjector *proj, uint32_t depth, uint32_t mask) {
+    uint32_t index;
+    uint32_t childMask;
+    uint32_t mark;
+    uint32_t kept;
+    bool first = true;
+    char c;
+    int result;
+
+    if (depth >= LWJSON_DEPTH_MAX) {
+        return -EPERM;
+    }
+
+    proj->i++;
+    result = ProjectEmit(proj, "[", 1);
+    if (result != 0) {
+        return result;
+    }
+
+    ProjectSkipWhitespace(proj);
+    if (ProjectPeek(proj) == ']') {
+        proj->i++;
+        return ProjectEmit(proj, "]", 1);
+    }
+
+    for (index = 0; ; index++) {
+        childMask = ProjectMatchIndex(proj, depth, mask, index);
+        if (ProjectSelected(proj, depth + 1, childMask)) {
+            mark = proj->o;
+            kept = proj->kept;
+            if (!first) {
+                result = ProjectEmit(proj, ",", 1);
+                if (result != 0) {
+                    return result;
+                }
+            }
+            result = ProjectValue(proj, depth + 1, childMask);
+            if (proj->keep && proj->kept == kept) {
+                proj->o = mark;
+            } else {
+                first = false;
+            }
+        } else {
+            result = ProjectSkipValue(proj);
+        }
+        if (result != 0) {
+            return result;
+        }
+
+        ProjectSkipWhitespace(proj);
+        c = ProjectPeek(proj);
+        proj->i++;
+        if (c == ']') {
+            break;
+        }
+        if (c != ',') {
+            return -EPERM;
+        }
+        ProjectSkipWhitespace(proj);
+    }
+
+    return ProjectEmit(proj, "]", 1);
+}
+
+static int RedactValue(LwJsonProjector *proj, uint32_t depth, uint32_t mask, bool all) {
+    uint32_t start = proj->i;
+    char c = ProjectPeek(proj);
+    int result;
+
+    all = all || ProjectFullMatch(proj, depth, mask);
+    if (c == '{' && (all || mask != 0)) {
+        return RedactObject(proj, depth, mask, all);
+    }
+    if (c == '[' && (all || mask != 0)) {
+        return RedactArray(proj, depth, mask, all);
+    }
+
+    result = ProjectSkipValue(proj);
+    if (result != 0 || !all) {
+        return result;
+    }
+
+    if (c == '"') {
+        // Same length mask between the quotes
+        memset(&proj->dst[start + 1], proj->mask, proj->i - start - 2);
+        proj->redacted++;
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        // Numbers become 0 padded with whitespace
+        proj->dst[start] = '0';
+        memset(&proj->dst[start + 1], ' ', proj->i - start - 1);
+        proj->redacted++;
+    }
+
+    return 0;
+}
+
+static int RedactObject(LwJsonProjector *proj, uint32_t depth, uint32_t mask, bool all) {
+    uint32_t nameStart;
+    uint32_t childMask;
+    char c;
+    int result;
+
+    if (depth >= LWJSON_DEPTH_MAX) {
+        return -EPERM;
+    }
+
+    proj->i++;
+    ProjectSkipWhitespace(proj);
+    if (ProjectPeek(proj) == '}') {
+        proj->i++;
+        return 0;
+    }
+
+    while (true) {
+        if (ProjectPeek(proj) != '"') {
+            return -EPERM;
+        }
+        nameStart = proj->i;
+        result = ProjectSkipString(proj);
+        if (result != 0) {
+            return result;
+        }
+        childMask = ProjectMatchName(proj, depth, mask, &proj->src[nameStart + 1], proj->i - nameStart - 2);
+
+        ProjectSkipWhitespace(proj);
+        if (ProjectPeek(proj) != ':') {
+            return -EPERM;
+        }
+        proj->i++;
+        ProjectSkipWhitespace(proj);
+
+        result = RedactValue(proj, depth + 1, childMask, all);
+        if (result != 0) {
+            return result;
+        }
+
+        ProjectSkipWhitespace(proj);
+        c = ProjectPeek(proj);
+        proj->i++;
+        if (c == '}') {
+            return 0;
+        }
+        if (c != ',') {
+            return -EPERM;
+        }
+        ProjectSkipWhitespace(proj);
+    }
+}
+
+static int RedactArray(LwJsonProjector *proj, uint32_t depth, uint32_t mask, bool all) {
+    uint32_t index;
+    char c;
+    int result;
+
+    if (depth >= LWJSON_DEPTH_MAX) {
+        return -EPERM;
+    }
+
+    proj->i++;
+    ProjectSkipWhitespace(proj);
+    if (ProjectPeek(proj) == ']') {
+        proj->i++;
+        return 0;
+    }
+
+    for (index = 0; ; index++) {
+        result = RedactValue(proj, depth + 1, ProjectMatchIndex(proj, depth, mask, index), all);
+        if (result != 0) {
+            return result;
+        }
+
+        ProjectSkipWhitespace(proj);
+        c = ProjectPeek(proj);
+        proj->i++;
+        if (c == ']') {
+            return 0;
+        }
+        if (c != ',') {
+            return -EPERM;
+        }
+        ProjectSkipWhitespace(proj);
+    }
+}
+
+static bool ProjectSelected(const LwJsonProjector *proj, uint32_t depth, uint32_t mask) {
+    char c;
+
+    if (!proj->keep) {
+        // Dropped only when a path ends here
+        return !ProjectFullMatch(proj, depth, mask);
+    }
+    if (mask == 0) {
+        return false;
+    }
+    if (ProjectFullMatch(proj, depth, mask)) {
+        return true;
+    }
+
+    // Paths going deeper can only match inside containers
+    c = ProjectPeek(proj);
+
+    return (c == '{' || c == '[');
+}
+
+static bool ProjectFullMatch(const LwJsonProjector *proj, uint32_t depth, uint32_t mask) {
+    uint32_t n;
+
+    for (n = 0; n < proj->pathCount; n++) {
+        if ((mask & (1UL << n)) != 0 && proj->paths[n][depth] == NULL) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint32_t ProjectMatchName(const LwJsonProjector *proj, uint32_t depth, uint32_t mask, const char *name, uint32_t nameLen) {
+    uint32_t childMask = 0;
+    const char *element;
+    uint32_t n;
+
+    for (n = 0; n < proj->pathCount; n++) {
+        if ((mask & (1UL << n)) == 0) {
+            continue;
+        }
+        // Names are compared as they appear in the message, escapes included. "*" matches any name
+        element = proj->paths[n][depth];
+        if (element == NULL) {
+            continue;
+        }
+        if (strcmp(element, "*") == 0 || (strlen(element) == nameLen && memcmp(element, name, nameLen) == 0)) {
+            childMask |= (1UL << n);
+        }
+    }
+
+    return childMask;
+}
+
+static uint32_t ProjectMatchIndex(const LwJsonProjector *proj, uint32_t depth, uint32_t mask, uint32_t index) {
+    uint32_t childMask = 0;
+    uint32_t arrayIndex;
+    const char *element;
+    uint32_t n;
+
+    for (n = 0; n < proj->pathCount; n++) {
+        if ((mask & (1UL << n)) == 0) {
+            continue;
+        }
+        // "*" matches any item
+        element = proj->paths[n][depth];
+        if (element == NULL) {
+            continue;
+        }
+        if (strcmp(element, "*") == 0 || (lwJsonParseArrayIndex(element, &arrayIndex) == 0 && arrayIndex == index)) {
+            childMask |= (1UL << n);
+        }
+    }
+
+    return childMask;
+}
+
+static int ProjectSkipValue(LwJsonProjector *proj) {
+    char closers[LWJSON_DEPTH_MAX];
+    uint32_t depth = 0;
+    uint32_t start;
+    char c;
+    int result;
+
+    do {
+        c = ProjectPeek(proj);
+        if (c == '"') {
+            result = ProjectSkipString(proj);
+            if (result != 0) {
+                return result;
+            }
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            if (depth >= LWJSON_DEPTH_MAX) {
+                return -EPERM;
+            }
+            closers[depth] = (c == '{') ? '}' : ']';
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (depth == 0 || closers[depth - 1] != c) {
+                return -EPERM;
+            }
+            depth--;
+        } else if (c == 0) {
+            return -EPERM;
+        } else if (depth == 0) {
+            // Number or literal, up to the next delimiter
+            start = proj->i;
+            while ((c = ProjectPeek(proj)) != 0 && c != ',' && c != '}' && c != ']' && !WhitespaceChar(c)) {
+                proj->i++;
+            }
+            return (proj->i > start) ? 0 : -EPERM;
+        }
+        proj->i++;
+    } while (depth > 0);
+
+    return 0;
+}
+
+static int ProjectSkipString(LwJsonProjector *proj) {
+    LwJsonWord word;
+    char c;
+
+    proj->i++;
+    while (proj->i < proj->srcLen) {
+        // Fast path. Skip whole words without quotes, escapes or terminator
+        if ((proj->i + LWJSON_WORD_SIZE) <= proj->srcLen) {
+            memcpy(&word, &proj->src[proj->i], LWJSON_WORD_SIZE);
+            if ((WordHasByte(word, '"') | WordHasByte(word, '\\') | WordHasLess(word, 1)) == 0) {
+                proj->i += LWJSON_WORD_SIZE;
+                continue;
+            }
+        }
+
+        c = proj->src[proj->i];
+        proj->i++;
+        if (c == '"') {
+            return 0;
+        }
+        if (c == 0) {
+            break;
+        }
+        if (c == '\\') {
+            proj->i++;
+        }
+    }
+
+    return -EPERM;
+}
+
+static void ProjectSkipWhitespace(LwJsonProjector *proj) {
+
+    while (proj->i < proj->srcLen && WhitespaceChar(proj->src[proj->i])) {
+        proj->i++;
+    }
+}
+
+static char ProjectPeek(const LwJsonProjector *proj) {
+
+    // Input ends at its length or at a string terminator
+    if (proj->i >= proj->srcLen) {
+        return 0;
+    }
+
+    return proj->src[proj->i];
+}
+
+static int ProjectEmit(LwJsonProjector *proj, const char *data, uint32_t len) {
+
+    if (len > proj->dstLen - proj->o) {
+        return -ENOMEM;
+    }
+    // Output never overtakes input, so src and dst may be the same buffer
+    memmove(&proj->dst[proj->o], data, len);
+    proj->o += len;
+
+    return 0;
+}
+
+static int ProjectInit(LwJsonProjector *proj, const LwJsonMsg *src, const char **const *paths, uint32_t pathCount, uint32_t *mask) {
+    uint32_t i;
+
+    if (src == NULL || src->string == NULL) {
+        return -EINVAL;
+    }
+    if ((paths == NULL && pathCount > 0) || pathCount > LWJSON_PROJECT_PATHS_MAX) {
+        return -EINVAL;
+    }
+    for (i = 0; i < pathCount; i++) {
+        // Empty paths would select the whole message
+        if (paths[i] == NULL || paths[i][0] == NULL) {
+            return -EINVAL;
+        }
+    }
+
+    memset(proj, 0, sizeof(LwJsonProjector));
+    proj->src = src->string;
+    proj->srcLen = src->len;
+    proj->paths = paths;
+    proj->pathCount = pathCount;
+    (*mask) = (pathCount == 32) ? UINT32_MAX : ((1UL << pathCount) - 1);
+
+    return 0;
+}
@@ -1,9 +1,10 @@
 #include "CppUTest/TestHarness.h"
-#include "lwjson.h"
+#include "lwjson.hpp"
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 
 TEST_GROUP(lwjson)
@@ -360,6 +361,45 @@ TEST(lwjson, ParseValueInArrayObject)
     CHECK_EQUAL(-ENOENT, callResult);
 }
 
+static void TestDirtyStack(void)
+{
+    volatile unsigned char garbage[1024];
+
+    // Leaves non-zero bytes where the parser of the next call lives
+    for (unsigned int i = 0; i < sizeof(garbage); i++) {
+        garbage[i] = 0xA5;
+    }
+}
+
+TEST(lwjson, ParseWithDirtyStack)
+{
+    char testString[] = "{\"skip\":{\"x\":\"s\"},\"array\":[7,8],\"value\":5}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    const char *path[] = {NULL, NULL, NULL};
+    char string[4];
+    int callResult;
+    int value = 0;
+
+    // Parser state must not depend on what was on the stack before
+    path[0] = "value";
+    TestDirtyStack();
+    callResult = lwJsonGetInt(path, &testMsg, &value);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(5, value);
+
+    path[0] = "array";
+    TestDirtyStack();
+    callResult = lwJsonGetInt(path, &testMsg, &value);
+    CHECK_EQUAL(-EPERM, callResult);
+
+    path[0] = "skip";
+    path[1] = "x";
+    TestDirtyStack();
+    callResult = lwJsonGetString(path, &testMsg, string, sizeof(string) - 1);
+    CHECK_EQUAL(0, callResult);
+    STRCMP_EQUAL("s", string);
+}
+
 TEST(lwjson, ParseObject) {
     char testString[] = "{\"array\":[0,{\"bool\":true},2,3,4,5,6,7,8,9]}";
     LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
@@ -913,3 +953,1986 @@ TEST(lwjson, AppendExistingObjectRunsOutOfSpace)
 
     CHECK_EQUAL(-ENOMEM, result);
 }
+
+TEST(lwjson, MinifyInPlace)
+{
+    char testString[] = "{\n\t\"object\" : {\r\n\t\t\"string\" : \"keep  these\\t spaces\",\n\t\t\"array\" : [ 1, 2 , 3 ]\n\t}\n}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    int result;
+
+    result = lwJsonMinify(&testMsg);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"object\":{\"string\":\"keep  these\\t spaces\",\"array\":[1,2,3]}}", testString);
+    CHECK_EQUAL(strlen(testString), testMsg.len);
+}
+
+TEST(lwjson, MinifyEscapedQuotes)
+{
+    char testString[] = "{ \"value\" : \"a \\\" b \\\\\" , \"next\" : true }";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    int result;
+
+    result = lwJsonMinify(&testMsg);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"value\":\"a \\\" b \\\\\",\"next\":true}", testString);
+}
+
+TEST(lwjson, MinifyToBuffer)
+{
+    const char srcString[] = "{ \"integer\" : 2 ,\n \"string\" : \"a b\" }";
+    const unsigned int STRING_LEN = 28;
+    char string[STRING_LEN + 1];
+    LwJsonMsg srcMsg = {(char*)srcString, sizeof(srcString) - 1};
+    LwJsonMsg dstMsg = {string, STRING_LEN};
+    int result;
+
+    result = lwJsonMinifyTo(&srcMsg, &dstMsg);
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(28, dstMsg.len);
+    string[dstMsg.len] = 0;
+    STRCMP_EQUAL("{\"integer\":2,\"string\":\"a b\"}", string);
+}
+
+TEST(lwjson, MinifyToBufferRunsOutOfSpace)
+{
+    const char srcString[] = "{ \"integer\" : 2 ,\n \"string\" : \"a b\" }";
+    const unsigned int STRING_LEN = 27;
+    char string[STRING_LEN + 1];
+    LwJsonMsg srcMsg = {(char*)srcString, sizeof(srcString) - 1};
+    LwJsonMsg dstMsg = {string, STRING_LEN};
+    int result;
+
+    result = lwJsonMinifyTo(&srcMsg, &dstMsg);
+    CHECK_EQUAL(-ENOMEM, result);
+}
+
+TEST(lwjson, MinifyUnterminatedString)
+{
+    char testString[] = "{ \"value\" : \"testing }";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    int result;
+
+    result = lwJsonMinify(&testMsg);
+    CHECK_EQUAL(-EPERM, result);
+    // Buffer is partly compacted, length is left as it was
+    CHECK_EQUAL(sizeof(testString) - 1, testMsg.len);
+}
+
+TEST(lwjson, ProjectKeepPaths)
+{
+    const char srcString[] = "{ \"id\" : 7, \"meta\" : {\"a\" : 1, \"b\" : [1, 2]}, \"data\" : [{\"x\":1,\"y\":2}, {\"x\":3}], \"z\" : \"s\" }";
+    const char* idPath[] = {"id", NULL};
+    const char* bPath[] = {"meta", "b", NULL};
+    const char* dataPath[] = {"data", "[1]", NULL};
+    const char* missingPath[] = {"z", "deeper", NULL};
+    const char** paths[] = {idPath, bPath, dataPath, missingPath};
+    const unsigned int STRING_LEN = 64;
+    char string[STRING_LEN];
+    LwJsonMsg srcMsg = {(char*)srcString, sizeof(srcString) - 1};
+    LwJsonMsg dstMsg = {string, STRING_LEN};
+    int result;
+
+    result = lwJsonProject(&srcMsg, paths, 4, LWJSON_PROJECT_KEEP, &dstMsg);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"id\":7,\"meta\":{\"b\":[1, 2]},\"data\":[{\"x\":3}]}", string);
+    CHECK_EQUAL(strlen(string), dstMsg.len);
+}
+
+TEST(lwjson, ProjectKeepOmitsEmptyParents)
+{
+    char testString[] = "{\"a\":{\"x\":2},\"d\":3,\"list\":[{\"b\":1},{\"c\":2},[]],\"e\":{}}";
+    const char* abPath[] = {"a", "b", NULL};
+    const char* listPath[] = {"list", "*", "b", NULL};
+    const char* ePath[] = {"e", NULL};
+    const char** paths[] = {abPath, listPath, ePath};
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    int result;
+
+    // "a" and the items without "b" hold nothing selected. A selected empty object stays
+    result = lwJsonProject(&testMsg, paths, 3, LWJSON_PROJECT_KEEP, &testMsg);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"list\":[{\"b\":1}],\"e\":{}}", testString);
+    CHECK_EQUAL(strlen(testString), testMsg.len);
+
+    // Nothing selected at all leaves the root container
+    strcpy(testString, "{\"a\":{\"x\":2},\"d\":3}");
+    testMsg.len = strlen(testString);
+    result = lwJsonProject(&testMsg, paths, 1, LWJSON_PROJECT_KEEP, &testMsg);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{}", testString);
+}
+
+TEST(lwjson, ProjectDropPathsInPlace)
+{
+    char testString[] = "{ \"id\" : 7, \"meta\" : {\"a\" : 1}, \"data\" : [{\"x\":1,\"y\":2}, {\"x\":3}], \"z\" : \"s\" }";
+    const char* metaPath[] = {"meta", NULL};
+    const char* yPath[] = {"data", "[0]", "y", NULL};
+    const char** paths[] = {metaPath, yPath};
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    int result;
+
+    result = lwJsonProject(&testMsg, paths, 2, LWJSON_PROJECT_DROP, &testMsg);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"id\":7,\"data\":[{\"x\":1},{\"x\":3}],\"z\":\"s\"}", testString);
+    CHECK_EQUAL(strlen(testString), testMsg.len);
+}
+
+TEST(lwjson, ProjectErrors)
+{
+    const char srcString[] = "{\"id\":7,\"name\":\"abc\"}";
+    const char badString[] = "{\"id\":7,\"name\":\"abc}";
+    const char* idPath[] = {"id", NULL};
+    const char* emptyPath[] = {NULL};
+    const char** paths[] = {idPath, emptyPath};
+    const unsigned int STRING_LEN = 9;
+    char string[STRING_LEN];
+    LwJsonMsg srcMsg = {(char*)srcString, sizeof(srcString) - 1};
+    LwJsonMsg badMsg = {(char*)badString, sizeof(badString) - 1};
+    LwJsonMsg dstMsg = {string, STRING_LEN};
+
+    CHECK_EQUAL(-EINVAL, lwJsonProject(&srcMsg, paths, 2, LWJSON_PROJECT_KEEP, &dstMsg));
+    CHECK_EQUAL(-ENOMEM, lwJsonProject(&srcMsg, paths, 1, LWJSON_PROJECT_DROP, &dstMsg));
+    CHECK_EQUAL(-EPERM, lwJsonProject(&badMsg, paths, 1, LWJSON_PROJECT_KEEP, &dstMsg));
+    CHECK_EQUAL(0, lwJsonProject(&srcMsg, paths, 1, LWJSON_PROJECT_KEEP, &dstMsg));
+    STRCMP_EQUAL("{\"id\":7}", string);
+}
+
+TEST(lwjson, RedactPaths)
+{
+    char testString[] = "{\"user\":{\"email\":\"a@b.c\",\"id\":-12.5},\"cards\":[{\"pan\":\"4111\\\"1\",\"cvv\":123},{\"pan\":\"5500\"}],\"token\":[\"ab\",7,true]}";
+    const char* emailPath[] = {"user", "email", NULL};
+    const char* idPath[] = {"user", "id", NULL};
+    const char* panPath[] = {"cards", "*", "pan", NULL};
+    const char* tokenPath[] = {"token", NULL};
+    const char** paths[] = {emailPath, idPath, panPath, tokenPath};
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    int result;
+
+    result = lwJsonRedact(&testMsg, paths, 4, '*');
+    CHECK_EQUAL(6, result);
+    STRCMP_EQUAL("{\"user\":{\"email\":\"*****\",\"id\":0    },\"cards\":[{\"pan\":\"*******\",\"cvv\":123},{\"pan\":\"****\"}],\"token\":[\"**\",0,true]}", testString);
+    CHECK_EQUAL(sizeof(testString) - 1, testMsg.len);
+}
+
+TEST(lwjson, RedactErrors)
+{
+    char testString[] = "{\"token\":\"abc}";
+    const char* tokenPath[] = {"token", NULL};
+    const char** paths[] = {tokenPath};
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+
+    CHECK_EQUAL(-EINVAL, lwJsonRedact(&testMsg, paths, 1, '"'));
+    CHECK_EQUAL(-EINVAL, lwJsonRedact(NULL, paths, 1, '*'));
+    CHECK_EQUAL(-EPERM, lwJsonRedact(&testMsg, paths, 1, '*'));
+}
+
+TEST(lwjson, IndexBuildAndQuery)
+{
+    char testString[] = "{\"object\" : {\"boolean\":true, \"string\":\"testing\"}, \"array\":[{\"addr\":2},{\"addr\":3}], \"integer\":-100, \"empty\":null}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    uint32_t index[128];
+    char* path[] = {NULL, NULL, NULL, NULL};
+    int callResult;
+    int indexLen;
+    int integer;
+    bool boolean;
+    const int STRING_LEN = 9;
+    char string[STRING_LEN + 1];
+    LwJsonMsg obj;
+
+    indexLen = lwJsonIndexBuild(&testMsg, NULL, 0);
+    CHECK(indexLen > 0);
+    CHECK(indexLen <= (int)sizeof(index));
+    callResult = lwJsonIndexBuild(&testMsg, index, sizeof(index));
+    CHECK_EQUAL(indexLen, callResult);
+    callResult = lwJsonIndexCheck(index, indexLen, &testMsg, true);
+    CHECK_EQUAL(0, callResult);
+
+    path[0] = (char*)"object";
+    path[1] = (char*)"boolean";
+    callResult = lwJsonIndexGetBool(index, (const char**)path, &testMsg, &boolean);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(true, boolean);
+
+    path[1] = (char*)"string";
+    callResult = lwJsonIndexGetString(index, (const char**)path, &testMsg, string, STRING_LEN);
+    CHECK_EQUAL(0, callResult);
+    STRCMP_EQUAL("testing", string);
+
+    path[0] = (char*)"array";
+    path[1] = (char*)"[1]";
+    path[2] = (char*)"addr";
+    callResult = lwJsonIndexGetInt(index, (const char**)path, &testMsg, &integer);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(3, integer);
+
+    path[1] = (char*)"[2]";
+    callResult = lwJsonIndexGetInt(index, (const char**)path, &testMsg, &integer);
+    CHECK_EQUAL(-ENOENT, callResult);
+
+    path[1] = NULL;
+    callResult = lwJsonIndexGetArrayLen(index, (const char**)path, &testMsg);
+    CHECK_EQUAL(2, callResult);
+
+    path[0] = (char*)"integer";
+    callResult = lwJsonIndexGetInt(index, (const char**)path, &testMsg, &integer);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(-100, integer);
+
+    path[0] = (char*)"object";
+    callResult = lwJsonIndexGetObject(index, (const char**)path, &testMsg, &obj);
+    CHECK_EQUAL(0, callResult);
+    POINTERS_EQUAL(&testString[12], obj.string);
+    CHECK_EQUAL(36, obj.len);
+
+    path[0] = (char*)"empty";
+    callResult = lwJsonIndexGetInt(index, (const char**)path, &testMsg, &integer);
+    CHECK_EQUAL(-EPERM, callResult);
+}
+
+TEST(lwjson, IndexDuplicateNames)
+{
+    const char *documents[] = {
+        "{\"a\":{\"x\":1},\"a\":{\"b\":2}}",
+        "{\"a\":1,\"a\":{\"b\":3}}",
+        "{\"a\":[1],\"a\":{\"b\":4}}",
+        "{\"a\":{\"b\":5},\"a\":{\"b\":6}}",
+        "{\"c\":{\"b\":7},\"a\":{\"x\":8}}",
+    };
+    const char *path[] = {"a", "b", NULL};
+    char testString[64];
+    LwJsonMsg testMsg;
+    uint32_t index[64];
+    int expectedResult;
+    int expected;
+    int integer;
+    uint32_t i;
+
+    // Same answers as the parser, which restarts at the next member with the same name
+    for (i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+        strcpy(testString, documents[i]);
+        testMsg.string = testString;
+        testMsg.len = strlen(testString);
+        CHECK(lwJsonIndexBuild(&testMsg, index, sizeof(index)) > 0);
+        expected = -1;
+        integer = -1;
+        expectedResult = lwJsonGetInt(path, &testMsg, &expected);
+        CHECK_EQUAL(expectedResult, lwJsonIndexGetInt(index, path, &testMsg, &integer));
+        CHECK_EQUAL(expected, integer);
+    }
+}
+
+TEST(lwjson, ArrayIndexPathElements)
+{
+    char testString[] = "{\"v\":[{\"a\":5},{\"a\":6}]}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    LwJsonSegment segments[] = {{testString, sizeof(testString) - 1}};
+    LwJsonSegmentedMsg segMsg = {segments, 1};
+    const char *elements[] = {"[1]", "[01]", "[00]", "[4294967296]", "[4294967297]", "[]", "[-1]"};
+    const char *path[] = {"v", NULL, "a", NULL};
+    uint32_t index[64];
+    int expectedResult;
+    int integer;
+    uint32_t i;
+
+    CHECK(lwJsonIndexBuild(&testMsg, index, sizeof(index)) > 0);
+
+    // Only "[n]" as lwJsonFind writes it selects an item, overflowing indexes don't wrap
+    for (i = 0; i < sizeof(elements) / sizeof(elements[0]); i++) {
+        path[1] = elements[i];
+        expectedResult = lwJsonGetInt(path, &testMsg, &integer);
+        CHECK_EQUAL((i == 0) ? 0 : -ENOENT, expectedResult);
+        CHECK_EQUAL(expectedResult, lwJsonIndexGetInt(index, path, &testMsg, &integer));
+        CHECK_EQUAL(expectedResult, lwJsonSegGetInt(path, &segMsg, &integer));
+    }
+}
+
+TEST(lwjson, IndexRunsOutOfSpace)
+{
+    char testString[] = "{\"array\":[0,1,2,3,4,5,6,7,8,9]}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    uint32_t index[16];
+    int callResult;
+
+    callResult = lwJsonIndexBuild(&testMsg, index, sizeof(index));
+    CHECK_EQUAL(-ENOMEM, callResult);
+}
+
+TEST(lwjson, IndexRejectsModifiedDocument)
+{
+    char testString[] = "{\"value\":100}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    uint32_t index[32];
+    int indexLen;
+    int callResult;
+
+    indexLen = lwJsonIndexBuild(&testMsg, index, sizeof(index));
+    CHECK(indexLen > 0);
+
+    // Corrupted index
+    index[3]++;
+    callResult = lwJsonIndexCheck(index, indexLen, &testMsg, false);
+    CHECK_EQUAL(-EPERM, callResult);
+    index[3]--;
+
+    // Modified document
+    testString[10] = '2';
+    callResult = lwJsonIndexCheck(index, indexLen, &testMsg, false);
+    CHECK_EQUAL(0, callResult);
+    callResult = lwJsonIndexCheck(index, indexLen, &testMsg, true);
+    CHECK_EQUAL(-EPERM, callResult);
+}
+
+static void TestIndexReseal(uint32_t *index, uint32_t indexLen)
+{
+    const unsigned char *bytes = (const unsigned char*)index;
+    uint32_t checksum = 2166136261u;
+    uint32_t i;
+
+    // FNV-1a of header and entries, with the checksum field set to 0
+    index[6] = 0;
+    for (i = 0; i < indexLen; i++) {
+        checksum ^= bytes[i];
+        checksum *= 16777619u;
+    }
+    index[6] = checksum;
+}
+
+TEST(lwjson, IndexRejectsCraftedEntries)
+{
+    char testString[] = "{\"a\":1,\"b\":2}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    const char* path[] = {"b", NULL};
+    uint32_t index[32];
+    uint32_t saved;
+    int indexLen;
+    int integer;
+
+    indexLen = lwJsonIndexBuild(&testMsg, index, sizeof(index));
+    CHECK(indexLen > 0);
+    CHECK_EQUAL(0, lwJsonIndexGetInt(index, path, &testMsg, &integer));
+    CHECK_EQUAL(2, integer);
+
+    // Name of entry 1 outside the document. Header is 7 words, entries 6 words
+    saved = index[7 + 6];
+    index[7 + 6] = 0xFFFFFF00u;
+    TestIndexReseal(index, indexLen);
+    CHECK_EQUAL(-EPERM, lwJsonIndexCheck(index, indexLen, &testMsg, true));
+    CHECK_EQUAL(-EPERM, lwJsonIndexGetInt(index, path, &testMsg, &integer));
+    index[7 + 6] = saved;
+
+    // Sibling link of entry 1 pointing to itself
+    saved = index[7 + 6 + 3];
+    index[7 + 6 + 3] = 1;
+    TestIndexReseal(index, indexLen);
+    CHECK_EQUAL(-EPERM, lwJsonIndexCheck(index, indexLen, &testMsg, true));
+    CHECK_EQUAL(-EPERM, lwJsonIndexGetInt(index, path, &testMsg, &integer));
+
+    // Sibling link past the last entry
+    index[7 + 6 + 3] = 100;
+    TestIndexReseal(index, indexLen);
+    CHECK_EQUAL(-EPERM, lwJsonIndexCheck(index, indexLen, &testMsg, true));
+    CHECK_EQUAL(-EPERM, lwJsonIndexGetInt(index, path, &testMsg, &integer));
+    index[7 + 6 + 3] = saved;
+
+    TestIndexReseal(index, indexLen);
+    CHECK_EQUAL(0, lwJsonIndexCheck(index, indexLen, &testMsg, true));
+}
+
+TEST(lwjson, IndexMalformedDocument)
+{
+    char testString[] = "{\"array\":[1,2}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    uint32_t index[32];
+    int callResult;
+
+    callResult = lwJsonIndexBuild(&testMsg, index, sizeof(index));
+    CHECK_EQUAL(-EPERM, callResult);
+}
+
+TEST(lwjson, SegmentedParseValues)
+{
+    const char part1[] = "{\"object\":{\"boolean\":tr";
+    const char part2[] = "ue,\"string\":\"test";
+    const char part3[] = "ing\",\"integer\":-1";
+    const char part4[] = "00},\"array\":[{\"addr\":2},{\"addr\":3}]}";
+    LwJsonSegment segments[] = {
+        {part1, sizeof(part1) - 1},
+        {part2, sizeof(part2) - 1},
+        {NULL, 0},
+        {part3, sizeof(part3) - 1},
+        {part4, sizeof(part4) - 1}
+    };
+    LwJsonSegmentedMsg testMsg = {segments, 5};
+    char* path[] = {NULL, NULL, NULL, NULL};
+    int callResult;
+    bool boolean;
+    const int STRING_LEN = 9;
+    char string[STRING_LEN + 1];
+    int integer;
+
+    path[0] = (char*)"object";
+    path[1] = (char*)"boolean";
+    callResult = lwJsonSegGetBool((const char**)path, &testMsg, &boolean);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(true, boolean);
+
+    path[1] = (char*)"string";
+    callResult = lwJsonSegGetString((const char**)path, &testMsg, string, STRING_LEN);
+    CHECK_EQUAL(0, callResult);
+    STRCMP_EQUAL("testing", string);
+
+    path[1] = (char*)"integer";
+    callResult = lwJsonSegGetInt((const char**)path, &testMsg, &integer);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(-100, integer);
+
+    path[0] = (char*)"array";
+    path[1] = (char*)"[1]";
+    path[2] = (char*)"addr";
+    callResult = lwJsonSegGetInt((const char**)path, &testMsg, &integer);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(3, integer);
+
+    path[1] = (char*)"[2]";
+    callResult = lwJsonSegGetInt((const char**)path, &testMsg, &integer);
+    CHECK_EQUAL(-ENOENT, callResult);
+}
+
+TEST(lwjson, SegmentedParseObjectInPlaceOrCopied)
+{
+    const char part1[] = "{\"inner\":{\"value\":1},\"split\":{\"va";
+    const char part2[] = "lue\":2}}";
+    LwJsonSegment segments[] = {
+        {part1, sizeof(part1) - 1},
+        {part2, sizeof(part2) - 1}
+    };
+    LwJsonSegmentedMsg testMsg = {segments, 2};
+    char* path[] = {NULL, NULL};
+    const unsigned int BUFFER_LEN = 16;
+    char buffer[BUFFER_LEN];
+    int callResult;
+    LwJsonMsg obj;
+
+    path[0] = (char*)"inner";
+    callResult = lwJsonSegGetObject((const char**)path, &testMsg, &obj, NULL, 0);
+    CHECK_EQUAL(0, callResult);
+    POINTERS_EQUAL(&part1[9], obj.string);
+    CHECK_EQUAL(11, obj.len);
+
+    path[0] = (char*)"split";
+    callResult = lwJsonSegGetObject((const char**)path, &testMsg, &obj, NULL, 0);
+    CHECK_EQUAL(-ENOMEM, callResult);
+    callResult = lwJsonSegGetObject((const char**)path, &testMsg, &obj, buffer, BUFFER_LEN);
+    CHECK_EQUAL(0, callResult);
+    POINTERS_EQUAL(buffer, obj.string);
+    CHECK_EQUAL(11, obj.len);
+    CHECK(strncmp("{\"value\":2}", obj.string, obj.len) == 0);
+}
+
+TEST(lwjson, SegmentedFailToParseMalFormedMessage)
+{
+    const char part1[] = "{\"value\":";
+    const char part2[] = "100";
+    LwJsonSegment segments[] = {
+        {part1, sizeof(part1) - 1},
+        {part2, sizeof(part2) - 1}
+    };
+    LwJsonSegmentedMsg testMsg = {segments, 2};
+    char* path[] = {NULL, NULL};
+    int callResult;
+    int value;
+
+    path[0] = (char*)"value";
+    callResult = lwJsonSegGetInt((const char**)path, &testMsg, &value);
+    CHECK_EQUAL(-EPERM, callResult);
+}
+
+TEST(lwjson, SegmentedDuplicateNames)
+{
+    const char *documents[] = {
+        "{\"a\":{\"x\":1},\"a\":{\"b\":2}}",
+        "{\"a\":1,\"a\":{\"b\":3}}",
+        "{\"a\":[1],\"a\":{\"b\":4}}",
+        "{\"a\":{\"b\":5},\"a\":{\"b\":6}}",
+        "{\"c\":{\"b\":7},\"a\":{\"x\":8}}",
+    };
+    const char *path[] = {"a", "b", NULL};
+    char testString[64];
+    char ringBuffer[64];
+    LwJsonMsg testMsg;
+    LwJsonSegment segments[2];
+    LwJsonSegmentedMsg segMsg = {segments, 2};
+    LwJsonRing ring;
+    uint32_t len;
+    int expectedResult;
+    int expected;
+    int integer;
+    uint32_t i;
+
+    // Same answers as the contiguous parser, split in two segments and wrapped in a ring
+    for (i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+        len = strlen(documents[i]);
+        segments[0].string = documents[i];
+        segments[0].len = len / 2;
+        segments[1].string = documents[i] + len / 2;
+        segments[1].len = len - len / 2;
+        memcpy(ringBuffer, documents[i] + len - 5, 5);
+        memcpy(ringBuffer + sizeof(ringBuffer) - (len - 5), documents[i], len - 5);
+        ring.base = ringBuffer;
+        ring.capacity = sizeof(ringBuffer);
+        ring.head = sizeof(ringBuffer) - (len - 5);
+        ring.len = len;
+
+        strcpy(testString, documents[i]);
+        testMsg.string = testString;
+        testMsg.len = len;
+        expected = -1;
+        expectedResult = lwJsonGetInt(path, &testMsg, &expected);
+
+        integer = -1;
+        CHECK_EQUAL(expectedResult, lwJsonSegGetInt(path, &segMsg, &integer));
+        CHECK_EQUAL(expected, integer);
+        integer = -1;
+        CHECK_EQUAL(expectedResult, lwJsonRingGetInt(path, &ring, &integer));
+        CHECK_EQUAL(expected, integer);
+    }
+}
+
+TEST(lwjson, RingParseWrappedFrame)
+{
+    // Frame {"value":100,"name":"ring"} starting at offset 20 and wrapping
+    const unsigned int RING_LEN = 32;
+    const char frame[] = "{\"value\":100,\"name\":\"ring\"}";
+    char ringBuffer[RING_LEN];
+    LwJsonRing ring = {ringBuffer, RING_LEN, 20, sizeof(frame) - 1};
+    char* path[] = {NULL, NULL};
+    const int STRING_LEN = 4;
+    char string[STRING_LEN + 1];
+    int callResult;
+    int value;
+    unsigned int i;
+
+    memset(ringBuffer, '#', RING_LEN);
+    for (i = 0; i < ring.len; i++) {
+        ringBuffer[(ring.head + i) % RING_LEN] = frame[i];
+    }
+
+    path[0] = (char*)"value";
+    callResult = lwJsonRingGetInt((const char**)path, &ring, &value);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(100, value);
+
+    path[0] = (char*)"name";
+    callResult = lwJsonRingGetString((const char**)path, &ring, string, STRING_LEN);
+    CHECK_EQUAL(0, callResult);
+    STRCMP_EQUAL("ring", string);
+}
+
+TEST(lwjson, RingParseInvalidDescriptor)
+{
+    const unsigned int RING_LEN = 16;
+    char ringBuffer[RING_LEN] = "{\"value\":100}";
+    LwJsonRing ring = {ringBuffer, RING_LEN, RING_LEN, 13};
+    char* path[] = {NULL, NULL};
+    int callResult;
+    int value;
+
+    path[0] = (char*)"value";
+    callResult = lwJsonRingGetInt((const char**)path, &ring, &value);
+    CHECK_EQUAL(-EINVAL, callResult);
+
+    ring.head = 0;
+    callResult = lwJsonRingGetInt((const char**)path, &ring, &value);
+    CHECK_EQUAL(0, callResult);
+    CHECK_EQUAL(100, value);
+}
+
+TEST(lwjson, GenerateIntegerLimits)
+{
+    const unsigned int STRING_LEN = 50;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+    lwJsonAddIntToArray(&testMsg, INT64_MIN);
+    lwJsonAddIntToArray(&testMsg, INT64_MAX);
+    lwJsonAddIntToArray(&testMsg, 0);
+    lwJsonAddIntToArray(&testMsg, 10);
+    lwJsonCloseArray(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("[-9223372036854775808,9223372036854775807,0,10]", string);
+}
+
+TEST(lwjson, GenerateDouble)
+{
+    const unsigned int STRING_LEN = 70;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddDoubleToObject(&testMsg, "value", 0.1);
+    lwJsonAddArrayToObject(&testMsg, "array");
+    lwJsonAddDoubleToArray(&testMsg, -1.5);
+    lwJsonAddDoubleToArray(&testMsg, 100);
+    lwJsonAddDoubleToArray(&testMsg, 1e-7);
+    lwJsonAddDoubleToArray(&testMsg, 1.7976931348623157e308);
+    lwJsonCloseArray(&testMsg);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"value\":0.1,\"array\":[-1.5,100,1e-7,1.7976931348623157e308]}", string);
+}
+
+TEST(lwjson, GenerateDoubleRunsOutOfSpace)
+{
+    const unsigned int STRING_LEN = 23;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddDoubleToObject(&testMsg, "value", 3.14159265358979);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(-ENOMEM, result);
+}
+
+TEST(lwjson, GenerateEscapedString)
+{
+    const unsigned int STRING_LEN = 90;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddStringToObject(&testMsg, "text", "say \"hi\"\n");
+    lwJsonAddStringToObject(&testMsg, "path", "C:\\tmp\\a long clean tail");
+    lwJsonAddStringToObject(&testMsg, "ctl", "\x01\t");
+    lwJsonAddBooleanToObject(&testMsg, "a\"b", true);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"text\":\"say \\\"hi\\\"\\n\",\"path\":\"C:\\\\tmp\\\\a long clean tail\","
+                 "\"ctl\":\"\\u0001\\t\",\"a\\\"b\":true}", string);
+}
+
+TEST(lwjson, GenerateEscapedStringRunsOutOfSpace)
+{
+    const unsigned int STRING_LEN = 10;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    // Raw value fits but escaped value does not
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+    result = lwJsonAddStringToArray(&testMsg, "\"\"\"\"");
+
+    CHECK_EQUAL(-ENOMEM, result);
+}
+
+TEST(lwjson, GenerateInvalidUtf8Rejected)
+{
+    const unsigned int STRING_LEN = 40;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+    lwJsonAddStringToArray(&testMsg, "caf\xC3\xA9");
+    result = lwJsonAddStringToArray(&testMsg, "bad\xC3(");
+    CHECK_EQUAL(-EINVAL, result);
+    result = lwJsonAddStringToArray(&testMsg, "\xED\xA0\x80");
+    CHECK_EQUAL(-EINVAL, result);
+    lwJsonCloseArray(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(-EINVAL, result);
+}
+
+TEST(lwjson, GenerateInvalidUtf8Replaced)
+{
+    const unsigned int STRING_LEN = 40;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetUtf8Policy(&testMsg, LWJSON_UTF8_REPLACE);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddStringToObject(&testMsg, "a", "caf\xC3\xA9\xFF\"x\xE2\x82");
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"a\":\"caf\xC3\xA9\xEF\xBF\xBD\\\"x\xEF\xBF\xBD\xEF\xBF\xBD\"}", string);
+}
+
+TEST(lwjson, GenerateTrustedUtf8)
+{
+    const unsigned int STRING_LEN = 40;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    // Trusted input is copied without validation
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetUtf8Policy(&testMsg, LWJSON_UTF8_TRUSTED);
+    lwJsonStartArray(&testMsg);
+    lwJsonAddStringToArray(&testMsg, "\xFF\xFE\n");
+    lwJsonCloseArray(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("[\"\xFF\xFE\\n\"]", string);
+}
+
+TEST(lwjson, GenerateFixedDouble)
+{
+    const unsigned int STRING_LEN = 44;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddFixedDoubleToObject(&testMsg, "temp", 21.456, 2);
+    lwJsonAddArrayToObject(&testMsg, "array");
+    lwJsonAddFixedDoubleToArray(&testMsg, -0.004, 2);
+    lwJsonAddFixedDoubleToArray(&testMsg, -2.5, 3);
+    lwJsonAddFixedDoubleToArray(&testMsg, 3.2, 0);
+    lwJsonAddFixedDoubleToArray(&testMsg, 1e30, 2);
+    lwJsonCloseArray(&testMsg);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"temp\":21.46,\"array\":[0.00,-2.500,3,1e30]}", string);
+}
+
+typedef struct {
+    char data[512];
+    uint32_t len;
+    uint32_t calls;
+    int result;
+} TestFlushSink;
+
+static int TestFlush(void *context, const char *data, uint32_t len)
+{
+    TestFlushSink *sink = (TestFlushSink*)context;
+
+    if (sink->result != 0) {
+        return sink->result;
+    }
+    if (sink->len + len >= sizeof(sink->data)) {
+        return -ENOSPC;
+    }
+
+    memcpy(&sink->data[sink->len], data, len);
+    sink->len += len;
+    sink->data[sink->len] = 0;
+    sink->calls++;
+    return 0;
+}
+
+TEST(lwjson, GenerateWithFlush)
+{
+    const unsigned int STRING_LEN = 32;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    TestFlushSink sink = {{0}, 0, 0, 0};
+    int result;
+    int i;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetFlush(&testMsg, TestFlush, &sink);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddArrayToObject(&testMsg, "values");
+    for (i = 0; i < 20; i++) {
+        lwJsonAddIntToArray(&testMsg, i * 1000);
+    }
+    lwJsonCloseArray(&testMsg);
+    // Longer than the whole buffer
+    lwJsonAddStringToObject(&testMsg, "text", "a \"quoted\" \x01 string longer than the buffer caf\xC3\xA9");
+    lwJsonAppendObject(&testMsg, "obj", "{\"a\":1}");
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    CHECK(sink.calls > 1);
+    STRCMP_EQUAL("{\"values\":[0,1000,2000,3000,4000,5000,6000,7000,8000,9000,10000,11000,12000,"
+                 "13000,14000,15000,16000,17000,18000,19000],"
+                 "\"text\":\"a \\\"quoted\\\" \\u0001 string longer than the buffer caf\xC3\xA9\","
+                 "\"obj\":{\"a\":1}}", sink.data);
+}
+
+TEST(lwjson, GenerateWithFlushError)
+{
+    const unsigned int STRING_LEN = 32;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    TestFlushSink sink = {{0}, 0, 0, -EIO};
+    int result;
+    int i;
+
+    lwJsonWriteStart(&testMsg);
+    result = lwJsonWriteSetFlush(&testMsg, TestFlush, &sink);
+    CHECK_EQUAL(0, result);
+    lwJsonStartArray(&testMsg);
+    for (i = 0; i < 20; i++) {
+        lwJsonAddIntToArray(&testMsg, i);
+    }
+    lwJsonCloseArray(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(-EIO, result);
+    CHECK_EQUAL(0, sink.len);
+}
+
+TEST(lwjson, GenerateWithFlushSmallBuffer)
+{
+    const unsigned int STRING_LEN = 16;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    TestFlushSink sink = {{0}, 0, 0, 0};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    result = lwJsonWriteSetFlush(&testMsg, TestFlush, &sink);
+
+    CHECK_EQUAL(-EINVAL, result);
+}
+
+static void *TestRealloc(void *context, void *ptr, uint32_t oldLen, uint32_t newLen)
+{
+    (void)oldLen;
+    (*(int*)context)++;
+    return realloc(ptr, newLen);
+}
+
+typedef struct {
+    char data[256];
+    uint32_t used;
+} TestArena;
+
+static void *TestArenaRealloc(void *context, void *ptr, uint32_t oldLen, uint32_t newLen)
+{
+    TestArena *arena = (TestArena*)context;
+    char *block;
+
+    if (arena->used + newLen > sizeof(arena->data)) {
+        return NULL;
+    }
+
+    block = &arena->data[arena->used];
+    arena->used += newLen;
+    if (oldLen > 0) {
+        memcpy(block, ptr, oldLen);
+    }
+    return block;
+}
+
+TEST(lwjson, GenerateGrowable)
+{
+    LwJsonMsg testMsg = {(char*)malloc(1), 0};
+    char string[512];
+    int grows = 0;
+    int result;
+    int i;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetAllocator(&testMsg, TestRealloc, &grows);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddStringToObject(&testMsg, "name", "growable");
+    lwJsonAddArrayToObject(&testMsg, "values");
+    for (i = 0; i < 100; i++) {
+        lwJsonAddIntToArray(&testMsg, i);
+    }
+    lwJsonCloseArray(&testMsg);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+    strncpy(string, testMsg.string, sizeof(string));
+    free(testMsg.string);
+
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(4, grows);
+    CHECK_EQUAL(512, testMsg.len);
+    CHECK_EQUAL(0, strncmp("{\"name\":\"growable\",\"values\":[0,1,2,", string, 34));
+    STRCMP_EQUAL("97,98,99]}", string + strlen(string) - 10);
+}
+
+TEST(lwjson, GenerateGrowableFromEmpty)
+{
+    LwJsonMsg testMsg = {NULL, 0};
+    LwJsonMsg emptyMsg = {NULL, 0};
+    int grows = 0;
+
+    // The allocator provides the first buffer
+    CHECK_EQUAL(0, lwJsonWriteStart(&testMsg));
+    lwJsonWriteSetAllocator(&testMsg, TestRealloc, &grows);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddStringToObject(&testMsg, "name", "empty start");
+    lwJsonCloseObject(&testMsg);
+    CHECK_EQUAL(0, lwJsonWriteEnd(&testMsg));
+    CHECK_EQUAL(1, grows);
+    CHECK_EQUAL(64, testMsg.len);
+    STRCMP_EQUAL("{\"name\":\"empty start\"}", testMsg.string);
+    free(testMsg.string);
+
+    // Nothing written, the terminator still gets a buffer
+    CHECK_EQUAL(0, lwJsonWriteStart(&emptyMsg));
+    lwJsonWriteSetAllocator(&emptyMsg, TestRealloc, &grows);
+    CHECK_EQUAL(0, lwJsonWriteEnd(&emptyMsg));
+    STRCMP_EQUAL("", emptyMsg.string);
+    free(emptyMsg.string);
+
+    // Without allocator there is nowhere to write
+    emptyMsg.string = NULL;
+    emptyMsg.len = 0;
+    CHECK_EQUAL(0, lwJsonWriteStart(&emptyMsg));
+    CHECK_EQUAL(-ENOMEM, lwJsonStartObject(&emptyMsg));
+    CHECK_EQUAL(-EINVAL, lwJsonWriteEnd(&emptyMsg));
+    emptyMsg.len = 8;
+    CHECK_EQUAL(-EINVAL, lwJsonWriteStart(&emptyMsg));
+}
+
+TEST(lwjson, GenerateGrowableArenaExhausted)
+{
+    TestArena arena = {{0}, 0};
+    LwJsonMsg testMsg = {(char*)TestArenaRealloc(&arena, NULL, 0, 1), 0};
+    int result = 0;
+    int i;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetAllocator(&testMsg, TestArenaRealloc, &arena);
+    lwJsonStartArray(&testMsg);
+    for (i = 0; i < 100 && result == 0; i++) {
+        result = lwJsonAddStringToArray(&testMsg, "arena");
+    }
+    result = lwJsonWriteEnd(&testMsg);
+
+    // 1 + 65 + 129 bytes fit in the arena, 257 do not
+    CHECK_EQUAL(-ENOMEM, result);
+    CHECK_EQUAL(195, arena.used);
+    CHECK_EQUAL(128, testMsg.len);
+}
+
+TEST(lwjson, GenerateWithKeys)
+{
+    static const LwJsonKey keyTemp = LWJSON_KEY("temp");
+    static const LwJsonKey keyOn = LWJSON_KEY("on");
+    static const LwJsonKey keyList = LWJSON_KEY("list");
+    const unsigned int STRING_LEN = 80;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    char keyBuffer[16];
+    LwJsonKey keyName;
+    int result;
+
+    result = lwJsonKeyInit(&keyName, "na\"me", keyBuffer, sizeof(keyBuffer));
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(9, keyName.len);
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddFixedDoubleToObjectKey(&testMsg, &keyTemp, 21.5, 1);
+    lwJsonAddBooleanToObjectKey(&testMsg, &keyOn, true);
+    lwJsonAddStringToObjectKey(&testMsg, &keyName, "x");
+    lwJsonAddArrayToObjectKey(&testMsg, &keyList);
+    lwJsonAddIntToArray(&testMsg, 1);
+    lwJsonCloseArray(&testMsg);
+    lwJsonAddNullToObjectKey(&testMsg, &keyOn);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"temp\":21.5,\"on\":true,\"na\\\"me\":\"x\",\"list\":[1],\"on\":null}", string);
+}
+
+TEST(lwjson, GenerateKeyInitErrors)
+{
+    char keyBuffer[8];
+    LwJsonKey key;
+    int result;
+
+    result = lwJsonKeyInit(&key, "toolong", keyBuffer, sizeof(keyBuffer));
+    CHECK_EQUAL(-ENOMEM, result);
+    result = lwJsonKeyInit(&key, "\xC3(", keyBuffer, sizeof(keyBuffer));
+    CHECK_EQUAL(-EINVAL, result);
+    result = lwJsonKeyInit(&key, NULL, keyBuffer, sizeof(keyBuffer));
+    CHECK_EQUAL(-EINVAL, result);
+}
+
+TEST(lwjson, GenerateBulkArrays)
+{
+    const unsigned int STRING_LEN = 120;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    const int64_t ints[] = {0, -1, 42, INT64_MIN};
+    const double doubles[] = {0.5, -2};
+    const bool bools[] = {true, false};
+    const char *strings[] = {"a", "b\"c"};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddIntArray(&testMsg, "ints", ints, 4);
+    lwJsonAddDoubleArray(&testMsg, "doubles", doubles, 2);
+    lwJsonAddArrayToObject(&testMsg, "nested");
+    lwJsonAddBooleanArray(&testMsg, NULL, bools, 2);
+    lwJsonAddStringArray(&testMsg, NULL, strings, 2);
+    lwJsonAddIntArray(&testMsg, NULL, NULL, 0);
+    lwJsonCloseArray(&testMsg);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"ints\":[0,-1,42,-9223372036854775808],\"doubles\":[0.5,-2],"
+                 "\"nested\":[[true,false],[\"a\",\"b\\\"c\"],[]]}", string);
+}
+
+TEST(lwjson, GenerateBulkArrayRunsOutOfSpace)
+{
+    const unsigned int STRING_LEN = 12;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    const int64_t ints[] = {100, 200, 300};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+    result = lwJsonAddIntArray(&testMsg, NULL, ints, 3);
+
+    CHECK_EQUAL(-ENOMEM, result);
+}
+
+TEST(lwjson, GenerateBulkArrayWithFlush)
+{
+    const unsigned int STRING_LEN = 32;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    TestFlushSink sink = {{0}, 0, 0, 0};
+    int64_t ints[40];
+    double doubles[10];
+    char expected[512];
+    uint32_t len;
+    int result;
+    int i;
+
+    len = sprintf(expected, "{\"ints\":[");
+    for (i = 0; i < 40; i++) {
+        ints[i] = i * 3;
+        len += sprintf(expected + len, "%s%d", (i > 0) ? "," : "", i * 3);
+    }
+    len += sprintf(expected + len, "],\"doubles\":[");
+    for (i = 0; i < 10; i++) {
+        doubles[i] = i + 0.25;
+        len += sprintf(expected + len, "%s%d.25", (i > 0) ? "," : "", i);
+    }
+    sprintf(expected + len, "]}");
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetFlush(&testMsg, TestFlush, &sink);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddIntArray(&testMsg, "ints", ints, 40);
+    lwJsonAddDoubleArray(&testMsg, "doubles", doubles, 10);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL(expected, sink.data);
+}
+
+struct TestPoint {
+    int x;
+    int y;
+    char label[8];
+};
+LWJSON_FIELDS(TestPoint, x, y, label)
+
+struct TestShape {
+    TestPoint points[2];
+    bool closed;
+    double area;
+    std::array<uint8_t, 3> rgb;
+    std::string name;
+};
+LWJSON_FIELDS(TestShape, points, closed, area, rgb, name)
+
+TEST(lwjson, GenerateCppFields)
+{
+    TestShape shape = {{{1, -2, "a\"b"}, {3, 4, "c"}}, true, 1.5, {{255, 0, 7}}, "tri"};
+    char string[140];
+    int result;
+
+    result = lwjson::serialize(shape, string, sizeof(string) - 1);
+
+    CHECK_EQUAL((int)strlen(string), result);
+    CHECK_EQUAL(result, lwjson::measure(shape));
+    STRCMP_EQUAL("{\"points\":[{\"x\":1,\"y\":-2,\"label\":\"a\\\"b\"},{\"x\":3,\"y\":4,\"label\":\"c\"}],"
+                 "\"closed\":true,\"area\":1.5,\"rgb\":[255,0,7],\"name\":\"tri\"}", string);
+}
+
+TEST(lwjson, GenerateCppMaxSize)
+{
+    // Braces, keys with values and separators
+    constexpr std::size_t expected = 2 + (4 + 11) + (4 + 11) + (8 + 44) + 2;
+    TestPoint point = {INT32_MIN, INT32_MIN, "\x01\x01\x01\x01\x01\x01\x01"};
+    lwjson::Buffer<TestPoint> buffer;
+    int result;
+
+    CHECK_EQUAL(expected, lwjson::maxSize<TestPoint>());
+    CHECK_EQUAL(expected + 1, buffer.size());
+
+    result = lwjson::serialize(point, buffer);
+    CHECK_EQUAL((int)expected, result);
+    result = lwjson::serialize(point, buffer.data(), expected - 1);
+    CHECK_EQUAL(-ENOMEM, result);
+}
+
+struct TestNumbers {
+    uint64_t count;
+    float ratio;
+    float samples[3];
+};
+LWJSON_FIELDS(TestNumbers, count, ratio, samples)
+
+TEST(lwjson, GenerateCppNumbers)
+{
+    TestNumbers numbers = {INT64_MAX, 0.1f, {1.5f, -3.3f, 1e-45f}};
+    char string[100];
+    int result;
+
+    // Floats get their own shortest digits, not those of the widened double
+    result = lwjson::serialize(numbers, string, sizeof(string) - 1);
+    CHECK_EQUAL((int)strlen(string), result);
+    STRCMP_EQUAL("{\"count\":9223372036854775807,\"ratio\":0.1,\"samples\":[1.5,-3.3,1e-45]}", string);
+
+    // Unsigned values past INT64_MAX can't be written
+    numbers.count = UINT64_MAX;
+    CHECK_EQUAL(-ERANGE, lwjson::serialize(numbers, string, sizeof(string) - 1));
+    CHECK_EQUAL(-ERANGE, lwjson::measure(numbers));
+}
+
+TEST(lwjson, GenerateFloat)
+{
+    const unsigned int STRING_LEN = 64;
+    char string[STRING_LEN];
+    LwJsonMsg testMsg = {string, STRING_LEN - 1};
+    uint32_t bits;
+    uint32_t i;
+    float value;
+    float parsed;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddFloatToObject(&testMsg, "a", 0.3f);
+    lwJsonAddFloatToObject(&testMsg, "b", 3.4028235e38f);
+    lwJsonAddFloatToObject(&testMsg, "c", 16777216.0f);
+    lwJsonCloseObject(&testMsg);
+    CHECK_EQUAL(0, lwJsonWriteEnd(&testMsg));
+    STRCMP_EQUAL("{\"a\":0.3,\"b\":3.4028235e38,\"c\":16777216}", string);
+
+    // Every written float parses back to the same value
+    for (i = 0; i < 20000; i++) {
+        bits = i * 214741u + 12345u;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value - value != 0) {
+            continue;
+        }
+        lwJsonWriteStart(&testMsg);
+        lwJsonStartArray(&testMsg);
+        lwJsonAddFloatToArray(&testMsg, value);
+        lwJsonCloseArray(&testMsg);
+        CHECK_EQUAL(0, lwJsonWriteEnd(&testMsg));
+        parsed = strtof(&string[1], NULL);
+        CHECK_EQUAL(0, memcmp(&value, &parsed, sizeof(value)));
+    }
+}
+
+TEST(lwjson, GenerateTemplate)
+{
+    const unsigned int STRING_LEN = 100;
+    char string[STRING_LEN + 1];
+    char compact[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonMsg compactMsg = {compact, STRING_LEN};
+    LwJsonSlot slots[4];
+    LwJsonTemplate tpl;
+    int slotTemp;
+    int slotId;
+    int slotOn;
+    int slotSamples;
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonTemplateStart(&tpl, &testMsg, slots, 4);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddStringToObject(&testMsg, "type", "telemetry");
+    slotTemp = lwJsonAddFixedDoubleSlotToObject(&tpl, "temp", 7, 2);
+    slotId = lwJsonAddStringSlotToObject(&tpl, "id", 8);
+    slotOn = lwJsonAddBooleanSlotToObject(&tpl, "on");
+    lwJsonAddArrayToObject(&testMsg, "samples");
+    slotSamples = lwJsonAddIntSlotToArray(&tpl, 6);
+    lwJsonCloseArray(&testMsg);
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(3, slotSamples);
+    STRCMP_EQUAL("{\"type\":\"telemetry\",\"temp\":0.00   ,\"id\":\"\"      ,\"on\":false,\"samples\":[0     ]}", string);
+
+    // Each message only patches the values
+    CHECK_EQUAL(0, lwJsonTemplateSetDouble(&tpl, slotTemp, -21.456));
+    CHECK_EQUAL(0, lwJsonTemplateSetString(&tpl, slotId, "a\"b"));
+    CHECK_EQUAL(0, lwJsonTemplateSetBoolean(&tpl, slotOn, true));
+    CHECK_EQUAL(0, lwJsonTemplateSetInt(&tpl, slotSamples, -12345));
+    STRCMP_EQUAL("{\"type\":\"telemetry\",\"temp\":-21.46 ,\"id\":\"a\\\"b\"  ,\"on\":true ,\"samples\":[-12345]}", string);
+
+    CHECK_EQUAL(0, lwJsonTemplateSetNull(&tpl, slotTemp));
+    result = lwJsonTemplateCompact(&tpl, &compactMsg);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"type\":\"telemetry\",\"temp\":null,\"id\":\"a\\\"b\",\"on\":true,\"samples\":[-12345]}", compact);
+}
+
+TEST(lwjson, GenerateTemplateSlotErrors)
+{
+    const unsigned int STRING_LEN = 60;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonSlot slots[2];
+    LwJsonTemplate tpl;
+    int slotInt;
+    int slotString;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonTemplateStart(&tpl, &testMsg, slots, 2);
+    lwJsonStartArray(&testMsg);
+    slotInt = lwJsonAddIntSlotToArray(&tpl, 3);
+    slotString = lwJsonAddStringSlotToArray(&tpl, 4);
+    CHECK_EQUAL(-ENOMEM, lwJsonAddIntSlotToArray(&tpl, 3));
+    lwJsonCloseArray(&testMsg);
+    lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(-ENOMEM, lwJsonTemplateSetInt(&tpl, slotInt, 1000));
+    CHECK_EQUAL(-EINVAL, lwJsonTemplateSetString(&tpl, slotInt, "x"));
+    CHECK_EQUAL(-ENOMEM, lwJsonTemplateSetString(&tpl, slotString, "\n\n"));
+    CHECK_EQUAL(-EINVAL, lwJsonTemplateSetInt(&tpl, 2, 1));
+    STRCMP_EQUAL("[0  ,\"\"  ]", string);
+}
+
+TEST(lwjson, GenerateAutoClose)
+{
+    const unsigned int STRING_LEN = 60;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAppendObject(&testMsg, "raw", "{\"a\":[1]}");
+    lwJsonAddArrayToObject(&testMsg, "list");
+    lwJsonAddObjectToArray(&testMsg);
+    lwJsonAddIntToObject(&testMsg, "x", 1);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"raw\":{\"a\":[1]},\"list\":[{\"x\":1}]}", string);
+}
+
+TEST(lwjson, GenerateUnbalanced)
+{
+    const unsigned int STRING_LEN = 60;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    result = lwJsonAddIntToArray(&testMsg, 1);
+    CHECK_EQUAL(-EPERM, result);
+    result = lwJsonCloseArray(&testMsg);
+    CHECK_EQUAL(-EPERM, result);
+    result = lwJsonWriteEnd(&testMsg);
+    CHECK_EQUAL(-EPERM, result);
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+    result = lwJsonAddIntToObject(&testMsg, "a", 1);
+    CHECK_EQUAL(-EPERM, result);
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+    lwJsonCloseArray(&testMsg);
+    result = lwJsonCloseArray(&testMsg);
+    CHECK_EQUAL(-EPERM, result);
+}
+
+TEST(lwjson, GenerateDepthLimit)
+{
+    const unsigned int STRING_LEN = 60;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    int result = 0;
+    int i;
+
+    lwJsonWriteStart(&testMsg);
+    for (i = 0; i < LWJSON_WRITE_DEPTH_MAX && result == 0; i++) {
+        result = lwJsonStartArray(&testMsg);
+    }
+    CHECK_EQUAL(0, result);
+    result = lwJsonStartArray(&testMsg);
+    CHECK_EQUAL(-EPERM, result);
+}
+
+static uint32_t TestJoinSegments(const LwJsonSegmentList *list, char *output)
+{
+    uint32_t len = 0;
+    uint32_t i;
+
+    for (i = 0; i < list->count; i++) {
+        memcpy(output + len, list->segments[i].string, list->segments[i].len);
+        len += list->segments[i].len;
+    }
+    output[len] = 0;
+    return len;
+}
+
+TEST(lwjson, GenerateSegments)
+{
+    const unsigned int STRING_LEN = 72;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonSegment segments[8];
+    LwJsonSegmentList list = {segments, 0, 8};
+    const char *blob = "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVo=";
+    char output[128];
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetSegments(&testMsg, &list, 16);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddStringToObject(&testMsg, "blob", blob);
+    lwJsonAddStringToObject(&testMsg, "short", "abc");
+    lwJsonAddStringToObject(&testMsg, "log", "line with \"quotes\" gets copied");
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(3, list.count);
+    POINTERS_EQUAL(blob, segments[1].string);
+    TestJoinSegments(&list, output);
+    STRCMP_EQUAL("{\"blob\":\"QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVo=\",\"short\":\"abc\","
+                 "\"log\":\"line with \\\"quotes\\\" gets copied\"}", output);
+}
+
+TEST(lwjson, GenerateSegmentsNoTemplate)
+{
+    const unsigned int STRING_LEN = 72;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonSegment segments[4];
+    LwJsonSegmentList list = {segments, 0, 4};
+    LwJsonSlot slots[1];
+    LwJsonTemplate tpl;
+
+    // Long strings would land in the segment list, out of reach of the slots
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetSegments(&testMsg, &list, 4);
+    CHECK_EQUAL(-EPERM, lwJsonTemplateStart(&tpl, &testMsg, slots, 1));
+}
+
+TEST(lwjson, GenerateSegmentsListFull)
+{
+    const unsigned int STRING_LEN = 80;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonSegment segments[4];
+    LwJsonSegmentList list = {segments, 0, 4};
+    char output[128];
+    int result;
+
+    // Strings are copied once the list has no room for more references
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetSegments(&testMsg, &list, 1);
+    lwJsonStartArray(&testMsg);
+    lwJsonAddStringToArray(&testMsg, "first");
+    lwJsonAddStringToArray(&testMsg, "second");
+    lwJsonAddStringToArray(&testMsg, "third");
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(3, list.count);
+    TestJoinSegments(&list, output);
+    STRCMP_EQUAL("[\"first\",\"second\",\"third\"]", output);
+    CHECK_EQUAL(-EPERM, lwJsonWriteSetFlush(&testMsg, TestFlush, NULL));
+}
+
+TEST(lwjson, GenerateStitchedChunks)
+{
+    const unsigned int STRING_LEN = 80;
+    char string[STRING_LEN + 1];
+    char chunkStrings[3][64];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonMsg chunks[3];
+    int result;
+    int i;
+    int j;
+
+    // Each chunk is independent and could be written by its own thread
+    for (i = 0; i < 3; i++) {
+        chunks[i].string = chunkStrings[i];
+        chunks[i].len = sizeof(chunkStrings[i]) - 1;
+        lwJsonChunkStart(&chunks[i]);
+        for (j = 0; j < i * 2; j++) {
+            lwJsonAddObjectToArray(&chunks[i]);
+            lwJsonAddIntToObject(&chunks[i], "id", i * 10 + j);
+            lwJsonCloseObject(&chunks[i]);
+        }
+        result = lwJsonChunkEnd(&chunks[i]);
+        CHECK_EQUAL(0, result);
+    }
+    STRCMP_EQUAL("", chunkStrings[0]);
+    STRCMP_EQUAL("{\"id\":10},{\"id\":11}", chunkStrings[1]);
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddArrayToObject(&testMsg, "items");
+    lwJsonAddIntToArray(&testMsg, 0);
+    lwJsonStitchChunks(&testMsg, chunks, 3);
+    lwJsonAddIntToArray(&testMsg, 1);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("{\"items\":[0,{\"id\":10},{\"id\":11},{\"id\":20},{\"id\":21},{\"id\":22},{\"id\":23},1]}", string);
+}
+
+TEST(lwjson, GenerateStitchedChunksErrors)
+{
+    const unsigned int STRING_LEN = 40;
+    char string[STRING_LEN + 1];
+    char chunkString[8];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonMsg chunk = {chunkString, sizeof(chunkString) - 1};
+    int result;
+
+    lwJsonChunkStart(&chunk);
+    lwJsonAddStringToArray(&chunk, "too long");
+    result = lwJsonChunkEnd(&chunk);
+    CHECK_EQUAL(-ENOMEM, result);
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+    result = lwJsonStitchChunks(&testMsg, &chunk, 1);
+    CHECK_EQUAL(-ENOMEM, result);
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartObject(&testMsg);
+    lwJsonChunkStart(&chunk);
+    result = lwJsonStitchChunks(&testMsg, &chunk, 1);
+    CHECK_EQUAL(-EPERM, result);
+}
+
+static int TestWriteMeasured(LwJsonMsg *msg)
+{
+    static const int64_t ints[] = {-1, 20, INT64_MIN};
+    static const double doubles[] = {0.1, -2.5e-300};
+    static const bool booleans[] = {true, false};
+    static const char *const strings[] = {"", "tab\t", "\xC3\xA9"};
+    LwJsonKey key = LWJSON_KEY("key");
+
+    lwJsonWriteSetUtf8Policy(msg, LWJSON_UTF8_REPLACE);
+    lwJsonStartObject(msg);
+    lwJsonAddStringToObject(msg, "na\"me", "line\nbad\xFF");
+    lwJsonAddIntToObjectKey(msg, &key, 123456789);
+    lwJsonAddDoubleToObject(msg, "double", 3.14159);
+    lwJsonAddFixedDoubleToObject(msg, "fixed", -0.5, 3);
+    lwJsonAddArrayToObject(msg, "array");
+    lwJsonAddBooleanToArray(msg, false);
+    lwJsonAddNullToArray(msg);
+    lwJsonAddObjectToArray(msg);
+    lwJsonCloseObject(msg);
+    lwJsonCloseArray(msg);
+    lwJsonAddIntArray(msg, "ints", ints, 3);
+    lwJsonAddDoubleArray(msg, "doubles", doubles, 2);
+    lwJsonAddBooleanArray(msg, "booleans", booleans, 2);
+    lwJsonAddStringArray(msg, "strings", strings, 3);
+    lwJsonAddIntArray(msg, "empty", ints, 0);
+    lwJsonAppendObject(msg, "raw", "{\"a\":1}");
+    lwJsonAddObjectToObject(msg, "open");
+
+    // Containers left open are closed by the end call
+    return msg->_lastError;
+}
+
+TEST(lwjson, GenerateMeasure)
+{
+    const unsigned int STRING_LEN = 300;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonMsg measureMsg = {};
+    uint32_t len = 0;
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    TestWriteMeasured(&testMsg);
+    result = lwJsonWriteEnd(&testMsg);
+    CHECK_EQUAL(0, result);
+
+    lwJsonMeasureStart(&measureMsg);
+    TestWriteMeasured(&measureMsg);
+    result = lwJsonMeasureEnd(&measureMsg, &len);
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(strlen(string), len);
+    POINTERS_EQUAL(NULL, measureMsg.string);
+}
+
+TEST(lwjson, GenerateMeasureErrors)
+{
+    char string[8];
+    LwJsonSegment segments[4];
+    LwJsonSegmentList list = {segments, 0, 4};
+    LwJsonMsg measureMsg = {};
+    LwJsonMsg testMsg = {string, sizeof(string) - 1};
+    uint32_t len = 0;
+    int result;
+
+    lwJsonMeasureStart(&measureMsg);
+    CHECK_EQUAL(-EPERM, lwJsonWriteSetFlush(&measureMsg, TestFlush, NULL));
+    CHECK_EQUAL(-EPERM, lwJsonWriteSetAllocator(&measureMsg, TestRealloc, NULL));
+    CHECK_EQUAL(-EPERM, lwJsonWriteSetSegments(&measureMsg, &list, 0));
+
+    // Invalid input fails as in a real write
+    lwJsonStartArray(&measureMsg);
+    result = lwJsonAddStringToArray(&measureMsg, "bad\xFF");
+    CHECK_EQUAL(-EINVAL, result);
+    result = lwJsonMeasureEnd(&measureMsg, &len);
+    CHECK_EQUAL(-EINVAL, result);
+
+    lwJsonMeasureStart(&measureMsg);
+    result = lwJsonCloseObject(&measureMsg);
+    CHECK_EQUAL(-EPERM, result);
+
+    // Only measuring messages have a length to report
+    lwJsonWriteStart(&testMsg);
+    result = lwJsonMeasureEnd(&testMsg, &len);
+    CHECK_EQUAL(-EINVAL, result);
+}
+
+TEST(lwjson, GenerateRollback)
+{
+    const unsigned int STRING_LEN = 40;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonWriteMark mark;
+    int records = 0;
+    int result;
+    int i;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+
+    // Pack whole records while they fit, drop the one that does not
+    for (i = 0; i < 10; i++) {
+        lwJsonWriteMark(&testMsg, &mark);
+        lwJsonAddObjectToArray(&testMsg);
+        lwJsonAddIntToObject(&testMsg, "id", i);
+        lwJsonAddBooleanToObject(&testMsg, "ok", true);
+        result = lwJsonCloseObject(&testMsg);
+        if (result != 0) {
+            CHECK_EQUAL(-ENOMEM, result);
+            result = lwJsonWriteRollback(&testMsg, &mark);
+            CHECK_EQUAL(0, result);
+            break;
+        }
+        records++;
+    }
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(2, records);
+    STRCMP_EQUAL("[{\"id\":0,\"ok\":true},{\"id\":1,\"ok\":true}]", string);
+}
+
+TEST(lwjson, GenerateRollbackErrors)
+{
+    const unsigned int STRING_LEN = 40;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    TestFlushSink sink = {};
+    LwJsonWriteMark mark;
+    LwJsonWriteMark later;
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonStartArray(&testMsg);
+    lwJsonWriteMark(&testMsg, &mark);
+    lwJsonAddIntToArray(&testMsg, 1);
+    lwJsonWriteMark(&testMsg, &later);
+    lwJsonWriteRollback(&testMsg, &mark);
+
+    // Marks ahead of the writer are no longer valid
+    result = lwJsonWriteRollback(&testMsg, &later);
+    CHECK_EQUAL(-EPERM, result);
+
+    lwJsonCloseObject(&testMsg);
+    result = lwJsonWriteMark(&testMsg, &mark);
+    CHECK_EQUAL(-EPERM, result);
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetFlush(&testMsg, TestFlush, &sink);
+    result = lwJsonWriteMark(&testMsg, &mark);
+    CHECK_EQUAL(-EPERM, result);
+}
+
+static int TestWriteSample(LwJsonMsg *msg, void *context)
+{
+    int *sample = (int*)context;
+
+    lwJsonAddObjectToArray(msg);
+    lwJsonAddIntToObject(msg, "t", *sample);
+    return lwJsonCloseObject(msg);
+}
+
+TEST(lwjson, GenerateSplitArray)
+{
+    const unsigned int STRING_LEN = 44;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    TestFlushSink sink = {};
+    LwJsonSplitter split;
+    int result;
+    int i;
+
+    result = lwJsonSplitStart(&split, &testMsg, "\"dev\":7", "samples", "\"v\":1", TestFlush, &sink);
+    CHECK_EQUAL(0, result);
+    for (i = 0; i < 5; i++) {
+        result = lwJsonSplitAdd(&split, TestWriteSample, &i);
+        CHECK_EQUAL(0, result);
+    }
+    result = lwJsonSplitEnd(&split);
+
+    // Every message is a whole document within the size limit
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(3, sink.calls);
+    STRCMP_EQUAL("{\"dev\":7,\"samples\":[{\"t\":0},{\"t\":1}],\"v\":1}"
+                 "{\"dev\":7,\"samples\":[{\"t\":2},{\"t\":3}],\"v\":1}"
+                 "{\"dev\":7,\"samples\":[{\"t\":4}],\"v\":1}", sink.data);
+}
+
+TEST(lwjson, GenerateSplitArrayErrors)
+{
+    const unsigned int STRING_LEN = 24;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    TestFlushSink sink = {};
+    LwJsonSplitter split;
+    int sample = 1234567890;
+    int result;
+
+    // Element larger than an empty envelope
+    lwJsonSplitStart(&split, &testMsg, NULL, "samples", NULL, TestFlush, &sink);
+    result = lwJsonSplitAdd(&split, TestWriteSample, &sample);
+    CHECK_EQUAL(-ENOMEM, result);
+    result = lwJsonSplitEnd(&split);
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(0, sink.calls);
+
+    // Sink errors are returned to the caller
+    sample = 1;
+    sink.result = -EIO;
+    lwJsonSplitStart(&split, &testMsg, NULL, "samples", NULL, TestFlush, &sink);
+    lwJsonSplitAdd(&split, TestWriteSample, &sample);
+    result = lwJsonSplitEnd(&split);
+    CHECK_EQUAL(-EIO, result);
+
+    result = lwJsonSplitStart(&split, &testMsg, NULL, "samples", "\"suffix too long\":true", TestFlush, &sink);
+    CHECK_EQUAL(-ENOMEM, result);
+}
+
+TEST(lwjson, GenerateCbor)
+{
+    const unsigned int STRING_LEN = 64;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonMsg measureMsg = {};
+    LwJsonKey key = LWJSON_KEY("k");
+    const int64_t ints[] = {1000, INT64_MIN};
+    const uint8_t expected[] = {
+        0xBF,
+        0x61, 'a', 0x01,
+        0x61, 'b', 0x9F, 0x20, 0xF5, 0xF6, 0xFF,
+        0x61, 's', 0x62, 'h', 'i',
+        0x61, 'd', 0xFA, 0x3F, 0xC0, 0x00, 0x00,
+        0x61, 'e', 0xFB, 0x3F, 0xB9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9A,
+        0x61, 'k', 0xF4,
+        0x61, 'n', 0x9F, 0x19, 0x03, 0xE8, 0x3B, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF
+    };
+    uint32_t len = 0;
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetFormat(&testMsg, LWJSON_FORMAT_CBOR);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddIntToObject(&testMsg, "a", 1);
+    lwJsonAddArrayToObject(&testMsg, "b");
+    lwJsonAddIntToArray(&testMsg, -1);
+    lwJsonAddBooleanToArray(&testMsg, true);
+    lwJsonAddNullToArray(&testMsg);
+    lwJsonCloseArray(&testMsg);
+    lwJsonAddStringToObject(&testMsg, "s", "hi");
+    lwJsonAddDoubleToObject(&testMsg, "d", 1.5);
+    lwJsonAddFixedDoubleToObject(&testMsg, "e", 0.1, 2);
+    lwJsonAddBooleanToObjectKey(&testMsg, &key, false);
+    lwJsonAddIntArray(&testMsg, "n", ints, 2);
+    result = lwJsonWriteEnd(&testMsg);
+
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(sizeof(expected), testMsg._offset);
+    MEMCMP_EQUAL(expected, string, sizeof(expected));
+
+    // Measure gives the binary length as well
+    lwJsonMeasureStart(&measureMsg);
+    lwJsonWriteSetFormat(&measureMsg, LWJSON_FORMAT_CBOR);
+    lwJsonStartArray(&measureMsg);
+    lwJsonAddStringToArray(&measureMsg, "hi");
+    lwJsonAddDoubleToArray(&measureMsg, 0.1);
+    lwJsonMeasureEnd(&measureMsg, &len);
+    CHECK_EQUAL(1 + 3 + 9 + 1, len);
+
+    // JSON text can not be embedded
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetFormat(&testMsg, LWJSON_FORMAT_CBOR);
+    lwJsonStartObject(&testMsg);
+    result = lwJsonAppendObject(&testMsg, "raw", "{}");
+    CHECK_EQUAL(-EPERM, result);
+    result = lwJsonWriteSetFormat(&testMsg, LWJSON_FORMAT_JSON);
+    CHECK_EQUAL(-EPERM, result);
+}
+
+TEST(lwjson, ParseCbor)
+{
+    const unsigned int STRING_LEN = 80;
+    char string[STRING_LEN + 1];
+    LwJsonMsg testMsg = {string, STRING_LEN};
+    LwJsonMsg object;
+    const char *path[] = {NULL, NULL, NULL};
+    char *strings[2];
+    uint32_t stringLens[2];
+    int ints[3];
+    char value[8];
+    bool boolean = false;
+    int number = 0;
+    int result;
+
+    lwJsonWriteStart(&testMsg);
+    lwJsonWriteSetFormat(&testMsg, LWJSON_FORMAT_CBOR);
+    lwJsonStartObject(&testMsg);
+    lwJsonAddStringToObject(&testMsg, "name", "sensor");
+    lwJsonAddObjectToObject(&testMsg, "data");
+    lwJsonAddIntToObject(&testMsg, "temp", -40);
+    lwJsonAddBooleanToObject(&testMsg, "ok", true);
+    lwJsonCloseObject(&testMsg);
+    lwJsonAddArrayToObject(&testMsg, "ids");
+    lwJsonAddIntToArray(&testMsg, 7);
+    lwJsonAddIntToArray(&testMsg, 70000);
+    lwJsonCloseArray(&testMsg);
+    lwJsonAddArrayToObject(&testMsg, "tags");
+    lwJsonAddStringToArray(&testMsg, "x");
+    lwJsonAddStringToArray(&testMsg, "yz");
+    lwJsonWriteEnd(&testMsg);
+    testMsg.len = testMsg._offset;
+
+    // Same lookups as for JSON text
+    path[0] = "name";
+    result = lwJsonGetString(path, &testMsg, value, sizeof(value) - 1);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("sensor", value);
+
+    path[0] = "data";
+    path[1] = "temp";
+    result = lwJsonGetInt(path, &testMsg, &number);
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(-40, number);
+
+    path[1] = NULL;
+    result = lwJsonGetObject(path, &testMsg, &object);
+    CHECK_EQUAL(0, result);
+    path[0] = "ok";
+    result = lwJsonGetBool(path, &object, &boolean);
+    CHECK_EQUAL(0, result);
+    CHECK(boolean);
+
+    path[0] = "ids";
+    result = lwJsonGetArrayLen(path, &testMsg);
+    CHECK_EQUAL(2, result);
+    result = lwJsonGetIntArray(path, &testMsg, ints, 3);
+    CHECK_EQUAL(2, result);
+    CHECK_EQUAL(70000, ints[1]);
+    path[1] = "[1]";
+    result = lwJsonGetInt(path, &testMsg, &number);
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(70000, number);
+
+    path[0] = "tags";
+    path[1] = NULL;
+    result = lwJsonGetStringArray(path, &testMsg, strings, stringLens, 2);
+    CHECK_EQUAL(2, result);
+    CHECK_EQUAL(2, stringLens[1]);
+    MEMCMP_EQUAL("yz", strings[1], 2);
+
+    path[0] = "missing";
+    result = lwJsonGetInt(path, &testMsg, &number);
+    CHECK_EQUAL(-ENOENT, result);
+    path[0] = "name";
+    result = lwJsonGetInt(path, &testMsg, &number);
+    CHECK_EQUAL(-EPERM, result);
+}
+
+TEST(lwjson, ParseCborDefiniteLength)
+{
+    // {"a": 1, "b": [2, 3], "c": "d" in two chunks} with a self-described CBOR tag
+    char testString[] = "\xD9\xD9\xF7\xA3\x61" "a" "\x01\x61" "b" "\x82\x02\x03\x61" "c" "\x7F\x61" "d" "\x62" "ef" "\xFF";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    const char *path[] = {NULL, NULL, NULL};
+    char value[4];
+    int number = 0;
+    int result;
+
+    path[0] = "b";
+    path[1] = "[1]";
+    result = lwJsonGetInt(path, &testMsg, &number);
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(3, number);
+
+    path[1] = "[2]";
+    result = lwJsonGetInt(path, &testMsg, &number);
+    CHECK_EQUAL(-ENOENT, result);
+
+    path[0] = "c";
+    path[1] = NULL;
+    result = lwJsonGetString(path, &testMsg, value, sizeof(value) - 1);
+    CHECK_EQUAL(0, result);
+    STRCMP_EQUAL("def", value);
+    result = lwJsonGetString(path, &testMsg, value, 2);
+    CHECK_EQUAL(-ENOMEM, result);
+
+    // Truncated message
+    testMsg.len -= 2;
+    path[0] = "a";
+    result = lwJsonGetInt(path, &testMsg, &number);
+    CHECK_EQUAL(-EPERM, result);
+}
+
+#if LWJSON_STATS
+static void TestTrace(void *context, LwJsonTraceEvent event, uint32_t arg)
+{
+    uint32_t *events = (uint32_t*)context;
+
+    (void)arg;
+    events[event]++;
+}
+
+TEST(lwjson, StatsAndTrace)
+{
+    char testString[] = "{\"a\":{\"x\":1},\"a\":{\"y\":2}}";
+    LwJsonMsg testMsg = {testString, sizeof(testString) - 1};
+    const char* path[] = {"a", "y", NULL};
+    const unsigned int STRING_LEN = 32;
+    char string[STRING_LEN + 1];
+    LwJsonMsg writeMsg = {string, STRING_LEN};
+    uint32_t events[LWJSON_TRACE_WRITE_GROW + 1] = {0};
+    LwJsonStats stats;
+    int number = 0;
+
+    lwJsonStatsReset();
+    lwJsonSetTrace(TestTrace, events);
+
+    // The first "a" matches partially, so the search restarts at its end
+    CHECK_EQUAL(0, lwJsonGetInt(path, &testMsg, &number));
+    CHECK_EQUAL(2, number);
+    lwJsonStatsGet(&stats);
+    CHECK_EQUAL(sizeof(testString) - 1, stats.bytesScanned);
+    CHECK_EQUAL(3, stats.stackPushes);
+    CHECK_EQUAL(1, stats.rescans);
+    CHECK(stats.stateTransitions > 0);
+    CHECK_EQUAL(1, events[LWJSON_TRACE_FIND_START]);
+    CHECK_EQUAL(3, events[LWJSON_TRACE_FIND_PUSH]);
+    CHECK_EQUAL(1, events[LWJSON_TRACE_FIND_RESCAN]);
+    CHECK_EQUAL(1, events[LWJSON_TRACE_FIND_END]);
+
+    // Malformed input still counts what was scanned and ends the trace
+    char badString[] = "{\"a\":x,\"y\":2}";
+    LwJsonMsg badMsg = {badString, sizeof(badString) - 1};
+    lwJsonStatsReset();
+    CHECK_EQUAL(-EPERM, lwJsonGetInt(path, &badMsg, &number));
+    lwJsonStatsGet(&stats);
+    CHECK_EQUAL(7, stats.bytesScanned);
+    CHECK_EQUAL(2, events[LWJSON_TRACE_FIND_START]);
+    CHECK_EQUAL(2, events[LWJSON_TRACE_FIND_END]);
+
+    lwJsonWriteStart(&writeMsg);
+    lwJsonStartObject(&writeMsg);
+    lwJsonAddStringToObject(&writeMsg, "name", "value");
+    CHECK_EQUAL(0, lwJsonWriteEnd(&writeMsg));
+    lwJsonStatsGet(&stats);
+    CHECK_EQUAL(strlen(string), stats.bytesWritten);
+    CHECK_EQUAL(2, stats.stringsCopied);
+    CHECK_EQUAL(0, stats.enomemRetries);
+
+    // Every grow of a writer started without buffer is a retry
+    LwJsonMsg growMsg = {NULL, 0};
+    int grows = 0;
+    lwJsonStatsReset();
+    lwJsonWriteStart(&growMsg);
+    lwJsonWriteSetAllocator(&growMsg, TestRealloc, &grows);
+    lwJsonStartArray(&growMsg);
+    for (int i = 0; i < 40; i++) {
+        lwJsonAddIntToArray(&growMsg, 1000000 + i);
+    }
+    lwJsonCloseArray(&growMsg);
+    CHECK_EQUAL(0, lwJsonWriteEnd(&growMsg));
+    free(growMsg.string);
+    lwJsonStatsGet(&stats);
+    CHECK_EQUAL(4, grows);
+    CHECK_EQUAL(4, stats.enomemRetries);
+    CHECK_EQUAL(4, events[LWJSON_TRACE_WRITE_GROW]);
+
+    // Flushes when full are retries, the final one in lwJsonWriteEnd is not
+    char flushString[LWJSON_FLUSH_LEN_MIN + 1];
+    LwJsonMsg flushMsg = {flushString, LWJSON_FLUSH_LEN_MIN};
+    TestFlushSink sink;
+    memset(&sink, 0, sizeof(sink));
+    lwJsonStatsReset();
+    lwJsonWriteStart(&flushMsg);
+    lwJsonWriteSetFlush(&flushMsg, TestFlush, &sink);
+    lwJsonStartArray(&flushMsg);
+    for (int i = 0; i < 40; i++) {
+        lwJsonAddIntToArray(&flushMsg, 1000 + i);
+    }
+    lwJsonCloseArray(&flushMsg);
+    CHECK_EQUAL(0, lwJsonWriteEnd(&flushMsg));
+    lwJsonStatsGet(&stats);
+    CHECK_EQUAL(sink.len, stats.bytesWritten);
+    CHECK_EQUAL(events[LWJSON_TRACE_WRITE_FLUSH] - 1, stats.enomemRetries);
+    CHECK(stats.enomemRetries > 0);
+
+    lwJsonSetTrace(NULL, NULL);
+    lwJsonStatsReset();
+    lwJsonStatsGet(&stats);
+    CHECK_EQUAL(0, stats.bytesScanned);
+}
+#endif